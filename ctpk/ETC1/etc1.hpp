@@ -1,6 +0,0 @@
-#ifndef ETC1_HPP
-#define ETC1_HPP
-
-extern "C" void unpackETC1Block(void* etc1Block, unsigned int* dstPixels, int preserveAlpha);
-
-#endif
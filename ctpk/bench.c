@@ -0,0 +1,347 @@
+#define _GNU_SOURCE // nftw
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ftw.h>
+#include <unistd.h>
+
+#include "ctpkProcess.h"
+
+#include "common.h"
+
+// Reproducible benchmark for the CTPK pipeline. Every corpus is generated
+// from a fixed seed & encoded with rg_etc1, so results are comparable
+// between builds & machines.
+//
+// Output is one TSV row per corpus and operation:
+//   corpus  op  textures  bytes  runs  median_ms  mib_s
+//
+// encode-<quality>-<simd> rows time the ETC1 encoder alone with each error
+// kernel the CPU supports; their output is checked against the scalar one.
+
+#define BENCH_RUNS 3
+
+typedef struct {
+    const char* name;
+
+    u32 dataFormat;
+    u16 size; // Textures are size x size
+    u16 textureCount;
+
+    u16 encodeTextureCount; // Textures used for the encode-* rows; 0 to skip
+} BenchCorpus;
+
+static const BenchCorpus corpora[] = {
+    { "etc1-64", 0x0C, 64, 32, 2 },
+    { "etc1-256", 0x0C, 256, 4, 0 },
+    { "etc1-1024", 0x0C, 1024, 1, 0 },
+    { "etc1a4-64", 0x0D, 64, 32, 0 },
+    { "etc1a4-256", 0x0D, 256, 4, 0 },
+    { "etc1a4-1024", 0x0D, 1024, 1, 0 }
+};
+
+typedef struct {
+    const char* name;
+    int level;
+} BenchSimdLevel;
+
+static const BenchSimdLevel simdLevels[] = {
+    { "scalar", ETC1_SIMD_NONE },
+    { "sse4.1", ETC1_SIMD_SSE41 },
+    { "avx2", ETC1_SIMD_AVX2 }
+};
+
+typedef struct {
+    const char* name;
+    int quality;
+} BenchQuality;
+
+static const BenchQuality encodeQualities[] = {
+    { "medium", ETC1_QUALITY_MEDIUM },
+    { "high", ETC1_QUALITY_HIGH }
+};
+
+typedef struct {
+    u32 state;
+} BenchRandom;
+
+static inline u32 BenchNext(BenchRandom* random) {
+    u32 x = random->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return random->state = x;
+}
+
+// UI-like content: flat panels, gradients & noisy detail with an alpha ramp.
+void BenchFillImage(BenchRandom* random, u32* pixels, u16 size) {
+    for (u32 y = 0; y < size; y++) {
+        for (u32 x = 0; x < size; x++) {
+            u32 region = ((x / 32) + (y / 32) * 3) % 4;
+
+            u8 r, g, b;
+            if (region == 0) {
+                r = 0x30; g = 0x80; b = 0xC0;
+            }
+            else if (region == 1) {
+                r = (u8)(x * 255 / size); g = (u8)(y * 255 / size); b = 0x40;
+            }
+            else {
+                u32 noise = BenchNext(random);
+                r = (u8)noise; g = (u8)(noise >> 8); b = (u8)(noise >> 16);
+            }
+
+            u8 a = region == 3 ? 0 : (u8)(0xFF - (x * 0x7F / size));
+
+            pixels[y * size + x] = r | (g << 8) | (b << 16) | ((u32)a << 24);
+        }
+    }
+}
+
+typedef struct {
+    u32* pixels; // One size x size image per texture
+    CtpkBuildTexture* textures;
+} BenchSource;
+
+BenchSource BenchGenerateSource(const BenchCorpus* corpus) {
+    BenchRandom random = { 0x9E3779B9 };
+    BenchSource source;
+
+    u32 pixelCount = (u32)corpus->size * corpus->size;
+
+    source.pixels = (u32*)malloc(sizeof(u32) * pixelCount * corpus->textureCount);
+    source.textures = (CtpkBuildTexture*)malloc(sizeof(CtpkBuildTexture) * corpus->textureCount);
+    if (!source.pixels || !source.textures)
+        PANIC_MALLOC("bench source");
+
+    for (u32 i = 0; i < corpus->textureCount; i++) {
+        CtpkBuildTexture* texture = source.textures + i;
+
+        char path[64];
+        snprintf(path, sizeof(path), "bench/%s_%03u.tga", corpus->name, i);
+
+        texture->path = strdup(path);
+        texture->dataFormat = corpus->dataFormat;
+        texture->width = corpus->size;
+        texture->height = corpus->size;
+        texture->srcTimestamp = 1500000000 + i;
+        texture->dataSize = corpus->dataFormat == 0x0C ? pixelCount / 2 : pixelCount;
+        texture->data = (u8*)malloc(texture->dataSize);
+        if (!texture->path || !texture->data)
+            PANIC_MALLOC("bench texture");
+
+        BenchFillImage(&random, source.pixels + pixelCount * i, corpus->size);
+    }
+
+    return source;
+}
+
+int BenchCompareDouble(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+
+    return (da > db) - (da < db);
+}
+
+void BenchReport(const BenchCorpus* corpus, const char* op, u32 textureCount, u64 bytes, double* times) {
+    qsort(times, BENCH_RUNS, sizeof(double), BenchCompareDouble);
+    double median = times[BENCH_RUNS / 2];
+
+    printf(
+        "%s\t%s\t%u\t%lu\t%u\t%.3f\t%.1f\n",
+        corpus->name, op, textureCount, bytes, BENCH_RUNS,
+        median * 1000.0, median > 0.0 ? bytes / (1024.0 * 1024.0) / median : 0.0
+    );
+    fflush(stdout);
+}
+
+CtpkBuildResult BenchConstruct(const BenchCorpus* corpus, BenchSource* source) {
+    u32 pixelCount = (u32)corpus->size * corpus->size;
+
+    for (u32 i = 0; i < corpus->textureCount; i++) {
+        CtpkBuildTexture* texture = source->textures + i;
+
+        ImageEncodeFunction function =
+            corpus->dataFormat == 0x0C ? EncodeETC1 : EncodeETC1A4;
+        function(
+            (u32*)texture->data, source->pixels + pixelCount * i,
+            texture->width, texture->height, ETC1_QUALITY_LOW
+        );
+    }
+
+    return CtpkBuild(source->textures, corpus->textureCount);
+}
+
+// Encodes the first encodeTextureCount textures at each quality with every
+// supported error kernel.
+void BenchEncodeSimdLevels(const BenchCorpus* corpus, BenchSource* source) {
+    u32 pixelCount = (u32)corpus->size * corpus->size;
+    u32 textureCount = corpus->encodeTextureCount;
+
+    u32 dataSize = source->textures[0].dataSize;
+    u8* reference = (u8*)malloc(dataSize * textureCount);
+    if (!reference)
+        PANIC_MALLOC("bench reference");
+
+    int defaultLevel = packETC1BlockGetSimdLevel();
+
+    for (u32 q = 0; q < sizeof(encodeQualities) / sizeof(encodeQualities[0]); q++) {
+        for (u32 l = 0; l < sizeof(simdLevels) / sizeof(simdLevels[0]); l++) {
+            if (!packETC1BlockSetSimdLevel(simdLevels[l].level))
+                continue;
+
+            double times[BENCH_RUNS];
+            for (u32 run = 0; run < BENCH_RUNS; run++) {
+                double start = getTimeSeconds();
+
+                for (u32 i = 0; i < textureCount; i++) {
+                    CtpkBuildTexture* texture = source->textures + i;
+
+                    ImageEncodeFunction function =
+                        corpus->dataFormat == 0x0C ? EncodeETC1 : EncodeETC1A4;
+                    function(
+                        (u32*)texture->data, source->pixels + pixelCount * i,
+                        texture->width, texture->height, encodeQualities[q].quality
+                    );
+                }
+
+                times[run] = getTimeSeconds() - start;
+            }
+
+            for (u32 i = 0; i < textureCount; i++) {
+                u8* expected = reference + dataSize * i;
+
+                if (simdLevels[l].level == ETC1_SIMD_NONE)
+                    memcpy(expected, source->textures[i].data, dataSize);
+                else if (memcmp(expected, source->textures[i].data, dataSize) != 0)
+                    panic("SIMD encoder output differs from the scalar encoder");
+            }
+
+            char op[64];
+            snprintf(op, sizeof(op), "encode-%s-%s", encodeQualities[q].name, simdLevels[l].name);
+
+            BenchReport(corpus, op, textureCount, (u64)pixelCount * 4 * textureCount, times);
+        }
+    }
+
+    packETC1BlockSetSimdLevel(defaultLevel);
+    free(reference);
+}
+
+void BenchDecode(const CtrCtpk* ctpk) {
+    u16 textureCount = CtrCtpkGetTextureCount(ctpk);
+    for (u16 i = 0; i < textureCount; i++) {
+        size_t bufferSize;
+        u32* buffer;
+
+        if (CtrCtpkDecodeTexture(ctpk, i, &buffer, &bufferSize) != CTR_OK)
+            panic("Texture decode failed");
+
+        CtrFree(NULL, buffer);
+    }
+}
+
+void BenchExtract(const CtrCtpk* ctpk) {
+    DecodeScratch scratch;
+    DecodeScratchInit(&scratch);
+    DecodeScratchReserve(&scratch, CtrCtpkGetMaxDecodedSize(ctpk));
+
+    u16 textureCount = CtrCtpkGetTextureCount(ctpk);
+    for (u16 i = 0; i < textureCount; i++)
+        CtpkExportTexture(ctpk, i, &scratch, NULL);
+
+    DecodeScratchFree(&scratch);
+}
+
+int I_BenchRemoveEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    return remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    logStream = stderr;
+    logLevel = LOG_LEVEL_QUIET;
+
+    packETC1BlockInit();
+
+    FILE* fpNull = fopen("/dev/null", "wb");
+    if (fpNull == NULL)
+        panic("Could not open /dev/null");
+
+    // CtpkExportTexture writes to the working directory
+    char tempDir[] = "/tmp/ctpkt-bench-XXXXXX";
+    if (mkdtemp(tempDir) == NULL || chdir(tempDir) != 0)
+        panic("Could not create a temporary directory");
+
+    printf("corpus\top\ttextures\tbytes\truns\tmedian_ms\tmib_s\n");
+
+    for (u32 c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        const BenchCorpus* corpus = corpora + c;
+        double times[BENCH_RUNS];
+
+        BenchSource source = BenchGenerateSource(corpus);
+
+        u64 pixelBytes = (u64)corpus->size * corpus->size * 4 * corpus->textureCount;
+
+        CtpkBuildResult ctpk;
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            ctpk = BenchConstruct(corpus, &source);
+
+            times[run] = getTimeSeconds() - start;
+
+            if (run + 1 != BENCH_RUNS)
+                free(ctpk.ptr);
+        }
+        BenchReport(corpus, "construct", corpus->textureCount, pixelBytes, times);
+
+        CtrCtpk* ctpkHandle = CtpkOpen(ctpk.ptr, ctpk.size);
+
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            BenchDecode(ctpkHandle);
+
+            times[run] = getTimeSeconds() - start;
+        }
+        BenchReport(corpus, "decode", corpus->textureCount, pixelBytes, times);
+
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            CtpkListTextures(ctpkHandle, fpNull, LIST_FORMAT_NDJSON);
+
+            times[run] = getTimeSeconds() - start;
+        }
+        BenchReport(corpus, "list", corpus->textureCount, ctpk.size, times);
+
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            BenchExtract(ctpkHandle);
+
+            times[run] = getTimeSeconds() - start;
+        }
+        BenchReport(corpus, "extract", corpus->textureCount, pixelBytes, times);
+
+        if (corpus->encodeTextureCount)
+            BenchEncodeSimdLevels(corpus, &source);
+
+        CtrCtpkClose(ctpkHandle);
+        free(ctpk.ptr);
+
+        for (u32 i = 0; i < corpus->textureCount; i++) {
+            free(source.textures[i].path);
+            free(source.textures[i].data);
+        }
+        free(source.textures);
+        free(source.pixels);
+    }
+
+    nftw(tempDir, I_BenchRemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    fclose(fpNull);
+
+    return 0;
+}
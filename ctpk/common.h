@@ -30,25 +30,66 @@ typedef signed char s8;
 
 #define INDENT_SPACE "    "
 
-#define LOG_OK printf(" OK\n")
+typedef enum {
+    LOG_LEVEL_QUIET, // Errors only (-q)
+    LOG_LEVEL_NORMAL, // Phase messages & progress bar
+    LOG_LEVEL_VERBOSE // Every step & every file (-v)
+} LogLevel;
+
+LogLevel logLevel = LOG_LEVEL_NORMAL;
+
+// Destination for status messages. Stays stdout unless stdout is carrying
+// machine-readable output, in which case main switches it to stderr.
+FILE* logStream;
+
+#define LOG(...) do { \
+    if (logLevel >= LOG_LEVEL_NORMAL) fprintf(logStream, __VA_ARGS__); \
+} while (0)
+#define LOG_OK LOG(" OK\n")
+
+#define LOG_VERBOSE(...) do { \
+    if (logLevel >= LOG_LEVEL_VERBOSE) fprintf(logStream, __VA_ARGS__); \
+} while (0)
+#define LOG_VERBOSE_OK LOG_VERBOSE(" OK\n")
+
+// Warnings & errors always go to stderr; only warnings are silenced by -q.
+#define LOG_WARN(...) do { \
+    if (logLevel >= LOG_LEVEL_NORMAL) fprintf(stderr, __VA_ARGS__); \
+} while (0)
+#define LOG_ERROR(...) fprintf(stderr, __VA_ARGS__)
 
 void panic(const char* msg) {
-    printf("\nPANIC: %s\nExiting ..\n", msg);
+    fflush(stdout);
+    fprintf(stderr, "\nPANIC: %s\nExiting ..\n", msg);
     exit(1);
 }
 
-char* getFilename(char* path) {
-    char* lastSlash = strrchr(path, '/');
+#define PANIC_MALLOC(msg) panic("Failed to allocate memory (" msg ")")
+
+// Monotonic time in seconds, for progress & timing.
+double getTimeSeconds(void) {
+    struct timespec ts;
+    #ifdef _WIN32
+    timespec_get(&ts, TIME_UTC);
+    #else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    #endif
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+const char* getFilename(const char* path) {
+    const char* lastSlash = strrchr(path, '/');
     if (!lastSlash)
         lastSlash = strrchr(path, '\\');
 
     if (!lastSlash)
         return path;
 
-    return (char*)(lastSlash + 1);
+    return lastSlash + 1;
 }
 
-void setFileTimestamp(char* path, u32 timestamp) {
+void setFileTimestamp(const char* path, u32 timestamp) {
     struct utimbuf lTime;
 
     lTime.actime = timestamp;
@@ -9,63 +9,24 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 
+#include "ctrtools.h"
+#include "ctrFormats.h"
+
 #include "imageProcess.h"
+#include "listWriter.h"
+#include "tarWriter.h"
+#include "stats.h"
 
 #include "common.h"
 
 #include <utime.h>
 #include <time.h>
 
-#define CTPK_MAGIC 0x4B505443 // "CTPK"
-
-typedef struct {
-    u32 magic; // Compare to CTPK_MAGIC
-    u16 version;
-
-    u16 textureCount;
-
-    u32 textureSectionOffset; // Offset to the texture section.
-    u32 textureSectionSize; // Size of the texture section.
-
-    u32 hashSectionOffset; // Offset to the hash section.
-
-    u32 textureInfoSection;
-
-    u64 pad64;
-} CtpkFileHeader;
-
-typedef struct {
-    u32 pathOffset; // Offset to file path
-
-    u32 dataSize; // Size of texture data.
-    u32 dataOffset; // Offset to texture data (relative to texture data block offset)
-    u32 dataFormat; // Texture data format.
-
-    u16 width; // Texture width
-    u16 height; // Texture height
-
-    u8 mipLevel; // Mipmap level
-    u8 type; // 0: Cube Map, 1: 1D, 2: 2D
-
-    u16 cubeDir;
-
-    u32 bitmapSizeOffset; // Relative to to this block
-
-    u32 srcTimestamp; // Unix timestamp of source texture.
-} TextureEntry;
-
-typedef struct {
-    u32 pathHash; // CRC32 hash of the file path.
-
-    u32 index;
-} HashBlockEntry;
+#include <zlib.h>
 
-typedef struct {
-    u8 textureFormat;
-    u8 mipLevel;
-    u8 compressed;
-    u8 compressionMethod;
-} TextureContextEntry;
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 /*
     Texture Formats:
@@ -85,123 +46,346 @@ typedef struct {
         ETC1A4 = 0x0D
 */
 
-void I_CtpkConvertTexture(u32** bufferOut, u32* sizeOut, const TextureEntry* textureInfoEntry, const CtpkFileHeader* fileHeader) {
-    const u32* dataIn = (const u32*)(
-        (u8*)fileHeader + fileHeader->textureSectionOffset +
-	textureInfoEntry->dataOffset
-    );
+StatsPhase statsDecode = { "ETC1 decode" };
+StatsPhase statsImageEncode = { "image encode" };
+StatsPhase statsFileWrite = { "file write" };
+
+typedef struct {
+    u8* ptr;
+    u32 size;
+    u32 capacity;
+} ImageFileBuffer;
 
-    ImageProcessFunction function;
-    switch (textureInfoEntry->dataFormat) {
-    case 0x0C:
-	function = ProcessETC1;
-	break;
-    case 0x0D:
-	function = ProcessETC1A4;
-	break;
-
-    default:
-	panic("Texture format not implemented");
+void I_ImageFileBufferWrite(void* context, void* data, int size) {
+    ImageFileBuffer* fileBuffer = (ImageFileBuffer*)context;
+
+    if (fileBuffer->size + size > fileBuffer->capacity) {
+        u32 newCapacity = fileBuffer->capacity ? fileBuffer->capacity * 2 : 4096;
+        while (newCapacity < fileBuffer->size + size)
+            newCapacity *= 2;
+
+        fileBuffer->ptr = (u8*)realloc(fileBuffer->ptr, newCapacity);
+        if (fileBuffer->ptr == NULL)
+            PANIC_MALLOC("image file buf");
+
+        fileBuffer->capacity = newCapacity;
     }
 
-    function(
-        bufferOut, sizeOut, dataIn,
-        textureInfoEntry->width, textureInfoEntry->height
-    );
+    memcpy(fileBuffer->ptr + fileBuffer->size, data, size);
+    fileBuffer->size += size;
 }
 
-void CtpkLogTextureNames(const u8* ctpkData) {
-    CtpkFileHeader* fileHeader = (CtpkFileHeader*)ctpkData;
-    
-    if (fileHeader->magic != CTPK_MAGIC)
-        panic("CTPK header magic is nonmatching");
+/*
+    Decoded pixels & the encoded image only live until the file is written,
+    so exports reuse one scratch buffer of each instead of allocating (and
+    page-faulting in) fresh ones per texture. The pixel buffer is reserved
+    for the largest texture in the archive up front; big buffers are aligned
+    to 2 MiB & marked for transparent huge pages. One scratch per thread.
+*/
 
-    printf("Textures: \n");
+#define DECODE_SCRATCH_ALIGN 64
+#define DECODE_SCRATCH_HUGE_PAGE (2 * 1024 * 1024)
 
-    for (u32 i = 0; i < fileHeader->textureCount; i++) {
-        TextureEntry* textureInfoEntry =
-            (TextureEntry*)(fileHeader + 1) + i;
+typedef struct {
+    u32* pixels;
+    size_t capacity;
 
-        printf(INDENT_SPACE "%d. %s\n", i + 1, ctpkData + textureInfoEntry->pathOffset);
-    }
+    ImageFileBuffer fileBuffer;
+} DecodeScratch;
+
+void DecodeScratchInit(DecodeScratch* scratch) {
+    scratch->pixels = NULL;
+    scratch->capacity = 0;
+
+    scratch->fileBuffer.ptr = NULL;
+    scratch->fileBuffer.size = 0;
+    scratch->fileBuffer.capacity = 0;
 }
 
-u16 CtpkGetTextureCount(const u8* ctpkData) {
-    CtpkFileHeader* fileHeader = (CtpkFileHeader*)ctpkData;
+void DecodeScratchFree(DecodeScratch* scratch) {
+    #ifdef _WIN32
+    _aligned_free(scratch->pixels);
+    #else
+    free(scratch->pixels);
+    #endif
 
-    if (fileHeader->magic != CTPK_MAGIC)
-        panic("CTPK header magic is nonmatching");
+    free(scratch->fileBuffer.ptr);
 
-    return fileHeader->textureCount;
+    DecodeScratchInit(scratch);
 }
 
-TextureEntry* CtpkGetTextureFromIndex(const u8* ctpkData, u16 textureIndex) {
-    CtpkFileHeader* fileHeader = (CtpkFileHeader*)ctpkData;
+// Grows the pixel buffer to at least size bytes; contents are not kept.
+void DecodeScratchReserve(DecodeScratch* scratch, size_t size) {
+    if (size <= scratch->capacity)
+        return;
 
-    if (fileHeader->magic != CTPK_MAGIC)
-        panic("CTPK header magic is nonmatching");
+    size_t align = size >= DECODE_SCRATCH_HUGE_PAGE ? DECODE_SCRATCH_HUGE_PAGE : DECODE_SCRATCH_ALIGN;
+    size_t capacity = (size + align - 1) & ~(align - 1);
 
-    if (textureIndex >= fileHeader->textureCount)
-        return NULL;
+    #ifdef _WIN32
+    _aligned_free(scratch->pixels);
+    scratch->pixels = (u32*)_aligned_malloc(capacity, align);
+    #else
+    free(scratch->pixels);
+    if (posix_memalign((void**)&scratch->pixels, align, capacity) != 0)
+        scratch->pixels = NULL;
+    #endif
 
-    return (TextureEntry*)(fileHeader + 1) + textureIndex;
-}
+    if (scratch->pixels == NULL)
+        PANIC_MALLOC("decode scratch");
 
-char* CtpkGetPathFromTextureIndex(const u8* ctpkData, u16 textureIndex) {
-    CtpkFileHeader* fileHeader = (CtpkFileHeader*)ctpkData;
+    #ifdef MADV_HUGEPAGE
+    if (align == DECODE_SCRATCH_HUGE_PAGE)
+        madvise(scratch->pixels, capacity, MADV_HUGEPAGE); // Advisory only
+    #endif
 
-    if (fileHeader->magic != CTPK_MAGIC)
-        panic("CTPK header magic is nonmatching");
+    scratch->capacity = capacity;
+}
 
-    if (textureIndex >= fileHeader->textureCount)
-        return NULL;
+CtrCtpk* CtpkOpen(const u8* ctpkData, u32 ctpkSize) {
+    CtrCtpk* ctpk;
 
-    TextureEntry* textureInfoEntry =
-        (TextureEntry*)(fileHeader + 1) + textureIndex;
+    CtrStatus status = CtrCtpkOpen(NULL, ctpkData, ctpkSize, &ctpk);
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
 
-    return (char*)(ctpkData + textureInfoEntry->pathOffset);
+    return ctpk;
 }
 
-TextureEntry* CtpkFindTextureFromPath(const u8* ctpkData, char* path) {
-    CtpkFileHeader* fileHeader = (CtpkFileHeader*)ctpkData;
+CtrCtpkTexture CtpkGetTexture(const CtrCtpk* ctpk, u32 index) {
+    CtrCtpkTexture texture;
 
-    if (fileHeader->magic != CTPK_MAGIC)
-        panic("CTPK header magic is nonmatching");
+    CtrStatus status = CtrCtpkGetTexture(ctpk, index, &texture);
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
 
-    for (u32 i = 0; i < fileHeader->textureCount; i++) {
-        TextureEntry* textureInfoEntry =
-            (TextureEntry*)(fileHeader + 1) + i;
+    return texture;
+}
 
-        if (strcmp(path, (char*)ctpkData + textureInfoEntry->pathOffset) == 0)
-            return textureInfoEntry;
+void CtpkLogTextureNames(const CtrCtpk* ctpk) {
+    printf("Textures: \n");
+
+    for (u32 i = 0; i < CtrCtpkGetTextureCount(ctpk); i++)
+        printf(INDENT_SPACE "%d. %s\n", i + 1, CtpkGetTexture(ctpk, i).path);
+}
+
+void CtpkListTextures(const CtrCtpk* ctpk, FILE* fp, ListFormat format) {
+    static const char* const columns[] = {
+        "path", "format", "width", "height", "mipCount",
+        "dataOffset", "dataSize", "timestamp"
+    };
+
+    ListWriter writer;
+    ListBegin(&writer, fp, format, columns, 8);
+
+    for (u32 i = 0; i < CtrCtpkGetTextureCount(ctpk); i++) {
+        CtrCtpkTexture texture = CtpkGetTexture(ctpk, i);
+
+        ListRecordBegin(&writer);
+        ListFieldString(&writer, "path", texture.path);
+        ListFieldString(&writer, "format", CtrCtpkFormatName(texture.format));
+        ListFieldU64(&writer, "width", texture.width);
+        ListFieldU64(&writer, "height", texture.height);
+        ListFieldU64(&writer, "mipCount", texture.mipCount);
+        ListFieldU64(&writer, "dataOffset", texture.dataOffset);
+        ListFieldU64(&writer, "dataSize", texture.dataSize);
+        ListFieldU64(&writer, "timestamp", texture.timestamp);
+        ListRecordEnd(&writer);
     }
 
-    return NULL;
+    ListEnd(&writer);
 }
 
-void CtpkExportTexture(const u8* ctpkData, TextureEntry* entry) {
-    CtpkFileHeader* fileHeader = (CtpkFileHeader*)ctpkData;
+// The scratch may be NULL for a one-off export. With a tar writer the image
+// becomes a member of its stream instead of a file in the working directory.
+void CtpkExportTexture(const CtrCtpk* ctpk, u32 index, DecodeScratch* scratch, TarWriter* tar) {
+    CtrCtpkTexture texture = CtpkGetTexture(ctpk, index);
+
+    DecodeScratch localScratch;
+    if (scratch == NULL) {
+        DecodeScratchInit(&localScratch);
+        scratch = &localScratch;
+    }
+
+    size_t bufferSize;
+
+    double statsTime = StatsBegin();
 
-    if (fileHeader->magic != CTPK_MAGIC)
-        panic("CTPK header magic is nonmatching");
+    DecodeScratchReserve(scratch, CtrCtpkGetDecodedSize(ctpk, index));
+
+    CtrStatus status = CtrCtpkDecodeTextureInto(
+        ctpk, index, scratch->pixels, scratch->capacity, &bufferSize
+    );
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
 
-    u32 bufferSize;
-    u32* buffer;
+    StatsEnd(&statsDecode, statsTime, texture.dataSize, bufferSize);
 
-    I_CtpkConvertTexture(&buffer, &bufferSize, entry, fileHeader);
+    const char* filename = getFilename(texture.path);
 
-    char* filename = getFilename((char*)ctpkData + entry->pathOffset);
+    // Encode in memory first so the file is written in one go
+    ImageFileBuffer* fileBuffer = &scratch->fileBuffer;
+    fileBuffer->size = 0;
 
-    if (stbi_write_tga(
-        filename,
-        entry->width, entry->height,
-        4, buffer
+    statsTime = StatsBegin();
+
+    if (stbi_write_tga_to_func(
+        I_ImageFileBufferWrite, fileBuffer,
+        texture.width, texture.height,
+        4, scratch->pixels
     ) == 0)
         panic("Image write failed");
 
-    setFileTimestamp(filename, entry->srcTimestamp);
+    StatsEnd(&statsImageEncode, statsTime, bufferSize, fileBuffer->size);
+
+    statsTime = StatsBegin();
+
+    if (tar)
+        TarAddFile(tar, filename, fileBuffer->ptr, fileBuffer->size, texture.timestamp);
+    else {
+        FILE* fpOut = fopen(filename, "wb");
+        if (fpOut == NULL)
+            panic("The output image could not be opened.");
+
+        if (fwrite(fileBuffer->ptr, 1, fileBuffer->size, fpOut) != fileBuffer->size) {
+            fclose(fpOut);
+
+            panic("Image write failed");
+        }
+
+        fclose(fpOut);
+
+        setFileTimestamp(filename, texture.timestamp);
+    }
+
+    StatsEnd(&statsFileWrite, statsTime, fileBuffer->size, fileBuffer->size);
+
+    if (scratch == &localScratch)
+        DecodeScratchFree(&localScratch);
+}
+
+typedef struct {
+    u8* ptr;
+    u32 size;
+} CtpkBuildResult;
+
+typedef struct {
+    char* path;
+
+    u32 dataFormat;
+    u16 width;
+    u16 height;
+
+    u32 srcTimestamp;
+
+    u8* data; // Encoded texture data
+    u32 dataSize;
+} CtpkBuildTexture;
+
+#define CTPK_DATA_ALIGN 128
+
+int I_CtpkCompareHashEntry(const void* a, const void* b) {
+    u32 hashA = ((const HashBlockEntry*)a)->pathHash;
+    u32 hashB = ((const HashBlockEntry*)b)->pathHash;
+
+    return (hashA > hashB) - (hashA < hashB);
+}
+
+/*
+    Layout:
+        CtpkFileHeader
+        TextureEntry[textureCount]
+        Bitmap sizes (u32 per mip level; one level per texture)
+        Paths (null-terminated, 4-aligned)
+        HashBlockEntry[textureCount] (sorted by hash)
+        TextureContextEntry[textureCount]
+        Texture data (CTPK_DATA_ALIGN-aligned)
+*/
+CtpkBuildResult CtpkBuild(const CtpkBuildTexture* textures, u16 textureCount) {
+    CtpkBuildResult result;
+
+    u32 bitmapSizeOffset = sizeof(CtpkFileHeader) + sizeof(TextureEntry) * textureCount;
+    u32 pathOffset = bitmapSizeOffset + sizeof(u32) * textureCount;
+
+    u32 pathsSize = 0;
+    for (u32 i = 0; i < textureCount; i++)
+        pathsSize += (strlen(textures[i].path) + 1 + 3) & ~3;
+
+    u32 hashSectionOffset = pathOffset + pathsSize;
+    u32 textureInfoOffset = hashSectionOffset + sizeof(HashBlockEntry) * textureCount;
+    u32 textureSectionOffset = (
+        textureInfoOffset + sizeof(TextureContextEntry) * textureCount +
+        CTPK_DATA_ALIGN - 1
+    ) & ~(CTPK_DATA_ALIGN - 1);
+
+    u32 textureSectionSize = 0;
+    for (u32 i = 0; i < textureCount; i++)
+        textureSectionSize += textures[i].dataSize;
+
+    result.size = textureSectionOffset + textureSectionSize;
+    result.ptr = (u8*)calloc(1, result.size);
+    if (result.ptr == NULL)
+        PANIC_MALLOC("CTPK build buf");
+
+    CtpkFileHeader* fileHeader = (CtpkFileHeader*)result.ptr;
+
+    fileHeader->magic = CTPK_MAGIC;
+    fileHeader->version = 1;
+    fileHeader->textureCount = textureCount;
+    fileHeader->textureSectionOffset = textureSectionOffset;
+    fileHeader->textureSectionSize = textureSectionSize;
+    fileHeader->hashSectionOffset = hashSectionOffset;
+    fileHeader->textureInfoSection = textureInfoOffset;
+
+    u32* bitmapSizes = (u32*)(result.ptr + bitmapSizeOffset);
+    HashBlockEntry* hashEntries = (HashBlockEntry*)(result.ptr + hashSectionOffset);
+    TextureContextEntry* contextEntries = (TextureContextEntry*)(result.ptr + textureInfoOffset);
+
+    u32 nextPathOffset = pathOffset;
+    u32 nextDataOffset = 0;
+
+    for (u32 i = 0; i < textureCount; i++) {
+        const CtpkBuildTexture* texture = textures + i;
+        TextureEntry* entry = (TextureEntry*)(fileHeader + 1) + i;
+
+        u32 pathLength = strlen(texture->path);
+
+        entry->pathOffset = nextPathOffset;
+        entry->dataSize = texture->dataSize;
+        entry->dataOffset = nextDataOffset;
+        entry->dataFormat = texture->dataFormat;
+        entry->width = texture->width;
+        entry->height = texture->height;
+        entry->mipLevel = 1;
+        entry->type = 2; // 2D
+        entry->cubeDir = 0;
+        entry->bitmapSizeOffset = i; // In words, into the bitmap size section
+        entry->srcTimestamp = texture->srcTimestamp;
+
+        bitmapSizes[i] = texture->dataSize;
+
+        memcpy(result.ptr + nextPathOffset, texture->path, pathLength + 1);
+        nextPathOffset += (pathLength + 1 + 3) & ~3;
+
+        hashEntries[i].pathHash = crc32(0, (const Bytef*)texture->path, pathLength);
+        hashEntries[i].index = i;
+
+        contextEntries[i].textureFormat = texture->dataFormat;
+        contextEntries[i].mipLevel = 1;
+        contextEntries[i].compressed = 0;
+        contextEntries[i].compressionMethod = 0;
+
+        memcpy(
+            result.ptr + textureSectionOffset + nextDataOffset,
+            texture->data, texture->dataSize
+        );
+        nextDataOffset += texture->dataSize;
+    }
+
+    // Sorted so the runtime can binary search by path hash
+    qsort(hashEntries, textureCount, sizeof(HashBlockEntry), I_CtpkCompareHashEntry);
 
-    free(buffer);
+    return result;
 }
 
 #endif
@@ -0,0 +1,375 @@
+#ifndef IMAGELOAD_H
+#define IMAGELOAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <zlib.h>
+
+#include "common.h"
+
+// Minimal PNG & TGA readers for building CTPKs. Both return top-to-bottom
+// rows of 32bpp pixels laid out as (R,G,B,A) in memory, the same layout the
+// ETC1 decoders produce.
+
+typedef struct {
+    u32* pixels;
+
+    u16 width;
+    u16 height;
+} LoadedImage;
+
+static const u8 pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+static inline u32 I_ReadBE32(const u8* data) {
+    return ((u32)data[0] << 24) | ((u32)data[1] << 16) | ((u32)data[2] << 8) | data[3];
+}
+
+static inline u8 I_PngPaeth(u8 a, u8 b, u8 c) {
+    int p = (int)a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return a;
+    if (pb <= pc)
+        return b;
+    return c;
+}
+
+// Reads sample n of a row with the given bit depth (1, 2, 4, 8 or 16); 16-bit
+// samples are reduced to their high byte.
+static inline u32 I_PngSample(const u8* row, u32 n, u8 bitDepth) {
+    switch (bitDepth) {
+    case 16:
+        return row[n * 2];
+    case 8:
+        return row[n];
+    default: {
+        u32 bitOffset = n * bitDepth;
+        u32 shift = 8 - bitDepth - (bitOffset & 7);
+
+        return (row[bitOffset >> 3] >> shift) & ((1 << bitDepth) - 1);
+    }
+    }
+}
+
+LoadedImage LoadPNG(const u8* data, u32 size) {
+    LoadedImage image;
+
+    if (size < 8 + 25 || memcmp(data, pngSignature, 8) != 0)
+        panic("PNG signature is nonmatching");
+
+    u32 width = 0, height = 0;
+    u8 bitDepth = 0, colorType = 0, interlace = 0;
+
+    u8 palette[256][4];
+    u32 paletteCount = 0;
+    memset(palette, 0xFF, sizeof(palette));
+
+    int hasColorKey = FALSE;
+    u16 colorKey[3] = { 0, 0, 0 };
+
+    u8* compressed = NULL;
+    u32 compressedSize = 0;
+
+    u32 offset = 8;
+    while (offset + 12 <= size) {
+        u32 chunkLength = I_ReadBE32(data + offset);
+        const u8* chunkType = data + offset + 4;
+        const u8* chunk = data + offset + 8;
+
+        if (chunkLength > size - offset - 12)
+            panic("PNG chunk runs past the end of the file");
+
+        if (memcmp(chunkType, "IHDR", 4) == 0) {
+            if (chunkLength < 13)
+                panic("PNG IHDR is too short");
+
+            width = I_ReadBE32(chunk);
+            height = I_ReadBE32(chunk + 4);
+            bitDepth = chunk[8];
+            colorType = chunk[9];
+            interlace = chunk[12];
+        }
+        else if (memcmp(chunkType, "PLTE", 4) == 0) {
+            paletteCount = chunkLength / 3;
+            if (paletteCount > 256)
+                paletteCount = 256;
+
+            for (u32 i = 0; i < paletteCount; i++) {
+                palette[i][0] = chunk[i * 3 + 0];
+                palette[i][1] = chunk[i * 3 + 1];
+                palette[i][2] = chunk[i * 3 + 2];
+            }
+        }
+        else if (memcmp(chunkType, "tRNS", 4) == 0) {
+            if (colorType == 3) {
+                for (u32 i = 0; i < chunkLength && i < 256; i++)
+                    palette[i][3] = chunk[i];
+            }
+            else if (colorType == 0 && chunkLength >= 2) {
+                hasColorKey = TRUE;
+                colorKey[0] = colorKey[1] = colorKey[2] = (chunk[0] << 8) | chunk[1];
+            }
+            else if (colorType == 2 && chunkLength >= 6) {
+                hasColorKey = TRUE;
+                for (u32 i = 0; i < 3; i++)
+                    colorKey[i] = (chunk[i * 2] << 8) | chunk[i * 2 + 1];
+            }
+        }
+        else if (memcmp(chunkType, "IDAT", 4) == 0) {
+            compressed = (u8*)realloc(compressed, compressedSize + chunkLength);
+            if (compressed == NULL)
+                PANIC_MALLOC("PNG IDAT buf");
+
+            memcpy(compressed + compressedSize, chunk, chunkLength);
+            compressedSize += chunkLength;
+        }
+        else if (memcmp(chunkType, "IEND", 4) == 0)
+            break;
+
+        offset += chunkLength + 12;
+    }
+
+    if (width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF)
+        panic("PNG dimensions are unsupported");
+    if (interlace != 0)
+        panic("Interlaced PNGs are not supported");
+    if (compressed == NULL)
+        panic("PNG has no image data");
+
+    u32 channels = 0;
+    switch (colorType) {
+    case 0: channels = 1; break; // Grayscale
+    case 2: channels = 3; break; // RGB
+    case 3: channels = 1; break; // Palette
+    case 4: channels = 2; break; // Grayscale + alpha
+    case 6: channels = 4; break; // RGBA
+    default:
+        panic("PNG color type is unsupported");
+    }
+
+    if (bitDepth != 1 && bitDepth != 2 && bitDepth != 4 && bitDepth != 8 && bitDepth != 16)
+        panic("PNG bit depth is unsupported");
+
+    u32 rowBytes = (width * channels * bitDepth + 7) / 8;
+    u32 bytesPerPixel = (channels * bitDepth + 7) / 8;
+
+    uLongf rawSize = (uLongf)(rowBytes + 1) * height;
+    u8* raw = (u8*)malloc(rawSize);
+    if (raw == NULL)
+        PANIC_MALLOC("PNG raw buf");
+
+    if (uncompress(raw, &rawSize, compressed, compressedSize) != Z_OK || rawSize != (uLongf)(rowBytes + 1) * height)
+        panic("PNG image data could not be inflated");
+
+    free(compressed);
+
+    // Undo the per-row filters in place
+    u8* previousRow = NULL;
+    for (u32 y = 0; y < height; y++) {
+        u8* row = raw + y * (rowBytes + 1) + 1;
+        u8 filter = row[-1];
+
+        for (u32 i = 0; i < rowBytes; i++) {
+            u8 left = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+            u8 up = previousRow ? previousRow[i] : 0;
+            u8 upLeft = (previousRow && i >= bytesPerPixel) ? previousRow[i - bytesPerPixel] : 0;
+
+            switch (filter) {
+            case 0: break;
+            case 1: row[i] += left; break;
+            case 2: row[i] += up; break;
+            case 3: row[i] += (u8)(((u32)left + up) / 2); break;
+            case 4: row[i] += I_PngPaeth(left, up, upLeft); break;
+            default:
+                panic("PNG row filter is invalid");
+            }
+        }
+
+        previousRow = row;
+    }
+
+    image.width = width;
+    image.height = height;
+    image.pixels = (u32*)malloc((u64)width * height * 4);
+    if (image.pixels == NULL)
+        PANIC_MALLOC("PNG pixel buf");
+
+    // Scales a sample of bitDepth bits to 8 bits
+    u32 scale = bitDepth < 8 ? 255 / ((1 << bitDepth) - 1) : 1;
+
+    for (u32 y = 0; y < height; y++) {
+        const u8* row = raw + y * (rowBytes + 1) + 1;
+        u8* pixel = (u8*)(image.pixels + y * width);
+
+        for (u32 x = 0; x < width; x++, pixel += 4) {
+            if (colorType == 3) {
+                u32 index = I_PngSample(row, x, bitDepth);
+                if (index >= paletteCount)
+                    panic("PNG palette index is out of range");
+
+                memcpy(pixel, palette[index], 4);
+                continue;
+            }
+
+            u32 samples[4];
+            for (u32 c = 0; c < channels; c++)
+                samples[c] = I_PngSample(row, x * channels + c, bitDepth) * scale;
+
+            if (channels <= 2) {
+                pixel[0] = pixel[1] = pixel[2] = samples[0];
+                pixel[3] = channels == 2 ? samples[1] : 0xFF;
+            }
+            else {
+                pixel[0] = samples[0];
+                pixel[1] = samples[1];
+                pixel[2] = samples[2];
+                pixel[3] = channels == 4 ? samples[3] : 0xFF;
+            }
+
+            if (hasColorKey && channels != 2 && channels != 4) {
+                // Color keys are compared at the original bit depth
+                u32 keyShift = bitDepth == 16 ? 8 : 0;
+                u32 keyScale = bitDepth < 8 ? scale : 1;
+                int match = TRUE;
+
+                for (u32 c = 0; c < channels; c++)
+                    if (samples[c] != (u32)(colorKey[c] >> keyShift) * keyScale)
+                        match = FALSE;
+
+                if (match)
+                    pixel[3] = 0;
+            }
+        }
+    }
+
+    free(raw);
+
+    return image;
+}
+
+// Supports uncompressed & RLE true-color (24/32bpp) and grayscale (8bpp).
+LoadedImage LoadTGA(const u8* data, u32 size) {
+    LoadedImage image;
+
+    if (size < 18)
+        panic("TGA header is truncated");
+
+    u8 idLength = data[0];
+    u8 colorMapType = data[1];
+    u8 imageType = data[2];
+    u16 colorMapLength = data[5] | (data[6] << 8);
+    u8 colorMapDepth = data[7];
+    u16 width = data[12] | (data[13] << 8);
+    u16 height = data[14] | (data[15] << 8);
+    u8 pixelDepth = data[16];
+    u8 descriptor = data[17];
+
+    int rle = imageType == 10 || imageType == 11;
+    int gray = imageType == 3 || imageType == 11;
+
+    if (imageType != 2 && imageType != 3 && imageType != 10 && imageType != 11)
+        panic("TGA image type is unsupported");
+    if (gray ? pixelDepth != 8 : (pixelDepth != 24 && pixelDepth != 32))
+        panic("TGA pixel depth is unsupported");
+    if (width == 0 || height == 0)
+        panic("TGA dimensions are invalid");
+
+    u32 bytesPerPixel = pixelDepth / 8;
+    u32 offset = 18 + idLength;
+    if (colorMapType)
+        offset += colorMapLength * ((colorMapDepth + 7) / 8);
+
+    u32 pixelCount = (u32)width * height;
+
+    image.width = width;
+    image.height = height;
+    image.pixels = (u32*)malloc((u64)pixelCount * 4);
+    if (image.pixels == NULL)
+        PANIC_MALLOC("TGA pixel buf");
+
+    int topToBottom = (descriptor & 0x20) != 0;
+
+    u32 packetLeft = 0;
+    int packetRepeat = FALSE;
+    u8 repeatPixel[4];
+
+    for (u32 i = 0; i < pixelCount; i++) {
+        const u8* source;
+
+        if (rle) {
+            if (packetLeft == 0) {
+                if (offset >= size)
+                    panic("TGA image data is truncated");
+
+                u8 packetHeader = data[offset++];
+                packetLeft = (packetHeader & 0x7F) + 1;
+                packetRepeat = (packetHeader & 0x80) != 0;
+
+                if (packetRepeat) {
+                    if (offset + bytesPerPixel > size)
+                        panic("TGA image data is truncated");
+
+                    memcpy(repeatPixel, data + offset, bytesPerPixel);
+                    offset += bytesPerPixel;
+                }
+            }
+
+            packetLeft--;
+
+            if (packetRepeat)
+                source = repeatPixel;
+            else {
+                if (offset + bytesPerPixel > size)
+                    panic("TGA image data is truncated");
+
+                source = data + offset;
+                offset += bytesPerPixel;
+            }
+        }
+        else {
+            if (offset + bytesPerPixel > size)
+                panic("TGA image data is truncated");
+
+            source = data + offset;
+            offset += bytesPerPixel;
+        }
+
+        u32 x = i % width;
+        u32 y = i / width;
+        if (!topToBottom)
+            y = height - 1 - y;
+
+        u8* pixel = (u8*)(image.pixels + y * width + x);
+
+        if (gray) {
+            pixel[0] = pixel[1] = pixel[2] = source[0];
+            pixel[3] = 0xFF;
+        }
+        else {
+            // Stored as BGR(A)
+            pixel[0] = source[2];
+            pixel[1] = source[1];
+            pixel[2] = source[0];
+            pixel[3] = bytesPerPixel == 4 ? source[3] : 0xFF;
+        }
+    }
+
+    return image;
+}
+
+// Picks the reader from the file's signature, falling back to TGA (which
+// has none).
+LoadedImage LoadImage(const u8* data, u32 size) {
+    if (size >= 8 && memcmp(data, pngSignature, 8) == 0)
+        return LoadPNG(data, size);
+
+    return LoadTGA(data, size);
+}
+
+#endif
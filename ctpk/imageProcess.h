@@ -3,85 +3,206 @@
 
 #include "common.h"
 
-void unpackETC1Block(void* etc1Block, unsigned int* dstPixels, int preserveAlpha);
+void packETC1BlockInit(void);
+unsigned int packETC1Block(void* etc1Block, const unsigned int* srcPixels, int quality);
 
-typedef void (*ImageProcessFunction)(u32**, u32*, const u32*, u16, u16);
+// Returns FALSE if the CPU does not support the level.
+int packETC1BlockSetSimdLevel(int level);
+int packETC1BlockGetSimdLevel(void);
 
-void ProcessETC1A4(u32** bufferOut, u32* sizeOut, const u32* dataIn, u16 width, u16 height) {
-    u32 bufferSize = width * height * 4;
-	u32* buffer = (u32*)malloc(bufferSize);
+// Matches rg_etc1::etc1_quality
+#define ETC1_QUALITY_LOW 0
+#define ETC1_QUALITY_MEDIUM 1
+#define ETC1_QUALITY_HIGH 2
 
-	u32 inOffset = 0;
+// Matches rg_etc1::etc1_simd_level
+#define ETC1_SIMD_NONE 0
+#define ETC1_SIMD_SSE41 1
+#define ETC1_SIMD_AVX2 2
 
-	for (u32 xImage = 0; xImage < width; xImage += 8) {
-		for (u32 yImage = 0; yImage < height; yImage += 8) {
-			u64 data;
-			u32 pixels[4 * 4];
+/*
+    ETC1 textures are stored as 8x8 tiles, left to right & top to bottom. Each
+    tile holds four 4x4 blocks in Z order (top left, top right, bottom left,
+    bottom right). ETC1A4 prefixes every block with 64 bits of 4-bit alpha in
+    column-major order. Decoding lives in libctrtools (CtrCtpkDecodeTexture).
+*/
 
-			for (unsigned z = 0; z < 4; z++) {
-				unsigned xStart = (z == 0 || z == 2 ? 0 : 4);
-				unsigned yStart = (z == 0 || z == 1 ? 0 : 4);
+typedef void (*ImageEncodeFunction)(u32*, const u32*, u16, u16, int);
 
-				memcpy(&data, &dataIn[inOffset], sizeof(unsigned long long));
-				inOffset += 2;
+typedef struct BlockCache BlockCache;
 
-				for (u32 y = yImage + xStart; y < yImage + xStart + 4; y++)
-					for (u32 x = xImage + yStart; x < xImage + yStart + 4; x++) {
-						buffer[(x * height) + y] =
-						    ((((data & 0xF) << 28) | ((data & 0xF) << 24)) & 0xFF000000);
-						data >>= 4;
-					}
+// Encodes the tiles of one 8-pixel-tall row (tileRow) into dataOut, which
+// points to the start of the texture's data. The cache may be NULL.
+typedef void (*ImageEncodeRowFunction)(u32*, const u32*, u16, u16, u32, int, BlockCache*);
 
-				xStart = (z == 0 || z == 1 ? 0 : 4);
-				yStart = (z == 0 || z == 2 ? 0 : 4);
+#define ETC1_TILE_ROW_SIZE(width) ((u32)(width) / 8 * 4 * 8)
+#define ETC1A4_TILE_ROW_SIZE(width) ((u32)(width) / 8 * 4 * 16)
 
-				*(u64*)&data = __builtin_bswap64(*(u64*)&dataIn[inOffset]);
-				inOffset += 2;
+/*
+    Atlases repeat the same 4x4 blocks (flat panels, transparent padding)
+    over & over, so packed blocks are remembered by their pixels. The cache
+    is direct-mapped & compares the full 64-byte block, so a hit always
+    returns what packETC1Block would have. One cache per thread.
+*/
 
-				unpackETC1Block(&data, pixels, FALSE);
+#define BLOCK_CACHE_SIZE 4096 // Entries; power of two
 
-				u32* lPixel = pixels;
-				for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
-				for (u32 y = yImage + yStart; y < yImage + yStart + 4; y++)
-					buffer[(x * height) + y] |= (*(lPixel++) & 0xFFFFFF);
-			}
-		}
-	}
+typedef struct {
+    u32 pixels[4 * 4];
+    u64 block;
+    int quality; // -1 if unused
+} BlockCacheEntry;
+
+struct BlockCache {
+    BlockCacheEntry* entries;
+
+    u64 hits;
+    u64 misses;
+};
+
+void BlockCacheInit(BlockCache* cache) {
+    cache->entries = (BlockCacheEntry*)malloc(sizeof(BlockCacheEntry) * BLOCK_CACHE_SIZE);
+    if (cache->entries == NULL)
+        PANIC_MALLOC("block cache");
+
+    for (u32 i = 0; i < BLOCK_CACHE_SIZE; i++)
+        cache->entries[i].quality = -1;
+
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void BlockCacheFree(BlockCache* cache) {
+    free(cache->entries);
+    cache->entries = NULL;
+}
+
+static inline u32 I_BlockCacheIndex(const u32* pixels) {
+    u64 hash = 0;
+    for (u32 i = 0; i < 4 * 4; i += 2) {
+        u64 word;
+        memcpy(&word, pixels + i, sizeof(u64));
+
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15;
+        hash ^= hash >> 32;
+    }
 
-	*bufferOut = buffer;
-	*sizeOut = bufferSize;
+    return (u32)(hash ^ (hash >> 29)) & (BLOCK_CACHE_SIZE - 1);
 }
 
-void ProcessETC1(u32** bufferOut, u32* sizeOut, const u32* dataIn, u16 width, u16 height) {
-    u32 bufferSize = width * height * 4;
-	u32* buffer = (u32*)malloc(bufferSize);
+// Packs 16 RGBA pixels into an ETC1 block, stored the way CTPK data holds it.
+static inline u64 I_EncodeETC1Block(const u32* pixels, int quality, BlockCache* cache) {
+    u32 opaquePixels[4 * 4];
+    for (u32 i = 0; i < 4 * 4; i++)
+        opaquePixels[i] = pixels[i] | 0xFF000000;
+
+    BlockCacheEntry* entry = NULL;
+    if (cache) {
+        entry = cache->entries + I_BlockCacheIndex(opaquePixels);
+
+        if (
+            entry->quality == quality &&
+            memcmp(entry->pixels, opaquePixels, sizeof(opaquePixels)) == 0
+        ) {
+            cache->hits++;
+            return entry->block;
+        }
+
+        cache->misses++;
+    }
+
+    u64 block;
+    packETC1Block(&block, opaquePixels, quality);
+    block = __builtin_bswap64(block);
+
+    if (entry) {
+        memcpy(entry->pixels, opaquePixels, sizeof(opaquePixels));
+        entry->block = block;
+        entry->quality = quality;
+    }
+
+    return block;
+}
 
-	u32 inOffset = 0;
+// Encodes one row of ETC1A4 tiles.
+void EncodeETC1A4TileRow(u32* dataOut, const u32* buffer, u16 width, u16 height, u32 tileRow, int quality, BlockCache* cache) {
+	u32 yImage = tileRow * 8;
+	u32 outOffset = tileRow * ETC1A4_TILE_ROW_SIZE(width) / sizeof(u32);
 
 	for (u32 xImage = 0; xImage < width; xImage += 8) {
-		for (u32 yImage = 0; yImage < height; yImage += 8) {
-			u64 data;
-			u32 pixels[4 * 4];
+		u32 pixels[4 * 4];
+
+		for (unsigned z = 0; z < 4; z++) {
+			unsigned xStart = (z == 0 || z == 2 ? 0 : 4);
+			unsigned yStart = (z == 0 || z == 1 ? 0 : 4);
+
+			u64 alpha = 0;
+			u32 shift = 0;
+			for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
+				for (u32 y = yImage + yStart; y < yImage + yStart + 4; y++) {
+					alpha |= (u64)(buffer[(y * width) + x] >> 28) << shift;
+					shift += 4;
+				}
+
+			memcpy(&dataOut[outOffset], &alpha, sizeof(u64));
+			outOffset += 2;
+
+			u32* lPixel = pixels;
+			for (u32 y = yImage + yStart; y < yImage + yStart + 4; y++)
+			for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
+				*(lPixel++) = buffer[(y * width) + x];
+
+			u64 block = I_EncodeETC1Block(pixels, quality, cache);
+			memcpy(&dataOut[outOffset], &block, sizeof(u64));
+			outOffset += 2;
+		}
+	}
+}
 
-			for (unsigned z = 0; z < 4; z++) {
-				unsigned xStart = (z == 0 || z == 1 ? 0 : 4);
-				unsigned yStart = (z == 0 || z == 2 ? 0 : 4);
+// Encodes one row of ETC1 tiles.
+void EncodeETC1TileRow(u32* dataOut, const u32* buffer, u16 width, u16 height, u32 tileRow, int quality, BlockCache* cache) {
+	u32 yImage = tileRow * 8;
+	u32 outOffset = tileRow * ETC1_TILE_ROW_SIZE(width) / sizeof(u32);
 
-				*(u64*)&data = __builtin_bswap64(*(u64*)&dataIn[inOffset]);
-				inOffset += 2;
+	for (u32 xImage = 0; xImage < width; xImage += 8) {
+		u32 pixels[4 * 4];
+
+		for (unsigned z = 0; z < 4; z++) {
+			unsigned xStart = (z == 0 || z == 2 ? 0 : 4);
+			unsigned yStart = (z == 0 || z == 1 ? 0 : 4);
 
-				unpackETC1Block(&data, pixels, FALSE);
+			u32* lPixel = pixels;
+			for (u32 y = yImage + yStart; y < yImage + yStart + 4; y++)
+			for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
+				*(lPixel++) = buffer[(y * width) + x];
 
-				u32* lPixel = pixels;
-				for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
-				for (u32 y = yImage + yStart; y < yImage + yStart + 4; y++)
-						buffer[(x * height) + y] = *(lPixel++);
-			}
+			u64 block = I_EncodeETC1Block(pixels, quality, cache);
+			memcpy(&dataOut[outOffset], &block, sizeof(u64));
+			outOffset += 2;
 		}
 	}
+}
+
+// dataOut must hold width * height bytes.
+void EncodeETC1A4(u32* dataOut, const u32* buffer, u16 width, u16 height, int quality) {
+	BlockCache cache;
+	BlockCacheInit(&cache);
+
+	for (u32 tileRow = 0; tileRow < height / 8u; tileRow++)
+		EncodeETC1A4TileRow(dataOut, buffer, width, height, tileRow, quality, &cache);
+
+	BlockCacheFree(&cache);
+}
+
+// dataOut must hold width * height / 2 bytes.
+void EncodeETC1(u32* dataOut, const u32* buffer, u16 width, u16 height, int quality) {
+	BlockCache cache;
+	BlockCacheInit(&cache);
+
+	for (u32 tileRow = 0; tileRow < height / 8u; tileRow++)
+		EncodeETC1TileRow(dataOut, buffer, width, height, tileRow, quality, &cache);
 
-	*bufferOut = buffer;
-	*sizeOut = bufferSize;
+	BlockCacheFree(&cache);
 }
 
 #endif
@@ -1,57 +1,460 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <sys/stat.h>
+
 #include "ctpkProcess.h"
+#include "imageLoad.h"
+#include "textureEncode.h"
+#include "archiveDiff.h"
+#include "progress.h"
 
 #include "common.h"
 
-void ExportTexture(u8* ctpkData, char* findPath) {
-    TextureEntry* entry = CtpkFindTextureFromPath(ctpkData, findPath);
+StatsPhase statsArchiveLoad = { "archive load" };
+StatsPhase statsImageLoad = { "image load" };
+StatsPhase statsEncode = { "ETC1 encode" };
+StatsPhase statsArchiveWrite = { "archive write" };
 
-    if (!entry)
+void ExportTexture(const CtrCtpk* ctpk, char* findPath, TarWriter* tar) {
+    u32 index;
+    if (CtrCtpkFind(ctpk, findPath, &index) != CTR_OK)
         panic("The texture was not found.");
 
-    printf("Write to file ..");
+    LOG("Write to file ..");
 
-    CtpkExportTexture(ctpkData, entry);
+    CtpkExportTexture(ctpk, index, NULL, tar);
 
     LOG_OK;
 }
 
-void ExportAllTextures(u8* ctpkData) {
-    u16 nodeCount = CtpkGetTextureCount(ctpkData);
+void ExportAllTextures(const CtrCtpk* ctpk, TarWriter* tar) {
+    u16 nodeCount = CtrCtpkGetTextureCount(ctpk);
+
+    DecodeScratch scratch;
+    DecodeScratchInit(&scratch);
+    DecodeScratchReserve(&scratch, CtrCtpkGetMaxDecodedSize(ctpk));
+
+    Progress progress;
+    ProgressBegin(&progress, "Exporting", nodeCount);
 
     for (u16 i = 0; i < nodeCount; i++) {
-        TextureEntry* entry = CtpkGetTextureFromIndex(ctpkData, i);
-        char* name = CtpkGetPathFromTextureIndex(ctpkData, i);
+        CtrCtpkTexture texture = CtpkGetTexture(ctpk, i);
+
+        LOG_VERBOSE("Writing texture no. %u ..", i+1);
+
+        CtpkExportTexture(ctpk, i, &scratch, tar);
+
+        LOG_VERBOSE_OK;
+        ProgressStep(&progress, (u64)texture.width * texture.height * 4);
+    }
+
+    ProgressEnd(&progress);
+
+    DecodeScratchFree(&scratch);
+}
+
+u8* ReadFileFromPath(const char* path, u32* sizeOut) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        panic("An input file could not be opened.");
+
+    fseek(fp, 0, SEEK_END);
+    u32 size = ftell(fp);
+    rewind(fp);
+
+    u8* data = (u8*)malloc(size);
+    if (data == NULL)
+        PANIC_MALLOC("input file buf");
+
+    if (fread(data, 1, size, fp) != size)
+        panic("An input file could not be read.");
+
+    fclose(fp);
+
+    *sizeOut = size;
+    return data;
+}
+
+// Returns TRUE if any pixel is not fully opaque.
+int ImageHasAlpha(const LoadedImage* image) {
+    u32 pixelCount = (u32)image->width * image->height;
+    for (u32 i = 0; i < pixelCount; i++)
+        if ((image->pixels[i] >> 24) != 0xFF)
+            return TRUE;
+
+    return FALSE;
+}
+
+#define TEX_FORMAT_AUTO 0
+
+void usage();
+
+// Texture width or height: a power of two from 8 to 1024.
+int TextureSizeIsValid(u32 size) {
+    return size >= 8 && size <= 1024 && (size & (size - 1)) == 0;
+}
+
+int BuildArchive(int argc, char* argv[]) {
+    char* outputPath = NULL;
+
+    int quality = ETC1_QUALITY_MEDIUM;
+    u32 texFormat = TEX_FORMAT_AUTO;
+    u32 threadCount = CtrGetCpuCount();
+
+    char** inputPaths = (char**)malloc(sizeof(char*) * argc);
+    u32 inputCount = 0;
+    if (inputPaths == NULL)
+        PANIC_MALLOC("input path list");
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0) {
+            if (i + 1 >= argc) {
+                LOG_ERROR("Error: missing output path after -o.\n\n");
+                usage();
+            }
+            outputPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0) {
+            int count = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            if (count <= 0) {
+                LOG_ERROR("Error: missing or invalid thread count after -j.\n\n");
+                usage();
+            }
+            threadCount = count;
+            i++;
+        }
+        else if (strcasecmp(argv[i], "--quality") == 0) {
+            const char* name = i + 1 < argc ? argv[i + 1] : "";
+
+            if (strcasecmp(name, "low") == 0)
+                quality = ETC1_QUALITY_LOW;
+            else if (strcasecmp(name, "medium") == 0)
+                quality = ETC1_QUALITY_MEDIUM;
+            else if (strcasecmp(name, "high") == 0)
+                quality = ETC1_QUALITY_HIGH;
+            else {
+                LOG_ERROR("Error: missing or unknown quality after --quality.\n\n");
+                usage();
+            }
+            i++;
+        }
+        else if (strcasecmp(argv[i], "--tex-format") == 0) {
+            const char* name = i + 1 < argc ? argv[i + 1] : "";
+
+            if (strcasecmp(name, "auto") == 0)
+                texFormat = TEX_FORMAT_AUTO;
+            else if (strcasecmp(name, "etc1") == 0)
+                texFormat = 0x0C;
+            else if (strcasecmp(name, "etc1a4") == 0)
+                texFormat = 0x0D;
+            else {
+                LOG_ERROR("Error: missing or unknown format after --tex-format.\n\n");
+                usage();
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+            logLevel = LOG_LEVEL_QUIET;
+        else if (strcmp(argv[i], "-v") == 0)
+            logLevel = LOG_LEVEL_VERBOSE;
+        else if (strcasecmp(argv[i], "--stats") == 0)
+            statsEnabled = 1;
+        else
+            inputPaths[inputCount++] = argv[i];
+    }
+
+    if (!outputPath || inputCount == 0)
+        usage();
+    if (inputCount > 0xFFFF)
+        panic("Too many input images.");
+
+    LoadedImage* images = (LoadedImage*)malloc(sizeof(LoadedImage) * inputCount);
+    CtpkBuildTexture* textures = (CtpkBuildTexture*)malloc(sizeof(CtpkBuildTexture) * inputCount);
+    TextureEncodeJob* jobs = (TextureEncodeJob*)malloc(sizeof(TextureEncodeJob) * inputCount);
+    if (!images || !textures || !jobs)
+        PANIC_MALLOC("build lists");
+
+    LOG("Load images ..");
+
+    for (u32 i = 0; i < inputCount; i++) {
+        LOG_VERBOSE("\n" INDENT_SPACE "%s", inputPaths[i]);
+
+        double statsTime = StatsBegin();
+
+        u32 fileSize;
+        u8* fileData = ReadFileFromPath(inputPaths[i], &fileSize);
+
+        images[i] = LoadImage(fileData, fileSize);
+        free(fileData);
+
+        StatsEnd(&statsImageLoad, statsTime, fileSize, (u64)images[i].width * images[i].height * 4);
+
+        // What the 3DS GPU can sample; also keeps the 8x8 tiles whole
+        if (!TextureSizeIsValid(images[i].width) || !TextureSizeIsValid(images[i].height)) {
+            LOG_ERROR("\nError: %s is %ux%u; width & height must be powers of two from 8 to 1024.\n",
+                inputPaths[i], images[i].width, images[i].height);
+            panic("Unsupported image dimensions.");
+        }
+
+        CtpkBuildTexture* texture = textures + i;
+
+        // Stored paths use forward slashes & no leading "./"
+        char* path = inputPaths[i];
+        if (path[0] == '.' && (path[1] == '/' || path[1] == '\\'))
+            path += 2;
+
+        texture->path = strdup(path);
+        if (texture->path == NULL)
+            PANIC_MALLOC("texture path");
+        for (char* c = texture->path; *c; c++)
+            if (*c == '\\')
+                *c = '/';
+
+        struct stat st;
+        texture->srcTimestamp = stat(inputPaths[i], &st) == 0 ? (u32)st.st_mtime : 0;
+
+        texture->dataFormat = texFormat != TEX_FORMAT_AUTO ? texFormat :
+            (ImageHasAlpha(images + i) ? 0x0D : 0x0C);
+        texture->width = images[i].width;
+        texture->height = images[i].height;
+        texture->dataSize = TextureEncodeGetDataSize(texture->dataFormat, texture->width, texture->height);
+        texture->data = (u8*)malloc(texture->dataSize);
+        if (texture->data == NULL)
+            PANIC_MALLOC("texture data");
+
+        jobs[i].pixels = images[i].pixels;
+        jobs[i].width = images[i].width;
+        jobs[i].height = images[i].height;
+        jobs[i].dataFormat = texture->dataFormat;
+        jobs[i].dataOut = (u32*)texture->data;
+    }
+
+    LOG_VERBOSE("\n");
+    LOG_OK;
+
+    LOG("Encode %u texture(s) on %u thread(s) ..", inputCount, threadCount);
+
+    u32 rowCount = 0;
+    u64 pixelBytes = 0;
+    for (u32 i = 0; i < inputCount; i++) {
+        rowCount += jobs[i].height / 8;
+        pixelBytes += (u64)jobs[i].width * jobs[i].height * 4;
+    }
 
-        if (!entry)
-            panic("A texture could not be found.");
-        if (!name)
-            panic("A texture's path could not be found.");
+    Progress progress;
+    ProgressBegin(&progress, "Encoding", rowCount);
 
-        printf("Writing texture no. %u ..", i+1);
+    double statsTime = StatsBegin();
 
-        CtpkExportTexture(ctpkData, entry);
+    TextureEncodeAll(jobs, inputCount, quality, threadCount, &progress);
+
+    u64 encodedBytes = 0;
+    for (u32 i = 0; i < inputCount; i++)
+        encodedBytes += textures[i].dataSize;
+
+    StatsEnd(&statsEncode, statsTime, pixelBytes, encodedBytes);
+
+    ProgressEnd(&progress);
+
+    LOG_VERBOSE("\n");
+    LOG_OK;
+
+    LOG("Build & write CTPK ..");
+
+    statsTime = StatsBegin();
+
+    CtpkBuildResult ctpk = CtpkBuild(textures, inputCount);
+
+    FILE* fpOut = fopen(outputPath, "wb");
+    if (fpOut == NULL)
+        panic("The output CTPK could not be opened.");
+
+    if (fwrite(ctpk.ptr, 1, ctpk.size, fpOut) != ctpk.size) {
+        fclose(fpOut);
+
+        panic("The output CTPK could not be written to.");
+    }
+
+    fclose(fpOut);
+
+    StatsEnd(&statsArchiveWrite, statsTime, encodedBytes, ctpk.size);
+
+    LOG_OK;
+
+    free(ctpk.ptr);
+
+    for (u32 i = 0; i < inputCount; i++) {
+        free(images[i].pixels);
+        free(textures[i].path);
+        free(textures[i].data);
+    }
+    free(jobs);
+    free(textures);
+    free(images);
+    free(inputPaths);
+
+    StatsReport();
+
+    LOG("\nFinished! Exiting ..\n");
+
+    return 0;
+}
+
+// Textures are compared by their encoded data as stored, never decoded;
+// format, dimensions & mip count count as part of the contents.
+int DiffCtpks(int argc, char* argv[]) {
+    ListFormat format = LIST_FORMAT_HUMAN;
+    u32 threadCount = CtrGetCpuCount();
+
+    char* ctpkPaths[2];
+    u32 pathCount = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0) {
+            int count = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            if (count <= 0) {
+                LOG_ERROR("Error: missing or invalid thread count after -j.\n\n");
+                usage();
+            }
+            threadCount = count;
+            i++;
+        }
+        else if (strcasecmp(argv[i], "--format") == 0) {
+            int listFormat = i + 1 < argc ? ListFormatFromName(argv[i + 1]) : -1;
+            if (listFormat < 0) {
+                LOG_ERROR("Error: missing or unknown format after --format.\n\n");
+                usage();
+            }
+
+            format = (ListFormat)listFormat;
+            i++;
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+            logLevel = LOG_LEVEL_QUIET;
+        else if (strcmp(argv[i], "-v") == 0)
+            logLevel = LOG_LEVEL_VERBOSE;
+        else if (strcasecmp(argv[i], "--stats") == 0)
+            statsEnabled = 1;
+        else if (pathCount < 2)
+            ctpkPaths[pathCount++] = argv[i];
+        else
+            usage();
+    }
+
+    if (pathCount != 2)
+        usage();
+
+    if (format != LIST_FORMAT_HUMAN)
+        logStream = stderr;
+
+    u8* ctpkBufs[2];
+    CtrCtpk* ctpks[2];
+    DiffEntry* sides[2];
+    u32 sideCounts[2];
+
+    for (u32 side = 0; side < 2; side++) {
+        LOG("Read & copy CTPK binary ..");
+
+        double statsTime = StatsBegin();
+
+        u32 ctpkSize;
+        ctpkBufs[side] = ReadFileFromPath(ctpkPaths[side], &ctpkSize);
+
+        StatsEnd(&statsArchiveLoad, statsTime, ctpkSize, ctpkSize);
 
         LOG_OK;
+
+        ctpks[side] = CtpkOpen(ctpkBufs[side], ctpkSize);
+        sideCounts[side] = CtrCtpkGetTextureCount(ctpks[side]);
+
+        sides[side] = (DiffEntry*)malloc(sizeof(DiffEntry) * (sideCounts[side] + 1));
+        if (sides[side] == NULL)
+            PANIC_MALLOC("diff entries");
+
+        for (u32 i = 0; i < sideCounts[side]; i++) {
+            CtrCtpkTexture texture = CtpkGetTexture(ctpks[side], i);
+
+            DiffEntry* entry = sides[side] + i;
+            entry->name = texture.path;
+            entry->data = texture.data;
+            entry->size = texture.dataSize;
+            entry->meta =
+                (u64)texture.format | ((u64)texture.mipCount << 16) |
+                ((u64)texture.width << 32) | ((u64)texture.height << 48);
+            entry->hash = 0;
+        }
     }
+
+    LOG("\n");
+
+    DiffSummary summary = DiffArchives(
+        sides[0], sideCounts[0], sides[1], sideCounts[1], threadCount, stdout, format
+    );
+
+    DiffLogSummary(summary);
+
+    for (u32 side = 0; side < 2; side++) {
+        free(sides[side]);
+        CtrCtpkClose(ctpks[side]);
+        free(ctpkBufs[side]);
+    }
+
+    StatsReport();
+
+    LOG("\nFinished! Exiting ..\n");
+
+    return 0;
 }
 
 void usage() {
     printf("CTPK Tool v1.0\n");
-    printf("A tool for extracting textures from CTPK texture archives.\n\n");
-
-    printf("Usage: ctpkt <path_to_ctpk> [texture_to_extract]\n");
-    printf("  <path_to_ctpk>         Path to the CTPK file.\n");
+    printf("A tool for extracting textures from & building CTPK texture archives.\n\n");
+
+    printf("Usage: ctpkt [options] <path_to_ctpk> [texture_to_extract]\n");
+    printf("       ctpkt build [options] <images...> -o <output_ctpk>\n");
+    printf("       ctpkt diff [options] <old_ctpk> <new_ctpk>\n\n");
+    printf("  <path_to_ctpk>         Path to the CTPK file. One named build or diff would\n");
+    printf("                         be taken as the command: give it as ./build, or put\n");
+    printf("                         -- first (nothing after -- is read as an option).\n");
     printf("  [texture_to_extract]   (Optional) Path of the texture to extract.\n");
     printf("                         If omitted, a list of all textures will be displayed.\n");
     printf("                         Use 'ALL' to extract all files in the archive.\n\n");
 
+    printf("Options:\n");
+    printf("  --format <human|json|ndjson|tsv>\n");
+    printf("                         Output format of the texture list or diff (default: human).\n");
+    printf("  -q                     Quiet: only print errors.\n");
+    printf("  -v                     Verbose: log every texture.\n");
+    printf("  --stats                Print per-phase timing, throughput & peak memory on exit.\n");
+    printf("  -o -                   Stream exported textures to stdout as a tar archive\n");
+    printf("                         instead of writing them to the working directory.\n\n");
+
+    printf("Build options:\n");
+    printf("  <images...>            PNG or TGA files; width & height must be powers of two\n");
+    printf("                         from 8 to 1024.\n");
+    printf("                         Each texture is stored under the path as given.\n");
+    printf("  -o <output_ctpk>       Path of the CTPK to write.\n");
+    printf("  --quality <low|medium|high>\n");
+    printf("                         ETC1 encoder quality (default: medium).\n");
+    printf("  --tex-format <auto|etc1|etc1a4>\n");
+    printf("                         Texture format; auto picks ETC1A4 for images\n");
+    printf("                         with transparency (default: auto).\n");
+    printf("  -j <threads>           Encoder threads (default: all cores).\n\n");
+
+    printf("Diff options:\n");
+    printf("  -j <threads>           Hashing threads (default: all cores).\n");
+    printf("                         Lists textures added, removed or changed; encoded\n");
+    printf("                         data, format & dimensions are compared as stored.\n\n");
+
     printf("Examples:\n");
     printf("  ctpkt ./sample.ctpk\n");
     printf("  ctpkt ./sample.ctpk path/to/texture\n");
     printf("  ctpkt ./sample.ctpk ALL\n");
+    printf("  ctpkt ./sample.ctpk ALL -o - | tar -x -C ./textures\n");
+    printf("  ctpkt -- build ALL\n");
+    printf("  ctpkt build --quality high ui/*.png -o ./sample.ctpk\n");
+    printf("  ctpkt diff old/sample.ctpk new/sample.ctpk\n");
 
     exit(1);
 }
@@ -61,16 +464,72 @@ int main(int argc, char* argv[]) {
     u8* ctpkBuf;
     u64 ctpkSize;
 
-    char* ctpkPath;
-    char* findPath;
+    char* ctpkPath = NULL;
+    char* findPath = NULL;
+    char* outputPath = NULL;
+
+    ListFormat format = LIST_FORMAT_HUMAN;
+
+    int optionsEnded = FALSE; // After --
+
+    logStream = stdout;
+
+    StatsInit(0);
+
+    if (argc >= 2 && strcmp(argv[1], "build") == 0)
+        return BuildArchive(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "diff") == 0)
+        return DiffCtpks(argc, argv);
+
+    // Commands are only recognised as argv[1], so a leading -- is how a CTPK
+    // named build or diff gets opened
+    for (int i = 1; i < argc; i++) {
+        const char* option = optionsEnded ? "" : argv[i];
+
+        if (strcmp(option, "--") == 0)
+            optionsEnded = TRUE;
+        else if (strcmp(option, "-q") == 0)
+            logLevel = LOG_LEVEL_QUIET;
+        else if (strcmp(option, "-v") == 0)
+            logLevel = LOG_LEVEL_VERBOSE;
+        else if (strcasecmp(option, "--stats") == 0)
+            statsEnabled = 1;
+        else if (strcasecmp(option, "--format") == 0) {
+            int listFormat = i + 1 < argc ? ListFormatFromName(argv[i + 1]) : -1;
+            if (listFormat < 0) {
+                LOG_ERROR("Error: missing or unknown format after --format.\n\n");
+                usage();
+            }
+
+            format = (ListFormat)listFormat;
+            i++;
+        }
+        else if (strcmp(option, "-o") == 0) {
+            // Only stdout for now; exports otherwise go to the working directory
+            if (i + 1 >= argc || strcmp(argv[i + 1], "-") != 0) {
+                LOG_ERROR("Error: -o only takes - (a tar stream on stdout).\n\n");
+                usage();
+            }
+            outputPath = argv[++i];
+        }
+        else if (!ctpkPath)
+            ctpkPath = argv[i];
+        else if (!findPath)
+            findPath = argv[i];
+        else
+            usage();
+    }
 
-    if (argc < 2)
+    if (!ctpkPath || (outputPath && !findPath))
         usage();
 
-    ctpkPath = argv[1];
-    findPath = argc > 2 ? argv[2] : NULL;
+    // Keep stdout clean for the listing itself
+    if ((!findPath && format != LIST_FORMAT_HUMAN) || outputPath)
+        logStream = stderr;
+
+    LOG("Read & copy CTPK binary ..");
 
-    printf("Read & copy CTPK binary ..");
+    double statsTime = StatsBegin();
 
     fpCtpk = fopen(ctpkPath, "rb");
     if (fpCtpk == NULL)
@@ -97,24 +556,42 @@ int main(int argc, char* argv[]) {
 
     fclose(fpCtpk);
 
+    StatsEnd(&statsArchiveLoad, statsTime, ctpkSize, ctpkSize);
+
     LOG_OK;
 
     ////////////////////////////////////////
 
+    CtrCtpk* ctpk = CtpkOpen(ctpkBuf, ctpkSize);
+
     if (findPath) {
+        TarWriter tar;
+        if (outputPath)
+            TarBegin(&tar, stdout);
+
         if (strcmp(findPath, "ALL") == 0)
-            ExportAllTextures(ctpkBuf);
+            ExportAllTextures(ctpk, outputPath ? &tar : NULL);
         else
-            ExportTexture(ctpkBuf, findPath);
+            ExportTexture(ctpk, findPath, outputPath ? &tar : NULL);
+
+        if (outputPath)
+            TarEnd(&tar);
     }
+    else if (format != LIST_FORMAT_HUMAN)
+        CtpkListTextures(ctpk, stdout, format);
     else {
-        CtpkLogTextureNames(ctpkBuf);
+        CtpkLogTextureNames(ctpk);
 
-        printf("\n!> To export a texture, append the path as a second argument.\n");
-        printf("   To export all textures, enter 'ALL' as the second argument.\n");
+        LOG("\n!> To export a texture, append the path as a second argument.\n");
+        LOG("   To export all textures, enter 'ALL' as the second argument.\n");
     }
 
-    printf("\nFinished! Exiting ..\n");
+    CtrCtpkClose(ctpk);
+    free(ctpkBuf);
+
+    StatsReport();
+
+    LOG("\nFinished! Exiting ..\n");
 
     return 0;
 }
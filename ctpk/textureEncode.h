@@ -0,0 +1,148 @@
+#ifndef TEXTUREENCODE_H
+#define TEXTUREENCODE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "ctrtools.h"
+
+#include "imageProcess.h"
+#include "progress.h"
+
+#include "common.h"
+
+// Encodes a batch of textures on a pool of worker threads. Work is handed
+// out one row of 8x8 tiles at a time, so a single large texture still keeps
+// every thread busy.
+
+typedef struct {
+    const u32* pixels; // Row-major RGBA, width * height
+    u16 width;
+    u16 height;
+
+    u32 dataFormat; // 0x0C (ETC1) or 0x0D (ETC1A4)
+
+    u32* dataOut; // Must hold TextureEncodeGetDataSize bytes
+} TextureEncodeJob;
+
+typedef struct {
+    TextureEncodeJob* jobs;
+    u32 jobCount;
+
+    int quality;
+
+    // Next (job, tileRow) pair to encode, flattened
+    u32 nextRow;
+    u32 rowCount;
+    u32* rowStarts; // First flattened row of each job
+
+    Progress* progress; // Optional; stepped under lock
+
+    // Summed from the workers' block caches
+    u64 blocksReused;
+    u64 blocksEncoded;
+
+    pthread_mutex_t lock;
+} TextureEncodeContext;
+
+u32 TextureEncodeGetDataSize(u32 dataFormat, u16 width, u16 height) {
+    return dataFormat == 0x0C ? (u32)width * height / 2 : (u32)width * height;
+}
+
+void* I_TextureEncodeWorker(void* arg) {
+    TextureEncodeContext* context = (TextureEncodeContext*)arg;
+
+    // Per thread, kept across textures so repeats between them are found too
+    BlockCache cache;
+    BlockCacheInit(&cache);
+
+    while (1) {
+        u32 row = __atomic_fetch_add(&context->nextRow, 1, __ATOMIC_RELAXED);
+        if (row >= context->rowCount)
+            break;
+
+        // Binary search for the last job starting at or before this row
+        u32 low = 0, high = context->jobCount - 1;
+        while (low < high) {
+            u32 mid = (low + high + 1) / 2;
+            if (context->rowStarts[mid] <= row)
+                low = mid;
+            else
+                high = mid - 1;
+        }
+        u32 jobIndex = low;
+
+        TextureEncodeJob* job = context->jobs + jobIndex;
+        u32 tileRow = row - context->rowStarts[jobIndex];
+
+        ImageEncodeRowFunction function =
+            job->dataFormat == 0x0C ? EncodeETC1TileRow : EncodeETC1A4TileRow;
+        function(job->dataOut, job->pixels, job->width, job->height, tileRow, context->quality, &cache);
+
+        if (context->progress) {
+            pthread_mutex_lock(&context->lock);
+
+            ProgressStep(context->progress, (u64)job->width * 8 * 4);
+
+            pthread_mutex_unlock(&context->lock);
+        }
+    }
+
+    __atomic_fetch_add(&context->blocksReused, cache.hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&context->blocksEncoded, cache.misses, __ATOMIC_RELAXED);
+
+    BlockCacheFree(&cache);
+
+    return NULL;
+}
+
+void TextureEncodeAll(TextureEncodeJob* jobs, u32 jobCount, int quality, u32 threadCount, Progress* progress) {
+    TextureEncodeContext context;
+
+    if (jobCount == 0)
+        return;
+
+    context.jobs = jobs;
+    context.jobCount = jobCount;
+    context.quality = quality;
+    context.nextRow = 0;
+    context.progress = progress;
+    context.blocksReused = 0;
+    context.blocksEncoded = 0;
+
+    context.rowStarts = (u32*)malloc(sizeof(u32) * jobCount);
+    if (context.rowStarts == NULL)
+        PANIC_MALLOC("encode row starts");
+
+    context.rowCount = 0;
+    for (u32 i = 0; i < jobCount; i++) {
+        context.rowStarts[i] = context.rowCount;
+        context.rowCount += jobs[i].height / 8;
+    }
+
+    // The encoder builds its tables on first use; do it here rather than
+    // have every worker wait on the first one to get there
+    packETC1BlockInit();
+
+    if (threadCount > context.rowCount)
+        threadCount = context.rowCount;
+    if (threadCount == 0)
+        threadCount = 1;
+
+    pthread_mutex_init(&context.lock, NULL);
+
+    CtrRunThreads(NULL, threadCount, I_TextureEncodeWorker, &context);
+
+    pthread_mutex_destroy(&context.lock);
+
+    free(context.rowStarts);
+
+    LOG_VERBOSE(
+        "\n" INDENT_SPACE "%lu of %lu blocks reused from the block cache",
+        context.blocksReused, context.blocksReused + context.blocksEncoded
+    );
+}
+
+#endif
@@ -0,0 +1,26 @@
+#include "etc1.hpp"
+
+#include "rg_etc1.h"
+
+void unpackETC1Block(void* etc1Block, unsigned int* dstPixels, int preserveAlpha) {
+    rg_etc1::unpack_etc1_block(etc1Block, dstPixels, preserveAlpha != 0);
+}
+
+void packETC1BlockInit(void) {
+    rg_etc1::pack_etc1_block_init();
+}
+
+int packETC1BlockSetSimdLevel(int level) {
+    return rg_etc1::set_etc1_simd_level(static_cast<rg_etc1::etc1_simd_level>(level)) ? 1 : 0;
+}
+
+int packETC1BlockGetSimdLevel(void) {
+    return static_cast<int>(rg_etc1::get_etc1_simd_level());
+}
+
+unsigned int packETC1Block(void* etc1Block, const unsigned int* srcPixels, int quality) {
+    rg_etc1::etc1_pack_params params;
+    params.m_quality = static_cast<rg_etc1::etc1_quality>(quality);
+
+    return rg_etc1::pack_etc1_block(etc1Block, srcPixels, params);
+}
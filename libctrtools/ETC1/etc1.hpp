@@ -0,0 +1,11 @@
+#ifndef ETC1_HPP
+#define ETC1_HPP
+
+extern "C" void unpackETC1Block(void* etc1Block, unsigned int* dstPixels, int preserveAlpha);
+
+extern "C" void packETC1BlockInit(void);
+extern "C" int packETC1BlockSetSimdLevel(int level);
+extern "C" int packETC1BlockGetSimdLevel(void);
+extern "C" unsigned int packETC1Block(void* etc1Block, const unsigned int* srcPixels, int quality);
+
+#endif
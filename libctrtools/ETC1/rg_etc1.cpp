@@ -17,6 +17,15 @@
 //#include <stdio.h>
 #include <math.h>
 
+// The SSE4.1 & AVX2 error kernels are compiled per function with target
+// attributes & picked at runtime, so the rest of the file needs no -m flags.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RG_ETC1_SIMD 1
+#include <immintrin.h>
+#else
+#define RG_ETC1_SIMD 0
+#endif
+
 #pragma warning (disable: 4201) //  nonstandard extension used : nameless struct/union
 
 #if defined(_DEBUG) || defined(DEBUG)
@@ -364,8 +373,6 @@ namespace rg_etc1
       // 0   1   2   3   -4  -3  -2  -1
    };
    
-   static uint8 g_quant5_tab[256+16];
-
    static const int g_etc1_inten_tables[cETC1IntenModifierValues][cETC1SelectorValues] = 
    { 
       { -8,  -2,   2,   8 }, { -17,  -5,  5,  17 }, { -29,  -9,   9,  29 }, {  -42, -13, 13,  42 }, 
@@ -375,9 +382,6 @@ namespace rg_etc1
    static const uint8 g_etc1_to_selector_index[cETC1SelectorValues] = { 2, 3, 1, 0 };
    static const uint8 g_selector_index_to_etc1[cETC1SelectorValues] = { 3, 2, 0, 1 };
       
-   // Given an ETC1 diff/inten_table/selector, and an 8-bit desired color, this table encodes the best packed_color in the low byte, and the abs error in the high byte.
-   static uint16 g_etc1_inverse_lookup[2*8*4][256];      // [diff/inten_table/selector][desired_color]
-
    // g_color8_to_etc_block_config[color][table_index] = Supplies for each 8-bit color value a list of packed ETC1 diff/intensity table/selectors/packed_colors that map to that color.
    // To pack: diff | (inten << 1) | (selector << 4) | (packed_c << 8)
    static const uint16 g_color8_to_etc_block_config_0_255[2][33] =
@@ -1342,6 +1346,212 @@ namespace rg_etc1
       bool m_color4;
    };
 
+   // Source pixels of an 8 pixel subblock, one channel per array, for the SIMD error kernels.
+   struct etc1_subblock_soa
+   {
+      int m_r[8];
+      int m_g[8];
+      int m_b[8];
+      int m_luma2[8]; // (r + g + b) * 2
+   };
+
+#if RG_ETC1_SIMD
+   // Both kernels return the same selectors & total error as the scalar loops in
+   // etc1_optimizer::evaluate_solution() & evaluate_solution_fast().
+   //  - best: each pixel takes the closest of the 4 block colors, lowest selector on ties.
+   //  - luma: each pixel's selector is the number of intensity midpoints at or below its luma.
+   typedef uint (*etc1_best_selectors_func)(const etc1_subblock_soa& src, const color_quad_u8* pBlock_colors, uint8* pSelectors);
+   typedef uint (*etc1_luma_selectors_func)(const etc1_subblock_soa& src, const color_quad_u8* pBlock_colors, const uint* pMidpoints, uint8* pSelectors);
+
+   static etc1_simd_level g_etc1_simd_level = cSIMDNone;
+   static etc1_best_selectors_func g_pBest_selectors_func = NULL;
+   static etc1_luma_selectors_func g_pLuma_selectors_func = NULL;
+
+   __attribute__((target("sse4.1")))
+   static inline __m128i squared_distance_rgb_sse41(__m128i r, __m128i g, __m128i b, const color_quad_u8& c)
+   {
+      const __m128i dr = _mm_sub_epi32(r, _mm_set1_epi32(c.r));
+      const __m128i dg = _mm_sub_epi32(g, _mm_set1_epi32(c.g));
+      const __m128i db = _mm_sub_epi32(b, _mm_set1_epi32(c.b));
+      return _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db));
+   }
+
+   __attribute__((target("sse4.1")))
+   static inline uint horizontal_sum_sse41(__m128i v)
+   {
+      v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+      v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+      return static_cast<uint>(_mm_cvtsi128_si32(v));
+   }
+
+   __attribute__((target("sse4.1")))
+   static inline void store_selectors_sse41(uint8* pSelectors, __m128i lo, __m128i hi)
+   {
+      const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(pSelectors), packed);
+   }
+
+   __attribute__((target("sse4.1")))
+   static uint best_selectors_sse41(const etc1_subblock_soa& src, const color_quad_u8* pBlock_colors, uint8* pSelectors)
+   {
+      __m128i best_err[2], best_sel[2];
+
+      for (uint h = 0; h < 2; h++)
+      {
+         const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.m_r + h * 4));
+         const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.m_g + h * 4));
+         const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.m_b + h * 4));
+
+         best_err[h] = squared_distance_rgb_sse41(r, g, b, pBlock_colors[0]);
+         best_sel[h] = _mm_setzero_si128();
+
+         for (uint s = 1; s < 4; s++)
+         {
+            const __m128i err = squared_distance_rgb_sse41(r, g, b, pBlock_colors[s]);
+            const __m128i better = _mm_cmplt_epi32(err, best_err[h]);
+            best_err[h] = _mm_min_epi32(err, best_err[h]);
+            best_sel[h] = _mm_blendv_epi8(best_sel[h], _mm_set1_epi32(s), better);
+         }
+      }
+
+      store_selectors_sse41(pSelectors, best_sel[0], best_sel[1]);
+      return horizontal_sum_sse41(_mm_add_epi32(best_err[0], best_err[1]));
+   }
+
+   __attribute__((target("sse4.1")))
+   static uint luma_selectors_sse41(const etc1_subblock_soa& src, const color_quad_u8* pBlock_colors, const uint* pMidpoints, uint8* pSelectors)
+   {
+      __m128i total = _mm_setzero_si128(), sel[2];
+
+      for (uint h = 0; h < 2; h++)
+      {
+         const __m128i luma2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.m_luma2 + h * 4));
+
+         // Midpoints are nondecreasing, so each mask is a subset of the previous one
+         __m128i cr = _mm_set1_epi32(pBlock_colors[0].r), cg = _mm_set1_epi32(pBlock_colors[0].g), cb = _mm_set1_epi32(pBlock_colors[0].b);
+         sel[h] = _mm_setzero_si128();
+         for (uint m = 0; m < 3; m++)
+         {
+            const __m128i above = _mm_cmplt_epi32(luma2, _mm_set1_epi32(pMidpoints[m]));
+            const __m128i at_or_above = _mm_xor_si128(above, _mm_set1_epi32(-1));
+            cr = _mm_blendv_epi8(cr, _mm_set1_epi32(pBlock_colors[m + 1].r), at_or_above);
+            cg = _mm_blendv_epi8(cg, _mm_set1_epi32(pBlock_colors[m + 1].g), at_or_above);
+            cb = _mm_blendv_epi8(cb, _mm_set1_epi32(pBlock_colors[m + 1].b), at_or_above);
+            sel[h] = _mm_sub_epi32(sel[h], at_or_above);
+         }
+
+         const __m128i dr = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src.m_r + h * 4)), cr);
+         const __m128i dg = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src.m_g + h * 4)), cg);
+         const __m128i db = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src.m_b + h * 4)), cb);
+         total = _mm_add_epi32(total, _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db)));
+      }
+
+      store_selectors_sse41(pSelectors, sel[0], sel[1]);
+      return horizontal_sum_sse41(total);
+   }
+
+   __attribute__((target("avx2")))
+   static inline __m256i squared_distance_rgb_avx2(__m256i r, __m256i g, __m256i b, const color_quad_u8& c)
+   {
+      const __m256i dr = _mm256_sub_epi32(r, _mm256_set1_epi32(c.r));
+      const __m256i dg = _mm256_sub_epi32(g, _mm256_set1_epi32(c.g));
+      const __m256i db = _mm256_sub_epi32(b, _mm256_set1_epi32(c.b));
+      return _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)), _mm256_mullo_epi32(db, db));
+   }
+
+   __attribute__((target("avx2")))
+   static inline uint horizontal_sum_avx2(__m256i v)
+   {
+      __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+      s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+      return static_cast<uint>(_mm_cvtsi128_si32(s));
+   }
+
+   __attribute__((target("avx2")))
+   static inline void store_selectors_avx2(uint8* pSelectors, __m256i sel)
+   {
+      const __m128i lo = _mm256_castsi256_si128(sel), hi = _mm256_extracti128_si256(sel, 1);
+      const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(pSelectors), packed);
+   }
+
+   __attribute__((target("avx2")))
+   static uint best_selectors_avx2(const etc1_subblock_soa& src, const color_quad_u8* pBlock_colors, uint8* pSelectors)
+   {
+      const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.m_r));
+      const __m256i g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.m_g));
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.m_b));
+
+      __m256i best_err = squared_distance_rgb_avx2(r, g, b, pBlock_colors[0]);
+      __m256i best_sel = _mm256_setzero_si256();
+
+      for (uint s = 1; s < 4; s++)
+      {
+         const __m256i err = squared_distance_rgb_avx2(r, g, b, pBlock_colors[s]);
+         const __m256i better = _mm256_cmpgt_epi32(best_err, err);
+         best_err = _mm256_min_epi32(err, best_err);
+         best_sel = _mm256_blendv_epi8(best_sel, _mm256_set1_epi32(s), better);
+      }
+
+      store_selectors_avx2(pSelectors, best_sel);
+      return horizontal_sum_avx2(best_err);
+   }
+
+   __attribute__((target("avx2")))
+   static uint luma_selectors_avx2(const etc1_subblock_soa& src, const color_quad_u8* pBlock_colors, const uint* pMidpoints, uint8* pSelectors)
+   {
+      const __m256i luma2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.m_luma2));
+
+      __m256i cr = _mm256_set1_epi32(pBlock_colors[0].r), cg = _mm256_set1_epi32(pBlock_colors[0].g), cb = _mm256_set1_epi32(pBlock_colors[0].b);
+      __m256i sel = _mm256_setzero_si256();
+      for (uint m = 0; m < 3; m++)
+      {
+         const __m256i above = _mm256_cmpgt_epi32(_mm256_set1_epi32(pMidpoints[m]), luma2);
+         const __m256i at_or_above = _mm256_xor_si256(above, _mm256_set1_epi32(-1));
+         cr = _mm256_blendv_epi8(cr, _mm256_set1_epi32(pBlock_colors[m + 1].r), at_or_above);
+         cg = _mm256_blendv_epi8(cg, _mm256_set1_epi32(pBlock_colors[m + 1].g), at_or_above);
+         cb = _mm256_blendv_epi8(cb, _mm256_set1_epi32(pBlock_colors[m + 1].b), at_or_above);
+         sel = _mm256_sub_epi32(sel, at_or_above);
+      }
+
+      const __m256i dr = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.m_r)), cr);
+      const __m256i dg = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.m_g)), cg);
+      const __m256i db = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.m_b)), cb);
+
+      store_selectors_avx2(pSelectors, sel);
+      return horizontal_sum_avx2(_mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)), _mm256_mullo_epi32(db, db)));
+   }
+
+   static bool etc1_simd_level_supported(etc1_simd_level level)
+   {
+      __builtin_cpu_init();
+      switch (level)
+      {
+         case cSIMDNone: return true;
+         case cSIMDSSE41: return __builtin_cpu_supports("sse4.1") != 0;
+         case cSIMDAVX2: return __builtin_cpu_supports("avx2") != 0;
+      }
+      return false;
+   }
+#else
+   static etc1_simd_level g_etc1_simd_level = cSIMDNone;
+
+   static bool etc1_simd_level_supported(etc1_simd_level level)
+   {
+      return level == cSIMDNone;
+   }
+#endif
+
+   static void apply_etc1_simd_level(etc1_simd_level level)
+   {
+      g_etc1_simd_level = level;
+#if RG_ETC1_SIMD
+      g_pBest_selectors_func = (level == cSIMDAVX2) ? best_selectors_avx2 : ((level == cSIMDSSE41) ? best_selectors_sse41 : NULL);
+      g_pLuma_selectors_func = (level == cSIMDAVX2) ? luma_selectors_avx2 : ((level == cSIMDSSE41) ? luma_selectors_sse41 : NULL);
+#endif
+   }
+
    class etc1_optimizer
    {
       etc1_optimizer(const etc1_optimizer&);
@@ -1457,6 +1667,7 @@ namespace rg_etc1
       vec3F m_avg_color;
       int m_br, m_bg, m_bb;
       uint16 m_luma[8];
+      etc1_subblock_soa m_src_soa;
       uint32 m_sorted_luma[2][8];
       const uint32* m_pSorted_luma_indices;
       uint32* m_pSorted_luma;
@@ -1639,6 +1850,11 @@ namespace rg_etc1
 
          m_luma[i] = static_cast<uint16>(c.r + c.g + c.b);
          m_sorted_luma[0][i] = i;
+
+         m_src_soa.m_r[i] = c.r;
+         m_src_soa.m_g[i] = c.g;
+         m_src_soa.m_b[i] = c.b;
+         m_src_soa.m_luma2[i] = m_luma[i] * 2;
       }
       avg_color *= (1.0f / static_cast<float>(n));
       m_avg_color = avg_color;
@@ -1695,7 +1911,14 @@ namespace rg_etc1
          }
          
          uint64 total_error = 0;
-         
+
+#if RG_ETC1_SIMD
+         // Scores all 8 pixels without the early out; a cut-short total is never taken either way.
+         if (g_pBest_selectors_func)
+            total_error = g_pBest_selectors_func(m_src_soa, block_colors, m_temp_selectors);
+         else
+#endif
+         {
          const color_quad_u8* pSrc_pixels = m_pParams->m_pSrc_pixels;
          for (uint c = 0; c < n; c++)
          {
@@ -1731,6 +1954,7 @@ namespace rg_etc1
             if (total_error >= trial_solution.m_error)
                break;
          }
+         }
          
          if (total_error < trial_solution.m_error)
          {
@@ -1808,10 +2032,17 @@ namespace rg_etc1
                   continue;
             }
 
+#if RG_ETC1_SIMD
+            if (g_pLuma_selectors_func)
+               total_error = g_pLuma_selectors_func(m_src_soa, block_colors, block_inten_midpoints, m_temp_selectors);
+            else
+#endif
+            {
             memset(&m_temp_selectors[0], 0, n);
 
             for (uint c = 0; c < n; c++)
                total_error += block_colors[0].squared_distance_rgb(pSrc_pixels[c]);
+            }
          }
          else if ((m_pSorted_luma[0] * 2) >= block_inten_midpoints[2])
          {
@@ -1822,11 +2053,22 @@ namespace rg_etc1
                   continue;
             }
 
+#if RG_ETC1_SIMD
+            if (g_pLuma_selectors_func)
+               total_error = g_pLuma_selectors_func(m_src_soa, block_colors, block_inten_midpoints, m_temp_selectors);
+            else
+#endif
+            {
             memset(&m_temp_selectors[0], 3, n);
 
             for (uint c = 0; c < n; c++)
                total_error += block_colors[3].squared_distance_rgb(pSrc_pixels[c]);
+            }
          }
+#if RG_ETC1_SIMD
+         else if (g_pLuma_selectors_func)
+            total_error = g_pLuma_selectors_func(m_src_soa, block_colors, block_inten_midpoints, m_temp_selectors);
+#endif
          else
          {
             uint cur_selector = 0, c;
@@ -1892,7 +2134,18 @@ done:
 
    static inline int mul_8bit(int a, int b) { int t = a*b + 128; return (t + (t >> 8)) >> 8; }
 
-   void pack_etc1_block_init()
+   // Lookup tables for the solid color packer & the 555 ditherer. They are built once, on first use, and never written again.
+   struct etc1_encoder_tables
+   {
+      // Given an ETC1 diff/inten_table/selector, and an 8-bit desired color, this table encodes the best packed_color in the low byte, and the abs error in the high byte.
+      uint16 m_inverse_lookup[2*8*4][256];      // [diff/inten_table/selector][desired_color]
+
+      uint8 m_quant5[256+16];
+
+      etc1_encoder_tables();
+   };
+
+   etc1_encoder_tables::etc1_encoder_tables()
    {
       for (uint diff = 0; diff < 2; diff++)
       {
@@ -1919,7 +2172,7 @@ done:
                      }
                   }
                   RG_ETC1_ASSERT(best_error <= 255);
-                  g_etc1_inverse_lookup[inverse_table_index][color] = static_cast<uint16>(best_packed_c | (best_error << 8));
+                  m_inverse_lookup[inverse_table_index][color] = static_cast<uint16>(best_packed_c | (best_error << 8));
                }
             }
          }
@@ -1932,8 +2185,43 @@ done:
       for(int i = 0; i < 256 + 16; i++)
       {
          int v = clamp<int>(i - 8, 0, 255);
-         g_quant5_tab[i] = static_cast<uint8>(expand5[mul_8bit(v,31)]);
+         m_quant5[i] = static_cast<uint8>(expand5[mul_8bit(v,31)]);
       }
+
+      // The default error kernel is picked along with the tables, before any block can be packed
+      apply_etc1_simd_level(etc1_simd_level_supported(cSIMDAVX2) ? cSIMDAVX2 : (etc1_simd_level_supported(cSIMDSSE41) ? cSIMDSSE41 : cSIMDNone));
+   }
+
+   // Function-local statics are initialized exactly once, even when several threads get here
+   // at the same time (C++11, -fthreadsafe-statics), so every entry point can simply call this.
+   static const etc1_encoder_tables& get_etc1_encoder_tables()
+   {
+      static const etc1_encoder_tables s_tables;
+      return s_tables;
+   }
+
+   void pack_etc1_block_init()
+   {
+      get_etc1_encoder_tables();
+   }
+
+   bool set_etc1_simd_level(etc1_simd_level level)
+   {
+      if (!etc1_simd_level_supported(level))
+         return false;
+
+      // Initialize first, so the default pick can't overwrite this one later
+      get_etc1_encoder_tables();
+
+      apply_etc1_simd_level(level);
+      return true;
+   }
+
+   etc1_simd_level get_etc1_simd_level()
+   {
+      get_etc1_encoder_tables();
+
+      return g_etc1_simd_level;
    }
 
    // Packs solid color blocks efficiently using a set of small precomputed tables.
@@ -1941,7 +2229,8 @@ done:
    static uint64 pack_etc1_block_solid_color(etc1_block& block, const uint8* pColor, etc1_pack_params& pack_params)
    {
       pack_params;
-      RG_ETC1_ASSERT(g_etc1_inverse_lookup[0][255]);
+      const etc1_encoder_tables& tables = get_etc1_encoder_tables();
+      RG_ETC1_ASSERT(tables.m_inverse_lookup[0][255]);
             
       static uint s_next_comp[4] = { 1, 2, 0, 1 };
             
@@ -1978,7 +2267,7 @@ done:
                RG_ETC1_ASSERT(etc1_decode_value(diff, inten, selector, p0) == (uint)c_plus_delta);
 #endif
 
-               const uint16* pInverse_table = g_etc1_inverse_lookup[x & 0xFF];
+               const uint16* pInverse_table = tables.m_inverse_lookup[x & 0xFF];
                uint16 p1 = pInverse_table[c1];
                uint16 p2 = pInverse_table[c2];
                const uint trial_error = rg_etc1::square(c_plus_delta - pColor[i]) + rg_etc1::square(p1 >> 8) + rg_etc1::square(p2 >> 8);
@@ -2030,7 +2319,8 @@ found_perfect_match:
       bool use_diff,
       const color_quad_u8* pBase_color5_unscaled)
    {
-      RG_ETC1_ASSERT(g_etc1_inverse_lookup[0][255]);
+      const etc1_encoder_tables& tables = get_etc1_encoder_tables();
+      RG_ETC1_ASSERT(tables.m_inverse_lookup[0][255]);
 
       pack_params;
       static uint s_next_comp[4] = { 1, 2, 0, 1 };
@@ -2088,7 +2378,7 @@ found_perfect_match:
                }
 #endif
 
-               const uint16* pInverse_table = g_etc1_inverse_lookup[x & 0xFF];
+               const uint16* pInverse_table = tables.m_inverse_lookup[x & 0xFF];
                uint16 p1 = pInverse_table[c1];
                uint16 p2 = pInverse_table[c2];
 
@@ -2143,7 +2433,7 @@ found_perfect_match:
    static void dither_block_555(color_quad_u8* dest, const color_quad_u8* block)
    {
       int err[8],*ep1 = err,*ep2 = err+4;
-      uint8 *quant = g_quant5_tab+8;
+      const uint8 *quant = get_etc1_encoder_tables().m_quant5+8;
 
       memset(dest, 0xFF, sizeof(color_quad_u8)*16);
 
@@ -2184,6 +2474,8 @@ found_perfect_match:
 
    unsigned int pack_etc1_block(void* pETC1_block, const unsigned int* pSrc_pixels_rgba, etc1_pack_params& pack_params)
    {
+      get_etc1_encoder_tables();
+
       const color_quad_u8* pSrc_pixels = reinterpret_cast<const color_quad_u8*>(pSrc_pixels_rgba);
       etc1_block& dst_block = *static_cast<etc1_block*>(pETC1_block);
 
@@ -36,9 +36,23 @@ namespace rg_etc1
       }
    };
 
-   // Important: pack_etc1_block_init() must be called before calling pack_etc1_block().
+   // The encoder's lookup tables are built on first use by any thread, & the fastest error evaluation kernel the CPU
+   // supports is selected along with them. Calling pack_etc1_block_init() first is optional; it just moves that one-time cost.
    void pack_etc1_block_init();
 
+   // Instruction sets the encoder's error evaluation can use. Every level produces identical blocks.
+   enum etc1_simd_level
+   {
+      cSIMDNone,
+      cSIMDSSE41,
+      cSIMDAVX2,
+   };
+
+   // Overrides the kernel picked by pack_etc1_block_init(); returns false if the CPU lacks the instruction set.
+   // Call it while no blocks are being packed.
+   bool set_etc1_simd_level(etc1_simd_level level);
+   etc1_simd_level get_etc1_simd_level();
+
    // Packs a 4x4 block of 32bpp RGBA pixels to an 8-byte ETC1 block.
    // 32-bit RGBA pixels must always be arranged as (R,G,B,A) (R first, A last) in memory, independent of platform endianness. A should always be 255.
    // Returns squared error of result.
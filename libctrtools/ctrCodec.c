@@ -0,0 +1,181 @@
+#include "ctrInternal.h"
+
+static const char* const codecNames[] = { "none", "zlib", "yaz0", "lz11", "lz13" };
+
+// A zlib stream starts with CMF/FLG: deflate, window <= 32K & a header
+// checksum that is a multiple of 31.
+static int I_CtrIsZlibHeader(const u8* bytes) {
+    return
+        (bytes[0] & 0x0F) == 8 && (bytes[0] >> 4) <= 7 &&
+        (((u32)bytes[0] << 8) | bytes[1]) % 31 == 0;
+}
+
+CtrCodec CtrCodecDetect(const void* data, size_t size) {
+    const u8* bytes = (const u8*)data;
+
+    if (!bytes || size < 4)
+        return CTR_CODEC_NONE;
+
+    if (memcmp(bytes, "Yaz0", 4) == 0)
+        return CTR_CODEC_YAZ0;
+    if (memcmp(bytes, "SARC", 4) == 0 || memcmp(bytes, "CTPK", 4) == 0)
+        return CTR_CODEC_NONE;
+
+    // Explicit type bytes before the zlib guess: an LZ11 stream's size bytes
+    // can pass for a zlib header. A ZLIB-SARC only starts with 0x11 or 0x13
+    // from 272 MiB decompressed, more than a 3DS has memory for.
+    if (bytes[0] == 0x13) {
+        // The wrapped LZ11 header follows the 4 or 8 byte LZ13 one
+        size_t inner = (bytes[1] | bytes[2] | bytes[3]) ? 4 : 8;
+        if (size > inner && bytes[inner] == 0x11)
+            return CTR_CODEC_LZ13;
+    }
+    if (bytes[0] == 0x11)
+        return CTR_CODEC_LZ11;
+
+    // ZLIB-SARC has no magic; its size prefix is followed by the zlib header
+    if (size >= 6 && I_CtrIsZlibHeader(bytes + 4))
+        return CTR_CODEC_ZLIB;
+
+    return CTR_CODEC_NONE;
+}
+
+const char* CtrCodecName(CtrCodec codec) {
+    if ((u32)codec >= sizeof(codecNames) / sizeof(codecNames[0]))
+        return "unknown";
+
+    return codecNames[codec];
+}
+
+CtrStatus CtrCodecFromName(const char* name, CtrCodec* codecOut) {
+    if (!name || !codecOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    for (u32 i = 0; i < sizeof(codecNames) / sizeof(codecNames[0]); i++) {
+        if (strcmp(name, codecNames[i]) == 0) {
+            *codecOut = (CtrCodec)i;
+            return CTR_OK;
+        }
+    }
+
+    // Yaz0 archives are usually called SZS
+    if (strcmp(name, "szs") == 0) {
+        *codecOut = CTR_CODEC_YAZ0;
+        return CTR_OK;
+    }
+
+    return CTR_ERROR_NOT_FOUND;
+}
+
+CtrStatus CtrCodecGetDecompressedSize(CtrCodec codec, const void* data, size_t size, size_t* sizeOut) {
+    if (!data || !sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    switch (codec) {
+    case CTR_CODEC_NONE:
+        *sizeOut = size;
+        return CTR_OK;
+    case CTR_CODEC_ZLIB:
+        return CtrZlibGetDecompressedSize(data, size, sizeOut);
+    case CTR_CODEC_YAZ0:
+        return I_CtrYaz0GetDecompressedSize((const u8*)data, size, sizeOut);
+    case CTR_CODEC_LZ11:
+    case CTR_CODEC_LZ13:
+        return I_CtrLz11GetDecompressedSize((const u8*)data, size, codec == CTR_CODEC_LZ13, sizeOut);
+    }
+
+    return CTR_ERROR_INVALID_ARGUMENT;
+}
+
+CtrStatus CtrCodecDecompressInto(
+    const CtrAllocator* allocator, CtrCodec codec, const void* data, size_t size,
+    void* out, size_t outSize
+) {
+    size_t decompressedSize;
+    CtrStatus status = CtrCodecGetDecompressedSize(codec, data, size, &decompressedSize);
+    if (status != CTR_OK)
+        return status;
+    if (!out && decompressedSize)
+        return CTR_ERROR_INVALID_ARGUMENT;
+    if (outSize < decompressedSize)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    switch (codec) {
+    case CTR_CODEC_NONE:
+        memcpy(out, data, size);
+        return CTR_OK;
+    case CTR_CODEC_ZLIB:
+        return CtrZlibDecompressInto(allocator, data, size, out, outSize);
+    case CTR_CODEC_YAZ0:
+        return I_CtrYaz0Decode((const u8*)data, size, (u8*)out, decompressedSize);
+    case CTR_CODEC_LZ11:
+    case CTR_CODEC_LZ13:
+        return I_CtrLz11Decode((const u8*)data, size, codec == CTR_CODEC_LZ13, (u8*)out, decompressedSize);
+    }
+
+    return CTR_ERROR_INVALID_ARGUMENT;
+}
+
+CtrStatus CtrCodecDecompress(
+    const CtrAllocator* allocator, CtrCodec codec, const void* data, size_t size,
+    void** dataOut, size_t* sizeOut
+) {
+    if (!dataOut || !sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    size_t decompressedSize;
+    CtrStatus status = CtrCodecGetDecompressedSize(codec, data, size, &decompressedSize);
+    if (status != CTR_OK)
+        return status;
+
+    u8* buffer = (u8*)I_CtrAlloc(allocator, decompressedSize ? decompressedSize : 1);
+    if (buffer == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    status = CtrCodecDecompressInto(allocator, codec, data, size, buffer, decompressedSize);
+    if (status != CTR_OK) {
+        I_CtrFree(allocator, buffer);
+        return status;
+    }
+
+    *dataOut = buffer;
+    *sizeOut = decompressedSize;
+
+    return CTR_OK;
+}
+
+CtrStatus CtrCodecCompress(
+    const CtrAllocator* allocator, CtrCodec codec, const void* data, size_t size, int level,
+    void** dataOut, size_t* sizeOut
+) {
+    if (!data || !dataOut || !sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    switch (codec) {
+    case CTR_CODEC_NONE: {
+        u8* buffer = (u8*)I_CtrAlloc(allocator, size ? size : 1);
+        if (buffer == NULL)
+            return CTR_ERROR_OUT_OF_MEMORY;
+
+        memcpy(buffer, data, size);
+
+        *dataOut = buffer;
+        *sizeOut = size;
+        return CTR_OK;
+    }
+    case CTR_CODEC_ZLIB:
+        if (level >= CTR_CODEC_LEVEL_ULTRA)
+            return CtrZlibCompressUltra(allocator, data, size, 0, dataOut, sizeOut);
+
+        return CtrZlibCompress(allocator, data, size, level, dataOut, sizeOut);
+    case CTR_CODEC_YAZ0:
+        return I_CtrYaz0Encode(allocator, (const u8*)data, size, level, dataOut, sizeOut);
+    case CTR_CODEC_LZ11:
+    case CTR_CODEC_LZ13:
+        return I_CtrLz11Encode(
+            allocator, (const u8*)data, size, level, codec == CTR_CODEC_LZ13, dataOut, sizeOut
+        );
+    }
+
+    return CTR_ERROR_INVALID_ARGUMENT;
+}
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ctrInternal.h"
+
+const char* CtrStatusString(CtrStatus status) {
+    switch (status) {
+    case CTR_OK:
+        return "Success";
+    case CTR_ERROR_INVALID_ARGUMENT:
+        return "Invalid argument";
+    case CTR_ERROR_OUT_OF_MEMORY:
+        return "Failed to allocate memory";
+    case CTR_ERROR_BAD_MAGIC:
+        return "Header magic is nonmatching";
+    case CTR_ERROR_BAD_BYTE_ORDER:
+        return "Byte order mark is invalid";
+    case CTR_ERROR_TRUNCATED:
+        return "File is truncated or an offset is out of range";
+    case CTR_ERROR_UNSUPPORTED_FORMAT:
+        return "Texture format not implemented";
+    case CTR_ERROR_NOT_FOUND:
+        return "Not found";
+    case CTR_ERROR_COMPRESSION:
+        return "Compressed data is invalid";
+    case CTR_ERROR_ABORTED:
+        return "Stopped by a callback";
+    }
+
+    return "Unknown error";
+}
+
+void* I_CtrAlloc(const CtrAllocator* allocator, size_t size) {
+    if (allocator && allocator->alloc)
+        return allocator->alloc(allocator->user, size);
+
+    return malloc(size);
+}
+
+void I_CtrFree(const CtrAllocator* allocator, void* ptr) {
+    if (ptr == NULL)
+        return;
+
+    if (allocator && allocator->free)
+        allocator->free(allocator->user, ptr);
+    else
+        free(ptr);
+}
+
+void I_CtrCopyAllocator(CtrAllocator* dst, const CtrAllocator* src) {
+    if (src)
+        *dst = *src;
+    else {
+        dst->alloc = NULL;
+        dst->free = NULL;
+        dst->user = NULL;
+    }
+}
+
+void CtrFree(const CtrAllocator* allocator, void* ptr) {
+    I_CtrFree(allocator, ptr);
+}
+
+uint32_t CtrGetCpuCount(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+}
+
+uint32_t CtrRunThreads(
+    const CtrAllocator* allocator, uint32_t threadCount,
+    void* (*worker)(void* user), void* user
+) {
+    if (threadCount == 0)
+        threadCount = CtrGetCpuCount();
+
+    pthread_t* threads = NULL;
+    if (threadCount > 1)
+        threads = (pthread_t*)I_CtrAlloc(allocator, sizeof(pthread_t) * (threadCount - 1));
+
+    u32 started = 0;
+    if (threads) {
+        while (started < threadCount - 1) {
+            if (pthread_create(threads + started, NULL, worker, user) != 0)
+                break;
+            started++;
+        }
+    }
+
+    worker(user);
+
+    for (u32 i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    I_CtrFree(allocator, threads);
+
+    return started + 1;
+}
@@ -0,0 +1,345 @@
+#include "ctrInternal.h"
+
+struct CtrCtpk {
+    CtrAllocator allocator;
+
+    const u8* data;
+    size_t size;
+
+    const CtpkFileHeader* fileHeader;
+    const TextureEntry* entries;
+};
+
+const char* CtrCtpkFormatName(uint32_t format) {
+    static const char* const formatNames[] = {
+        "RGBA8888", "RGB888", "RGBA5551", "RGB565", "RGBA4444", "LA88", "HL8",
+        "L8", "A8", "LA44", "L4", "A4", "ETC1", "ETC1A4"
+    };
+
+    if (format >= sizeof(formatNames) / sizeof(formatNames[0]))
+        return "UNKNOWN";
+
+    return formatNames[format];
+}
+
+/*
+    Checks every texture entry once, up front: paths are terminated strings
+    inside the file & data ranges lie inside it. Lookups & decodes then use
+    entry fields as they are, without checks of their own.
+*/
+static CtrStatus I_CtrCtpkValidateEntries(const u8* data, size_t size, const CtpkFileHeader* fileHeader) {
+    const TextureEntry* entries = (const TextureEntry*)(fileHeader + 1);
+
+    for (u32 i = 0; i < fileHeader->textureCount; i++) {
+        const TextureEntry* entry = entries + i;
+
+        size_t dataOffset = (size_t)fileHeader->textureSectionOffset + entry->dataOffset;
+        if (
+            entry->pathOffset >= size ||
+            !memchr(data + entry->pathOffset, '\0', size - entry->pathOffset) ||
+            dataOffset + entry->dataSize > size
+        )
+            return CTR_ERROR_TRUNCATED;
+    }
+
+    return CTR_OK;
+}
+
+CtrStatus CtrCtpkOpen(const CtrAllocator* allocator, const void* data, size_t size, CtrCtpk** ctpkOut) {
+    if (!data || !ctpkOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    const CtpkFileHeader* fileHeader = (const CtpkFileHeader*)data;
+
+    if (size < sizeof(CtpkFileHeader))
+        return CTR_ERROR_TRUNCATED;
+    if (fileHeader->magic != CTPK_MAGIC)
+        return CTR_ERROR_BAD_MAGIC;
+
+    if (sizeof(CtpkFileHeader) + sizeof(TextureEntry) * (size_t)fileHeader->textureCount > size)
+        return CTR_ERROR_TRUNCATED;
+
+    CtrStatus status = I_CtrCtpkValidateEntries((const u8*)data, size, fileHeader);
+    if (status != CTR_OK)
+        return status;
+
+    CtrCtpk* ctpk = (CtrCtpk*)I_CtrAlloc(allocator, sizeof(CtrCtpk));
+    if (ctpk == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    I_CtrCopyAllocator(&ctpk->allocator, allocator);
+
+    ctpk->data = (const u8*)data;
+    ctpk->size = size;
+
+    ctpk->fileHeader = fileHeader;
+    ctpk->entries = (const TextureEntry*)(fileHeader + 1);
+
+    *ctpkOut = ctpk;
+    return CTR_OK;
+}
+
+void CtrCtpkClose(CtrCtpk* ctpk) {
+    if (ctpk == NULL)
+        return;
+
+    CtrAllocator allocator = ctpk->allocator;
+    I_CtrFree(&allocator, ctpk);
+}
+
+uint32_t CtrCtpkGetTextureCount(const CtrCtpk* ctpk) {
+    return ctpk->fileHeader->textureCount;
+}
+
+CtrStatus CtrCtpkGetTexture(const CtrCtpk* ctpk, uint32_t index, CtrCtpkTexture* textureOut) {
+    if (!ctpk || !textureOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+    if (index >= ctpk->fileHeader->textureCount)
+        return CTR_ERROR_NOT_FOUND;
+
+    // Offsets were validated by CtrCtpkOpen
+    const TextureEntry* entry = ctpk->entries + index;
+
+    size_t dataOffset = (size_t)ctpk->fileHeader->textureSectionOffset + entry->dataOffset;
+
+    textureOut->path = (const char*)ctpk->data + entry->pathOffset;
+
+    textureOut->format = entry->dataFormat;
+    textureOut->width = entry->width;
+    textureOut->height = entry->height;
+    textureOut->mipCount = entry->mipLevel;
+
+    textureOut->data = ctpk->data + dataOffset;
+    textureOut->dataSize = entry->dataSize;
+    textureOut->dataOffset = dataOffset;
+
+    textureOut->timestamp = entry->srcTimestamp;
+
+    return CTR_OK;
+}
+
+CtrStatus CtrCtpkFind(const CtrCtpk* ctpk, const char* path, uint32_t* indexOut) {
+    if (!ctpk || !path || !indexOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    for (u32 i = 0; i < ctpk->fileHeader->textureCount; i++) {
+        CtrCtpkTexture texture;
+        if (CtrCtpkGetTexture(ctpk, i, &texture) != CTR_OK)
+            continue;
+
+        if (strcmp(path, texture.path) == 0) {
+            *indexOut = i;
+            return CTR_OK;
+        }
+    }
+
+    return CTR_ERROR_NOT_FOUND;
+}
+
+/*
+    ETC1 textures are stored as 8x8 tiles, left to right & top to bottom. Each
+    tile holds four 4x4 blocks in Z order (top left, top right, bottom left,
+    bottom right). ETC1A4 prefixes every block with 64 bits of 4-bit alpha in
+    column-major order.
+*/
+
+static void I_CtrDecodeETC1A4TileRow(u32* rows, const u32* dataIn, u16 width) {
+    u32 inOffset = 0;
+
+    for (u32 xImage = 0; xImage < width; xImage += 8) {
+        u64 data;
+        u32 pixels[4 * 4];
+
+        for (unsigned z = 0; z < 4; z++) {
+            unsigned xStart = (z == 0 || z == 2 ? 0 : 4);
+            unsigned yStart = (z == 0 || z == 1 ? 0 : 4);
+
+            memcpy(&data, &dataIn[inOffset], sizeof(u64));
+            inOffset += 2;
+
+            for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
+                for (u32 y = yStart; y < yStart + 4; y++) {
+                    rows[(y * width) + x] =
+                        ((((data & 0xF) << 28) | ((data & 0xF) << 24)) & 0xFF000000);
+                    data >>= 4;
+                }
+
+            memcpy(&data, &dataIn[inOffset], sizeof(u64));
+            data = __builtin_bswap64(data);
+            inOffset += 2;
+
+            unpackETC1Block(&data, pixels, FALSE);
+
+            u32* lPixel = pixels;
+            for (u32 y = yStart; y < yStart + 4; y++)
+            for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
+                rows[(y * width) + x] |= (*(lPixel++) & 0xFFFFFF);
+        }
+    }
+}
+
+static void I_CtrDecodeETC1TileRow(u32* rows, const u32* dataIn, u16 width) {
+    u32 inOffset = 0;
+
+    for (u32 xImage = 0; xImage < width; xImage += 8) {
+        u64 data;
+        u32 pixels[4 * 4];
+
+        for (unsigned z = 0; z < 4; z++) {
+            unsigned xStart = (z == 0 || z == 2 ? 0 : 4);
+            unsigned yStart = (z == 0 || z == 1 ? 0 : 4);
+
+            memcpy(&data, &dataIn[inOffset], sizeof(u64));
+            data = __builtin_bswap64(data);
+            inOffset += 2;
+
+            unpackETC1Block(&data, pixels, FALSE);
+
+            u32* lPixel = pixels;
+            for (u32 y = yStart; y < yStart + 4; y++)
+            for (u32 x = xImage + xStart; x < xImage + xStart + 4; x++)
+                rows[(y * width) + x] = *(lPixel++);
+        }
+    }
+}
+
+// Decodes tile row tileRow (pixel rows tileRow * 8 ..) into rows, which holds
+// 8 * width pixels.
+static void I_CtrDecodeTileRow(u32* rows, const CtrCtpkTexture* texture, u32 tileRow) {
+    // One ETC1 block is 2 words per 4x4 pixels; ETC1A4 adds 2 words of alpha
+    u32 wordsPerRow = texture->format == CTR_CTPK_FORMAT_ETC1 ? texture->width : texture->width * 2;
+    const u32* dataIn = (const u32*)texture->data + (size_t)wordsPerRow * tileRow;
+
+    if (texture->format == CTR_CTPK_FORMAT_ETC1)
+        I_CtrDecodeETC1TileRow(rows, dataIn, texture->width);
+    else
+        I_CtrDecodeETC1A4TileRow(rows, dataIn, texture->width);
+}
+
+// Checks that a texture can be decoded & returns the size of its pixels.
+static CtrStatus I_CtrCtpkCheckDecodable(const CtrCtpkTexture* texture, size_t* sizeOut) {
+    u32 blockBytes;
+    switch (texture->format) {
+    case CTR_CTPK_FORMAT_ETC1:
+        blockBytes = 8;
+        break;
+    case CTR_CTPK_FORMAT_ETC1A4:
+        blockBytes = 16;
+        break;
+
+    default:
+        return CTR_ERROR_UNSUPPORTED_FORMAT;
+    }
+
+    // Partial tiles aren't representable; the data must cover every 4x4 block.
+    if ((texture->width % 8) != 0 || (texture->height % 8) != 0)
+        return CTR_ERROR_UNSUPPORTED_FORMAT;
+    if ((u64)texture->width * texture->height / 16 * blockBytes > texture->dataSize)
+        return CTR_ERROR_TRUNCATED;
+
+    *sizeOut = (size_t)texture->width * texture->height * 4;
+    return CTR_OK;
+}
+
+size_t CtrCtpkGetDecodedSize(const CtrCtpk* ctpk, uint32_t index) {
+    CtrCtpkTexture texture;
+    if (CtrCtpkGetTexture(ctpk, index, &texture) != CTR_OK)
+        return 0;
+
+    size_t size;
+    if (I_CtrCtpkCheckDecodable(&texture, &size) != CTR_OK)
+        return 0;
+
+    return size;
+}
+
+size_t CtrCtpkGetMaxDecodedSize(const CtrCtpk* ctpk) {
+    size_t maxSize = 0;
+
+    for (u32 i = 0; i < ctpk->fileHeader->textureCount; i++) {
+        size_t size = CtrCtpkGetDecodedSize(ctpk, i);
+        if (size > maxSize)
+            maxSize = size;
+    }
+
+    return maxSize;
+}
+
+CtrStatus CtrCtpkDecodeTextureInto(
+    const CtrCtpk* ctpk, uint32_t index, uint32_t* pixels, size_t capacity, size_t* sizeOut
+) {
+    if (!sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    CtrCtpkTexture texture;
+    CtrStatus status = CtrCtpkGetTexture(ctpk, index, &texture);
+    if (status != CTR_OK)
+        return status;
+
+    size_t size;
+    status = I_CtrCtpkCheckDecodable(&texture, &size);
+    if (status != CTR_OK)
+        return status;
+
+    if (!pixels || size > capacity)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    for (u32 tileRow = 0; tileRow < texture.height / 8u; tileRow++)
+        I_CtrDecodeTileRow(pixels + (size_t)texture.width * 8 * tileRow, &texture, tileRow);
+
+    *sizeOut = size;
+    return CTR_OK;
+}
+
+CtrStatus CtrCtpkDecodeTextureRows(
+    const CtrCtpk* ctpk, uint32_t index, CtrCtpkRowCallback callback, void* user
+) {
+    if (!ctpk || !callback)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    CtrCtpkTexture texture;
+    CtrStatus status = CtrCtpkGetTexture(ctpk, index, &texture);
+    if (status != CTR_OK)
+        return status;
+
+    size_t size;
+    status = I_CtrCtpkCheckDecodable(&texture, &size);
+    if (status != CTR_OK)
+        return status;
+
+    u32* rows = (u32*)I_CtrAlloc(&ctpk->allocator, (size_t)texture.width * 8 * 4 + 1);
+    if (rows == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    for (u32 tileRow = 0; tileRow < texture.height / 8u; tileRow++) {
+        I_CtrDecodeTileRow(rows, &texture, tileRow);
+
+        if (callback(user, tileRow * 8, 8, rows) != 0) {
+            status = CTR_ERROR_ABORTED;
+            break;
+        }
+    }
+
+    I_CtrFree(&ctpk->allocator, rows);
+    return status;
+}
+
+CtrStatus CtrCtpkDecodeTexture(const CtrCtpk* ctpk, uint32_t index, uint32_t** pixelsOut, size_t* sizeOut) {
+    if (!ctpk || !pixelsOut || !sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    size_t bufferSize = CtrCtpkGetDecodedSize(ctpk, index);
+
+    u32* buffer = (u32*)I_CtrAlloc(&ctpk->allocator, bufferSize ? bufferSize : 1);
+    if (buffer == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    CtrStatus status = CtrCtpkDecodeTextureInto(ctpk, index, buffer, bufferSize, sizeOut);
+    if (status != CTR_OK) {
+        I_CtrFree(&ctpk->allocator, buffer);
+        return status;
+    }
+
+    *pixelsOut = buffer;
+    return CTR_OK;
+}
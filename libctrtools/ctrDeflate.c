@@ -0,0 +1,1139 @@
+#include <math.h>
+
+#include <zlib.h>
+
+#include "ctrInternal.h"
+
+/*
+    Optimal-parsing deflate for CtrZlibCompressUltra.
+
+    The input is cut into DEFLATE_SEGMENT_SIZE segments, each encoded on its
+    own (in parallel) & ended with an empty stored block, like a zlib sync
+    flush, so the segments' bytes simply concatenate. Matches still reach up
+    to 32K back into the previous segment; the segment size is fixed, so the
+    output doesn't depend on the thread count.
+
+    Per segment:
+    - Every match length & the shortest distance for it is found once over
+      hash chains & cached.
+    - The cheapest path through those is searched DEFLATE_ITERATIONS times,
+      each time with symbol costs from the previous path's statistics
+      (starting from the fixed Huffman code); the smallest result is kept.
+    - That path is split into blocks where separate Huffman codes pay for
+      their headers, & every block is written as dynamic, fixed or stored,
+      whichever is smallest.
+*/
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+#define DEFLATE_HASH_BITS 16
+#define DEFLATE_MAX_CHAIN 8192
+
+#define DEFLATE_SEGMENT_SIZE (1024 * 1024)
+#define DEFLATE_ITERATIONS 15
+
+#define DEFLATE_MIN_BLOCK 1024 // Symbols; smaller blocks aren't split further
+#define DEFLATE_SPLIT_POINTS 9
+
+#define DEFLATE_MAX_STORED 65535
+
+static const u16 lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const u8 lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const u16 distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const u8 distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const u8 codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static inline u32 I_CtrFloorLog2(u32 value) {
+    return 31 - __builtin_clz(value);
+}
+
+// Length code (0-28, i.e. symbol 257+) for a match length.
+static inline u32 I_CtrLengthCode(u32 length) {
+    u32 value = length - DEFLATE_MIN_MATCH;
+
+    if (length == DEFLATE_MAX_MATCH)
+        return 28;
+    if (value < 8)
+        return value;
+
+    u32 log = I_CtrFloorLog2(value);
+    return 4 * (log - 1) + ((value >> (log - 2)) & 3);
+}
+
+static inline u32 I_CtrDistanceCode(u32 distance) {
+    u32 value = distance - 1;
+    if (value < 4)
+        return value;
+
+    u32 log = I_CtrFloorLog2(value);
+    return 2 * log + ((value >> (log - 1)) & 1);
+}
+
+//////////////////////////////////////// Huffman codes
+
+/*
+    Code lengths limited to maxBits: plain Huffman, then lengths over the
+    limit are clamped & the code made complete again by lengthening the
+    longest codes that still fit. Every code gets at least 2 symbols, as
+    inflate rejects incomplete ones.
+*/
+static void I_CtrHuffmanLengths(const u32* freqs, u32 count, u32 maxBits, u8* lengths) {
+    u16 symbols[288];
+    u32 used = 0;
+
+    memset(lengths, 0, count);
+
+    for (u32 i = 0; i < count; i++) {
+        if (freqs[i])
+            symbols[used++] = (u16)i;
+    }
+
+    if (used < 2) {
+        // Pad with symbol 0 or 1 so the code is complete
+        lengths[used && symbols[0] == 0 ? 1 : 0] = 1;
+        lengths[used ? symbols[0] : 1] = 1;
+        return;
+    }
+
+    // Ascending frequency, ties by symbol so the result is deterministic
+    for (u32 i = 1; i < used; i++) {
+        u16 symbol = symbols[i];
+        u32 j = i;
+        while (j > 0 && freqs[symbols[j - 1]] > freqs[symbol]) {
+            symbols[j] = symbols[j - 1];
+            j--;
+        }
+        symbols[j] = symbol;
+    }
+
+    // Two-queue construction: leaves in order, then internal nodes as made
+    u32 weights[2 * 288];
+    u32 parents[2 * 288];
+    u32 depths[2 * 288];
+
+    for (u32 i = 0; i < used; i++)
+        weights[i] = freqs[symbols[i]];
+
+    u32 leaf = 0;
+    u32 node = used;
+    u32 nextNode = used;
+
+    for (u32 k = 0; k < used - 1; k++) {
+        u32 pair[2];
+        for (u32 p = 0; p < 2; p++) {
+            if (leaf < used && (node >= nextNode || weights[leaf] <= weights[node]))
+                pair[p] = leaf++;
+            else
+                pair[p] = node++;
+        }
+
+        weights[nextNode] = weights[pair[0]] + weights[pair[1]];
+        parents[pair[0]] = parents[pair[1]] = nextNode;
+        nextNode++;
+    }
+
+    u32 root = nextNode - 1;
+    depths[root] = 0;
+    for (u32 i = root; i-- > 0;)
+        depths[i] = depths[parents[i]] + 1;
+
+    u32 lengthCounts[16] = { 0 };
+    for (u32 i = 0; i < used; i++)
+        lengthCounts[depths[i] > maxBits ? maxBits : depths[i]]++;
+
+    u32 total = 0;
+    for (u32 bits = 1; bits <= maxBits; bits++)
+        total += lengthCounts[bits] << (maxBits - bits);
+
+    while (total != (1u << maxBits)) {
+        lengthCounts[maxBits]--;
+        for (u32 bits = maxBits - 1; bits > 0; bits--) {
+            if (lengthCounts[bits]) {
+                lengthCounts[bits]--;
+                lengthCounts[bits + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // The least frequent symbols take the longest codes
+    u32 next = 0;
+    for (u32 bits = maxBits; bits > 0; bits--) {
+        for (u32 c = lengthCounts[bits]; c; c--)
+            lengths[symbols[next++]] = (u8)bits;
+    }
+}
+
+// Canonical codes, bit-reversed for deflate's LSB-first bit order.
+static void I_CtrHuffmanCodes(const u8* lengths, u32 count, u16* codes) {
+    u32 lengthCounts[16] = { 0 };
+    u32 nextCode[16];
+
+    for (u32 i = 0; i < count; i++)
+        lengthCounts[lengths[i]]++;
+    lengthCounts[0] = 0;
+
+    u32 code = 0;
+    for (u32 bits = 1; bits < 16; bits++) {
+        code = (code + lengthCounts[bits - 1]) << 1;
+        nextCode[bits] = code;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        u32 bits = lengths[i];
+        if (bits == 0)
+            continue;
+
+        u32 value = nextCode[bits]++;
+        u32 reversed = 0;
+        for (u32 b = 0; b < bits; b++)
+            reversed |= ((value >> b) & 1) << (bits - 1 - b);
+
+        codes[i] = (u16)reversed;
+    }
+}
+
+//////////////////////////////////////// Blocks
+
+typedef struct {
+    u16 length; // 1: literal
+    u16 distance; // 0: literal
+    u8 literal;
+} I_CtrDeflateSymbol;
+
+typedef struct {
+    u32 litFreqs[288];
+    u32 distFreqs[30];
+
+    u64 extraBits;
+    u64 inputSize;
+} I_CtrDeflateHistogram;
+
+typedef struct {
+    u8 litLengths[288];
+    u8 distLengths[30];
+
+    u32 litCount; // HLIT + 257
+    u32 distCount; // HDIST + 1
+
+    u8 clLengths[19];
+    u32 clCount; // HCLEN + 4
+
+    u8 rle[288 + 30]; // Code length symbols ...
+    u8 rleExtra[288 + 30]; // ... & their repeat counts
+    u32 rleCount;
+} I_CtrDeflateTree;
+
+static void I_CtrDeflateCount(
+    const I_CtrDeflateSymbol* symbols, u32 count, I_CtrDeflateHistogram* histogram
+) {
+    memset(histogram, 0, sizeof(I_CtrDeflateHistogram));
+
+    for (u32 i = 0; i < count; i++) {
+        const I_CtrDeflateSymbol* symbol = symbols + i;
+
+        if (symbol->distance == 0) {
+            histogram->litFreqs[symbol->literal]++;
+            histogram->inputSize++;
+            continue;
+        }
+
+        u32 lengthCode = I_CtrLengthCode(symbol->length);
+        u32 distanceCode = I_CtrDistanceCode(symbol->distance);
+
+        histogram->litFreqs[257 + lengthCode]++;
+        histogram->distFreqs[distanceCode]++;
+        histogram->extraBits += lengthExtra[lengthCode] + distanceExtra[distanceCode];
+        histogram->inputSize += symbol->length;
+    }
+
+    histogram->litFreqs[256] = 1; // End of block
+}
+
+// Builds the dynamic code for a histogram; returns the header size in bits.
+static u64 I_CtrDeflateBuildTree(const I_CtrDeflateHistogram* histogram, I_CtrDeflateTree* tree) {
+    I_CtrHuffmanLengths(histogram->litFreqs, 288, 15, tree->litLengths);
+    I_CtrHuffmanLengths(histogram->distFreqs, 30, 15, tree->distLengths);
+
+    tree->litCount = 286;
+    while (tree->litCount > 257 && tree->litLengths[tree->litCount - 1] == 0)
+        tree->litCount--;
+
+    tree->distCount = 30;
+    while (tree->distCount > 1 && tree->distLengths[tree->distCount - 1] == 0)
+        tree->distCount--;
+
+    u8 all[288 + 30];
+    u32 allCount = tree->litCount + tree->distCount;
+    memcpy(all, tree->litLengths, tree->litCount);
+    memcpy(all + tree->litCount, tree->distLengths, tree->distCount);
+
+    u32 clFreqs[19] = { 0 };
+    tree->rleCount = 0;
+
+    for (u32 i = 0; i < allCount;) {
+        u8 value = all[i];
+
+        u32 run = 1;
+        while (i + run < allCount && all[i + run] == value)
+            run++;
+
+        if (value == 0 && run >= 3) {
+            u32 take = run > 138 ? 138 : run;
+
+            tree->rle[tree->rleCount] = take >= 11 ? 18 : 17;
+            tree->rleExtra[tree->rleCount++] = (u8)(take - (take >= 11 ? 11 : 3));
+            clFreqs[take >= 11 ? 18 : 17]++;
+
+            i += take;
+            continue;
+        }
+
+        // A value, then repeats of it in runs of 3-6
+        tree->rle[tree->rleCount] = value;
+        tree->rleExtra[tree->rleCount++] = 0;
+        clFreqs[value]++;
+        i++;
+        run--;
+
+        while (run >= 3) {
+            u32 take = run > 6 ? 6 : run;
+
+            tree->rle[tree->rleCount] = 16;
+            tree->rleExtra[tree->rleCount++] = (u8)(take - 3);
+            clFreqs[16]++;
+
+            i += take;
+            run -= take;
+        }
+    }
+
+    I_CtrHuffmanLengths(clFreqs, 19, 7, tree->clLengths);
+
+    tree->clCount = 19;
+    while (tree->clCount > 4 && tree->clLengths[codeLengthOrder[tree->clCount - 1]] == 0)
+        tree->clCount--;
+
+    u64 bits = 5 + 5 + 4 + 3 * tree->clCount;
+    for (u32 i = 0; i < tree->rleCount; i++) {
+        u8 symbol = tree->rle[i];
+        bits += tree->clLengths[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+    }
+
+    return bits;
+}
+
+static void I_CtrDeflateFixedLengths(u8* litLengths, u8* distLengths) {
+    for (u32 i = 0; i < 288; i++)
+        litLengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    for (u32 i = 0; i < 30; i++)
+        distLengths[i] = 5;
+}
+
+static u64 I_CtrDeflateDataBits(
+    const I_CtrDeflateHistogram* histogram, const u8* litLengths, const u8* distLengths
+) {
+    u64 bits = histogram->extraBits;
+
+    for (u32 i = 0; i < 286; i++)
+        bits += (u64)histogram->litFreqs[i] * litLengths[i];
+    for (u32 i = 0; i < 30; i++)
+        bits += (u64)histogram->distFreqs[i] * distLengths[i];
+
+    return bits;
+}
+
+static u64 I_CtrDeflateStoredBits(u64 inputSize) {
+    u64 blocks = inputSize ? (inputSize + DEFLATE_MAX_STORED - 1) / DEFLATE_MAX_STORED : 1;
+
+    // Header, worst case alignment & LEN/NLEN per block
+    return blocks * (3 + 7 + 32) + inputSize * 8;
+}
+
+// Size in bits of the smallest encoding of the block.
+static u64 I_CtrDeflateBlockCost(const I_CtrDeflateSymbol* symbols, u32 count) {
+    I_CtrDeflateHistogram histogram;
+    I_CtrDeflateCount(symbols, count, &histogram);
+
+    I_CtrDeflateTree tree;
+    u64 dynamicBits = 3 + I_CtrDeflateBuildTree(&histogram, &tree) +
+        I_CtrDeflateDataBits(&histogram, tree.litLengths, tree.distLengths);
+
+    u8 fixedLit[288];
+    u8 fixedDist[30];
+    I_CtrDeflateFixedLengths(fixedLit, fixedDist);
+
+    u64 fixedBits = 3 + I_CtrDeflateDataBits(&histogram, fixedLit, fixedDist);
+    u64 storedBits = I_CtrDeflateStoredBits(histogram.inputSize);
+
+    u64 bits = dynamicBits < fixedBits ? dynamicBits : fixedBits;
+    return bits < storedBits ? bits : storedBits;
+}
+
+//////////////////////////////////////// Bit output
+
+typedef struct {
+    u8* data;
+    size_t size;
+    size_t capacity;
+
+    u64 buffer;
+    u32 bitCount;
+
+    int overflow;
+} I_CtrBitWriter;
+
+static inline void I_CtrPutBits(I_CtrBitWriter* writer, u32 value, u32 bits) {
+    writer->buffer |= (u64)value << writer->bitCount;
+    writer->bitCount += bits;
+
+    while (writer->bitCount >= 8) {
+        if (writer->size < writer->capacity)
+            writer->data[writer->size++] = (u8)writer->buffer;
+        else
+            writer->overflow = TRUE;
+
+        writer->buffer >>= 8;
+        writer->bitCount -= 8;
+    }
+}
+
+static void I_CtrAlignBits(I_CtrBitWriter* writer) {
+    if (writer->bitCount)
+        I_CtrPutBits(writer, 0, 8 - writer->bitCount);
+}
+
+static void I_CtrDeflateWriteStored(I_CtrBitWriter* writer, const u8* data, u64 size, int final) {
+    do {
+        u32 chunk = size > DEFLATE_MAX_STORED ? DEFLATE_MAX_STORED : (u32)size;
+        size -= chunk;
+
+        I_CtrPutBits(writer, final && size == 0, 1);
+        I_CtrPutBits(writer, 0, 2);
+        I_CtrAlignBits(writer);
+
+        I_CtrPutBits(writer, chunk, 16);
+        I_CtrPutBits(writer, ~chunk & 0xFFFF, 16);
+
+        for (u32 i = 0; i < chunk; i++)
+            I_CtrPutBits(writer, data[i], 8);
+        data += chunk;
+    } while (size);
+}
+
+static void I_CtrDeflateWriteSymbols(
+    I_CtrBitWriter* writer, const I_CtrDeflateSymbol* symbols, u32 count,
+    const u8* litLengths, const u8* distLengths
+) {
+    u16 litCodes[288];
+    u16 distCodes[30];
+    I_CtrHuffmanCodes(litLengths, 288, litCodes);
+    I_CtrHuffmanCodes(distLengths, 30, distCodes);
+
+    for (u32 i = 0; i < count; i++) {
+        const I_CtrDeflateSymbol* symbol = symbols + i;
+
+        if (symbol->distance == 0) {
+            I_CtrPutBits(writer, litCodes[symbol->literal], litLengths[symbol->literal]);
+            continue;
+        }
+
+        u32 lengthCode = I_CtrLengthCode(symbol->length);
+        I_CtrPutBits(writer, litCodes[257 + lengthCode], litLengths[257 + lengthCode]);
+        I_CtrPutBits(writer, symbol->length - lengthBase[lengthCode], lengthExtra[lengthCode]);
+
+        u32 distanceCode = I_CtrDistanceCode(symbol->distance);
+        I_CtrPutBits(writer, distCodes[distanceCode], distLengths[distanceCode]);
+        I_CtrPutBits(writer, symbol->distance - distanceBase[distanceCode], distanceExtra[distanceCode]);
+    }
+
+    I_CtrPutBits(writer, litCodes[256], litLengths[256]);
+}
+
+// data is the block's input, for a stored block.
+static void I_CtrDeflateWriteBlock(
+    I_CtrBitWriter* writer, const I_CtrDeflateSymbol* symbols, u32 count,
+    const u8* data, int final
+) {
+    I_CtrDeflateHistogram histogram;
+    I_CtrDeflateCount(symbols, count, &histogram);
+
+    I_CtrDeflateTree tree;
+    u64 dynamicBits = I_CtrDeflateBuildTree(&histogram, &tree) +
+        I_CtrDeflateDataBits(&histogram, tree.litLengths, tree.distLengths);
+
+    u8 fixedLit[288];
+    u8 fixedDist[30];
+    I_CtrDeflateFixedLengths(fixedLit, fixedDist);
+
+    u64 fixedBits = I_CtrDeflateDataBits(&histogram, fixedLit, fixedDist);
+
+    if (I_CtrDeflateStoredBits(histogram.inputSize) < (dynamicBits < fixedBits ? dynamicBits : fixedBits)) {
+        I_CtrDeflateWriteStored(writer, data, histogram.inputSize, final);
+        return;
+    }
+
+    I_CtrPutBits(writer, final, 1);
+
+    if (fixedBits <= dynamicBits) {
+        I_CtrPutBits(writer, 1, 2);
+        I_CtrDeflateWriteSymbols(writer, symbols, count, fixedLit, fixedDist);
+        return;
+    }
+
+    I_CtrPutBits(writer, 2, 2);
+    I_CtrPutBits(writer, tree.litCount - 257, 5);
+    I_CtrPutBits(writer, tree.distCount - 1, 5);
+    I_CtrPutBits(writer, tree.clCount - 4, 4);
+
+    for (u32 i = 0; i < tree.clCount; i++)
+        I_CtrPutBits(writer, tree.clLengths[codeLengthOrder[i]], 3);
+
+    u16 clCodes[19];
+    I_CtrHuffmanCodes(tree.clLengths, 19, clCodes);
+
+    for (u32 i = 0; i < tree.rleCount; i++) {
+        u8 symbol = tree.rle[i];
+        I_CtrPutBits(writer, clCodes[symbol], tree.clLengths[symbol]);
+
+        if (symbol >= 16)
+            I_CtrPutBits(writer, tree.rleExtra[i], symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+    }
+
+    I_CtrDeflateWriteSymbols(writer, symbols, count, tree.litLengths, tree.distLengths);
+}
+
+// Splits [start, end) where two blocks are cheaper than one; appends the
+// block ends (symbol indices) in order.
+static void I_CtrDeflateSplit(
+    const I_CtrDeflateSymbol* symbols, u32 start, u32 end, u64 cost,
+    u32* splits, u32* splitCount
+) {
+    if (end - start >= 2 * DEFLATE_MIN_BLOCK) {
+        u32 bestPoint = 0;
+        u64 bestLeft = 0;
+        u64 bestRight = 0;
+
+        for (u32 p = 1; p <= DEFLATE_SPLIT_POINTS; p++) {
+            u32 point = start + (u32)((u64)(end - start) * p / (DEFLATE_SPLIT_POINTS + 1));
+
+            u64 left = I_CtrDeflateBlockCost(symbols + start, point - start);
+            u64 right = I_CtrDeflateBlockCost(symbols + point, end - point);
+
+            if (bestPoint == 0 || left + right < bestLeft + bestRight) {
+                bestPoint = point;
+                bestLeft = left;
+                bestRight = right;
+            }
+        }
+
+        if (bestLeft + bestRight < cost) {
+            I_CtrDeflateSplit(symbols, start, bestPoint, bestLeft, splits, splitCount);
+            I_CtrDeflateSplit(symbols, bestPoint, end, bestRight, splits, splitCount);
+            return;
+        }
+    }
+
+    splits[(*splitCount)++] = end;
+}
+
+//////////////////////////////////////// Parsing
+
+typedef struct {
+    u16 length;
+    u16 distance;
+} I_CtrDeflateMatch;
+
+typedef struct {
+    const CtrAllocator* allocator;
+
+    const u8* data; // Whole input
+    size_t start;
+    size_t end;
+    int final;
+
+    // Output: whole bytes, ending on a block boundary
+    u8* out;
+    size_t outSize;
+
+    CtrStatus status;
+} I_CtrDeflateSegment;
+
+typedef struct {
+    // Per position: matchCounts[i] matches from matches[matchStarts[i]],
+    // increasing in length, each the closest one of that length or longer
+    u32* matchStarts;
+    u16* matchCounts;
+
+    I_CtrDeflateMatch* matches;
+    size_t matchCount;
+    size_t matchCapacity;
+} I_CtrDeflateMatchCache;
+
+static int I_CtrDeflatePushMatch(const CtrAllocator* allocator, I_CtrDeflateMatchCache* cache, u32 length, u32 distance) {
+    if (cache->matchCount == cache->matchCapacity) {
+        size_t capacity = cache->matchCapacity ? cache->matchCapacity * 2 : 64 * 1024;
+
+        // The allocator interface has no realloc
+        I_CtrDeflateMatch* grown = (I_CtrDeflateMatch*)I_CtrAlloc(allocator, capacity * sizeof(I_CtrDeflateMatch));
+        if (grown == NULL)
+            return FALSE;
+
+        if (cache->matches)
+            memcpy(grown, cache->matches, cache->matchCount * sizeof(I_CtrDeflateMatch));
+        I_CtrFree(allocator, cache->matches);
+
+        cache->matches = grown;
+        cache->matchCapacity = capacity;
+    }
+
+    I_CtrDeflateMatch* match = cache->matches + cache->matchCount++;
+    match->length = (u16)length;
+    match->distance = (u16)distance;
+
+    return TRUE;
+}
+
+static inline u32 I_CtrDeflateHash(const u8* bytes) {
+    u32 value = bytes[0] | (u32)bytes[1] << 8 | (u32)bytes[2] << 16;
+    return (value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static CtrStatus I_CtrDeflateFindMatches(I_CtrDeflateSegment* segment, I_CtrDeflateMatchCache* cache) {
+    const u8* data = segment->data;
+    size_t historyStart = segment->start > DEFLATE_WINDOW ? segment->start - DEFLATE_WINDOW : 0;
+
+    s32* head = (s32*)I_CtrAlloc(segment->allocator, sizeof(s32) << DEFLATE_HASH_BITS);
+    s32* prev = (s32*)I_CtrAlloc(segment->allocator, sizeof(s32) * DEFLATE_WINDOW);
+    if (!head || !prev) {
+        I_CtrFree(segment->allocator, prev);
+        I_CtrFree(segment->allocator, head);
+        return CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (u32 i = 0; i < (1u << DEFLATE_HASH_BITS); i++)
+        head[i] = -1;
+
+    CtrStatus status = CTR_OK;
+
+    // Positions are relative to historyStart, so they fit in an s32
+    for (size_t pos = historyStart; pos < segment->end; pos++) {
+        s32 relative = (s32)(pos - historyStart);
+
+        if (pos >= segment->start) {
+            u32 index = (u32)(pos - segment->start);
+
+            cache->matchStarts[index] = (u32)cache->matchCount;
+            cache->matchCounts[index] = 0;
+
+            size_t maxLength = segment->end - pos;
+            if (maxLength > DEFLATE_MAX_MATCH)
+                maxLength = DEFLATE_MAX_MATCH;
+
+            if (maxLength >= DEFLATE_MIN_MATCH) {
+                const u8* current = data + pos;
+
+                u32 best = DEFLATE_MIN_MATCH - 1;
+                s32 candidate = head[I_CtrDeflateHash(current)];
+
+                for (u32 chain = 0; candidate >= 0 && chain < DEFLATE_MAX_CHAIN; chain++) {
+                    u32 distance = (u32)(relative - candidate);
+                    if (distance == 0 || distance > DEFLATE_WINDOW)
+                        break;
+
+                    const u8* other = current - distance;
+
+                    if (other[best] == current[best]) {
+                        u32 length = 0;
+                        while (length < maxLength && other[length] == current[length])
+                            length++;
+
+                        if (length > best) {
+                            if (!I_CtrDeflatePushMatch(segment->allocator, cache, length, distance)) {
+                                status = CTR_ERROR_OUT_OF_MEMORY;
+                                break;
+                            }
+
+                            cache->matchCounts[index]++;
+                            best = length;
+
+                            if (length == maxLength)
+                                break;
+                        }
+                    }
+
+                    s32 next = prev[candidate & (DEFLATE_WINDOW - 1)];
+                    if (next >= candidate)
+                        break; // Ring slot reused by a newer position
+
+                    candidate = next;
+                }
+
+                if (status != CTR_OK)
+                    break;
+            }
+        }
+
+        if (segment->end - pos >= DEFLATE_MIN_MATCH) {
+            u32 hash = I_CtrDeflateHash(data + pos);
+
+            prev[relative & (DEFLATE_WINDOW - 1)] = head[hash];
+            head[hash] = relative;
+        }
+    }
+
+    I_CtrFree(segment->allocator, prev);
+    I_CtrFree(segment->allocator, head);
+
+    return status;
+}
+
+typedef struct {
+    float literal[256];
+    float length[DEFLATE_MAX_MATCH + 1]; // Code & extra bits
+    float distance[30]; // Code & extra bits
+} I_CtrDeflateCosts;
+
+static void I_CtrDeflateFixedCosts(I_CtrDeflateCosts* costs) {
+    for (u32 i = 0; i < 256; i++)
+        costs->literal[i] = i < 144 ? 8.0f : 9.0f;
+
+    for (u32 length = DEFLATE_MIN_MATCH; length <= DEFLATE_MAX_MATCH; length++) {
+        u32 code = I_CtrLengthCode(length);
+        costs->length[length] = (code + 257 < 280 ? 7.0f : 8.0f) + lengthExtra[code];
+    }
+
+    for (u32 i = 0; i < 30; i++)
+        costs->distance[i] = 5.0f + distanceExtra[i];
+}
+
+// Entropy of each symbol under the previous path's statistics.
+static void I_CtrDeflateStatisticCosts(const I_CtrDeflateHistogram* histogram, I_CtrDeflateCosts* costs) {
+    u64 litTotal = 0;
+    for (u32 i = 0; i < 286; i++)
+        litTotal += histogram->litFreqs[i];
+
+    u64 distTotal = 0;
+    for (u32 i = 0; i < 30; i++)
+        distTotal += histogram->distFreqs[i];
+
+    float litLog = log2f((float)litTotal);
+    float distLog = distTotal ? log2f((float)distTotal) : 0.0f;
+
+    // Unused symbols cost as if they had been seen once
+    float litCosts[286];
+    for (u32 i = 0; i < 286; i++)
+        litCosts[i] = litLog - (histogram->litFreqs[i] ? log2f((float)histogram->litFreqs[i]) : 0.0f);
+
+    for (u32 i = 0; i < 256; i++)
+        costs->literal[i] = litCosts[i];
+
+    for (u32 length = DEFLATE_MIN_MATCH; length <= DEFLATE_MAX_MATCH; length++) {
+        u32 code = I_CtrLengthCode(length);
+        costs->length[length] = litCosts[257 + code] + lengthExtra[code];
+    }
+
+    for (u32 i = 0; i < 30; i++) {
+        costs->distance[i] =
+            distLog - (histogram->distFreqs[i] ? log2f((float)histogram->distFreqs[i]) : 0.0f) +
+            distanceExtra[i];
+    }
+}
+
+static inline u32 I_CtrDeflateRandom(u32* state) {
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+// Gives about a third of the symbols another symbol's frequency.
+static void I_CtrDeflateShuffle(I_CtrDeflateHistogram* histogram, u32* random) {
+    for (u32 i = 0; i < 286; i++) {
+        if (I_CtrDeflateRandom(random) % 3 == 0)
+            histogram->litFreqs[i] = histogram->litFreqs[I_CtrDeflateRandom(random) % 286];
+    }
+    for (u32 i = 0; i < 30; i++) {
+        if (I_CtrDeflateRandom(random) % 3 == 0)
+            histogram->distFreqs[i] = histogram->distFreqs[I_CtrDeflateRandom(random) % 30];
+    }
+
+    histogram->litFreqs[256] = 1;
+}
+
+// Starting costs: literals by the segment's byte entropy, matches by the
+// fixed code. A match-heavy start would make literals look too expensive
+// for the statistics to ever correct.
+static void I_CtrDeflateInitialCosts(const I_CtrDeflateSegment* segment, I_CtrDeflateCosts* costs) {
+    const u8* data = segment->data + segment->start;
+    u32 size = (u32)(segment->end - segment->start);
+
+    I_CtrDeflateFixedCosts(costs);
+    if (size == 0)
+        return;
+
+    u32 byteFreqs[256] = { 0 };
+    for (u32 i = 0; i < size; i++)
+        byteFreqs[data[i]]++;
+
+    float sizeLog = log2f((float)size);
+    for (u32 i = 0; i < 256; i++)
+        costs->literal[i] = sizeLog - (byteFreqs[i] ? log2f((float)byteFreqs[i]) : 0.0f);
+}
+
+/*
+    Cheapest path under costs, written to symbols (returns the count).
+    pathCosts, lengths & distances hold size + 1 entries.
+*/
+static u32 I_CtrDeflateShortestPath(
+    const I_CtrDeflateSegment* segment, const I_CtrDeflateMatchCache* cache,
+    const I_CtrDeflateCosts* costs,
+    float* pathCosts, u16* lengths, u16* distances, I_CtrDeflateSymbol* symbols
+) {
+    const u8* data = segment->data + segment->start;
+    u32 size = (u32)(segment->end - segment->start);
+
+    pathCosts[0] = 0.0f;
+    for (u32 i = 1; i <= size; i++)
+        pathCosts[i] = 3.0e38f;
+
+    u32 skipUntil = 0;
+
+    for (u32 i = 0; i < size; i++) {
+        float base = pathCosts[i];
+
+        float cost = base + costs->literal[data[i]];
+        if (cost < pathCosts[i + 1]) {
+            pathCosts[i + 1] = cost;
+            lengths[i + 1] = 1;
+            distances[i + 1] = 0;
+        }
+
+        // Inside a maximum-length match (long runs), only its end is tried;
+        // every position there has a near-identical maximum match anyway
+        if (i < skipUntil)
+            continue;
+
+        const I_CtrDeflateMatch* match = cache->matches + cache->matchStarts[i];
+        u32 count = cache->matchCounts[i];
+
+        u32 length = DEFLATE_MIN_MATCH;
+        for (u32 m = 0; m < count; m++, match++) {
+            u32 distance = match->distance;
+            float distanceCost = base + costs->distance[I_CtrDistanceCode(distance)];
+
+            for (; length <= match->length; length++) {
+                cost = distanceCost + costs->length[length];
+                if (cost < pathCosts[i + length]) {
+                    pathCosts[i + length] = cost;
+                    lengths[i + length] = (u16)length;
+                    distances[i + length] = (u16)distance;
+                }
+            }
+        }
+
+        if (count && length - 1 == DEFLATE_MAX_MATCH)
+            skipUntil = i + DEFLATE_MAX_MATCH;
+    }
+
+    // Walk back from the end, then reverse into symbol order
+    u32 symbolCount = 0;
+    for (u32 pos = size; pos > 0;) {
+        I_CtrDeflateSymbol* symbol = symbols + symbolCount++;
+        u32 length = lengths[pos];
+
+        symbol->length = (u16)length;
+        if (length == 1) {
+            symbol->distance = 0;
+            symbol->literal = data[pos - 1];
+        }
+        else {
+            symbol->distance = distances[pos];
+            symbol->literal = 0;
+        }
+
+        pos -= length;
+    }
+
+    for (u32 i = 0; i < symbolCount / 2; i++) {
+        I_CtrDeflateSymbol swap = symbols[i];
+        symbols[i] = symbols[symbolCount - 1 - i];
+        symbols[symbolCount - 1 - i] = swap;
+    }
+
+    return symbolCount;
+}
+
+static void I_CtrDeflateEncodeSegment(I_CtrDeflateSegment* segment) {
+    const CtrAllocator* allocator = segment->allocator;
+    u32 size = (u32)(segment->end - segment->start);
+
+    I_CtrDeflateMatchCache cache;
+    memset(&cache, 0, sizeof(cache));
+
+    cache.matchStarts = (u32*)I_CtrAlloc(allocator, sizeof(u32) * (size + 1));
+    cache.matchCounts = (u16*)I_CtrAlloc(allocator, sizeof(u16) * (size + 1));
+
+    float* pathCosts = (float*)I_CtrAlloc(allocator, sizeof(float) * (size + 1));
+    u16* lengths = (u16*)I_CtrAlloc(allocator, sizeof(u16) * (size + 1));
+    u16* distances = (u16*)I_CtrAlloc(allocator, sizeof(u16) * (size + 1));
+
+    I_CtrDeflateSymbol* symbols = (I_CtrDeflateSymbol*)I_CtrAlloc(allocator, sizeof(I_CtrDeflateSymbol) * (size + 1));
+    I_CtrDeflateSymbol* best = (I_CtrDeflateSymbol*)I_CtrAlloc(allocator, sizeof(I_CtrDeflateSymbol) * (size + 1));
+    u32* splits = (u32*)I_CtrAlloc(allocator, sizeof(u32) * (size / DEFLATE_MIN_BLOCK + 2));
+
+    // Worst case: everything stored, in 64K pieces & small blocks, plus the
+    // closing empty stored block
+    size_t outCapacity = size + size / 4096 + (size / DEFLATE_MIN_BLOCK + 2) * 8 + 64;
+    segment->out = (u8*)I_CtrAlloc(allocator, outCapacity);
+
+    if (
+        !cache.matchStarts || !cache.matchCounts || !pathCosts || !lengths || !distances ||
+        !symbols || !best || !splits || !segment->out
+    ) {
+        segment->status = CTR_ERROR_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    segment->status = I_CtrDeflateFindMatches(segment, &cache);
+    if (segment->status != CTR_OK)
+        goto cleanup;
+
+    I_CtrDeflateCosts costs;
+    I_CtrDeflateInitialCosts(segment, &costs);
+
+    u32 bestCount = 0;
+    u64 bestCost = 0;
+
+    I_CtrDeflateHistogram previous;
+    u64 previousCost = 0;
+
+    u32 random = 1; // Fixed seed: the output must be reproducible
+
+    for (u32 iteration = 0; iteration < DEFLATE_ITERATIONS; iteration++) {
+        u32 count = I_CtrDeflateShortestPath(
+            segment, &cache, &costs, pathCosts, lengths, distances, symbols
+        );
+
+        I_CtrDeflateHistogram histogram;
+        I_CtrDeflateCount(symbols, count, &histogram);
+
+        u64 cost = I_CtrDeflateBlockCost(symbols, count);
+        if (iteration == 0 || cost < bestCost) {
+            I_CtrDeflateSymbol* swap = best;
+            best = symbols;
+            symbols = swap;
+
+            bestCount = count;
+            bestCost = cost;
+        }
+
+        // The next path is costed with this one's statistics, plus half of
+        // the last one's so the search doesn't oscillate. Once it settles,
+        // shuffle the statistics a little to look for another minimum.
+        I_CtrDeflateHistogram mixed = histogram;
+        if (iteration > 0) {
+            for (u32 i = 0; i < 288; i++)
+                mixed.litFreqs[i] += previous.litFreqs[i] / 2;
+            for (u32 i = 0; i < 30; i++)
+                mixed.distFreqs[i] += previous.distFreqs[i] / 2;
+        }
+
+        if (iteration > 0 && cost == previousCost)
+            I_CtrDeflateShuffle(&mixed, &random);
+
+        I_CtrDeflateStatisticCosts(&mixed, &costs);
+
+        previous = histogram;
+        previousCost = cost;
+    }
+
+    u32 splitCount = 0;
+    I_CtrDeflateSplit(best, 0, bestCount, bestCost, splits, &splitCount);
+
+    I_CtrBitWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.data = segment->out;
+    writer.capacity = outCapacity;
+
+    const u8* input = segment->data + segment->start;
+    u32 blockStart = 0;
+
+    for (u32 i = 0; i < splitCount; i++) {
+        int final = segment->final && i + 1 == splitCount;
+
+        I_CtrDeflateWriteBlock(&writer, best + blockStart, splits[i] - blockStart, input, final);
+
+        for (u32 s = blockStart; s < splits[i]; s++)
+            input += best[s].length;
+        blockStart = splits[i];
+    }
+
+    // Sync flush: an empty stored block ends the segment on a byte boundary
+    if (!segment->final)
+        I_CtrDeflateWriteStored(&writer, input, 0, FALSE);
+    I_CtrAlignBits(&writer);
+
+    if (writer.overflow)
+        segment->status = CTR_ERROR_COMPRESSION;
+    segment->outSize = writer.size;
+
+cleanup:
+    I_CtrFree(allocator, splits);
+    I_CtrFree(allocator, best);
+    I_CtrFree(allocator, symbols);
+    I_CtrFree(allocator, distances);
+    I_CtrFree(allocator, lengths);
+    I_CtrFree(allocator, pathCosts);
+    I_CtrFree(allocator, cache.matches);
+    I_CtrFree(allocator, cache.matchCounts);
+    I_CtrFree(allocator, cache.matchStarts);
+}
+
+//////////////////////////////////////// Threads
+
+typedef struct {
+    I_CtrDeflateSegment* segments;
+    u32 segmentCount;
+
+    u32 next; // Next segment to take (atomic)
+} I_CtrDeflateJob;
+
+static void* I_CtrDeflateWorker(void* user) {
+    I_CtrDeflateJob* job = (I_CtrDeflateJob*)user;
+
+    for (;;) {
+        u32 index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (index >= job->segmentCount)
+            return NULL;
+
+        I_CtrDeflateEncodeSegment(job->segments + index);
+    }
+}
+
+CtrStatus CtrZlibCompressUltra(
+    const CtrAllocator* allocator, const void* data, size_t size, uint32_t threadCount,
+    void** dataOut, size_t* sizeOut
+) {
+    if ((!data && size) || !dataOut || !sizeOut || size > 0xFFFFFFFF)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    u32 segmentCount = size ? (u32)((size + DEFLATE_SEGMENT_SIZE - 1) / DEFLATE_SEGMENT_SIZE) : 1;
+
+    I_CtrDeflateSegment* segments = (I_CtrDeflateSegment*)I_CtrAlloc(
+        allocator, sizeof(I_CtrDeflateSegment) * segmentCount
+    );
+    if (segments == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    for (u32 i = 0; i < segmentCount; i++) {
+        I_CtrDeflateSegment* segment = segments + i;
+
+        segment->allocator = allocator;
+        segment->data = (const u8*)data;
+        segment->start = (size_t)i * DEFLATE_SEGMENT_SIZE;
+        segment->end = i + 1 == segmentCount ? size : segment->start + DEFLATE_SEGMENT_SIZE;
+        segment->final = i + 1 == segmentCount;
+        segment->out = NULL;
+        segment->outSize = 0;
+        segment->status = CTR_OK;
+    }
+
+    if (threadCount == 0)
+        threadCount = CtrGetCpuCount();
+    if (threadCount > segmentCount)
+        threadCount = segmentCount;
+
+    I_CtrDeflateJob job;
+    job.segments = segments;
+    job.segmentCount = segmentCount;
+    job.next = 0;
+
+    CtrRunThreads(allocator, threadCount, I_CtrDeflateWorker, &job);
+
+    CtrStatus status = CTR_OK;
+    size_t compressedSize = sizeof(u32) + 2 + 4;
+    for (u32 i = 0; i < segmentCount; i++) {
+        if (segments[i].status != CTR_OK && status == CTR_OK)
+            status = segments[i].status;
+        compressedSize += segments[i].outSize;
+    }
+
+    u8* buffer = NULL;
+    if (status == CTR_OK) {
+        buffer = (u8*)I_CtrAlloc(allocator, compressedSize);
+        if (buffer == NULL)
+            status = CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (status == CTR_OK) {
+        u8* out = buffer;
+
+        *out++ = (u8)(size >> 24);
+        *out++ = (u8)(size >> 16);
+        *out++ = (u8)(size >> 8);
+        *out++ = (u8)size;
+
+        // zlib header: deflate, 32K window, maximum compression
+        *out++ = 0x78;
+        *out++ = 0xDA;
+
+        for (u32 i = 0; i < segmentCount; i++) {
+            memcpy(out, segments[i].out, segments[i].outSize);
+            out += segments[i].outSize;
+        }
+
+        u32 checksum = adler32(adler32(0, NULL, 0), (const Bytef*)data, size);
+        *out++ = (u8)(checksum >> 24);
+        *out++ = (u8)(checksum >> 16);
+        *out++ = (u8)(checksum >> 8);
+        *out++ = (u8)checksum;
+
+        *dataOut = buffer;
+        *sizeOut = compressedSize;
+    }
+
+    for (u32 i = 0; i < segmentCount; i++)
+        I_CtrFree(allocator, segments[i].out);
+    I_CtrFree(allocator, segments);
+
+    if (status != CTR_OK)
+        return status;
+
+    // Long runs can come out a few bytes larger than with zlib, whose cost
+    // is negligible next to the above; ship whichever is smaller
+    void* zlibData;
+    size_t zlibSize;
+    if (CtrZlibCompress(allocator, data, size, 9, &zlibData, &zlibSize) == CTR_OK) {
+        if (zlibSize < *sizeOut) {
+            I_CtrFree(allocator, *dataOut);
+
+            *dataOut = zlibData;
+            *sizeOut = zlibSize;
+        }
+        else
+            I_CtrFree(allocator, zlibData);
+    }
+
+    return CTR_OK;
+}
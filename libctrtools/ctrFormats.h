@@ -0,0 +1,111 @@
+#ifndef CTRFORMATS_H
+#define CTRFORMATS_H
+
+#include <stdint.h>
+
+// On-disk layouts of SARC & CTPK, as the library reads them & the tools build
+// them. Fields are stored in the file's byte order (SARC: see boMarker; CTPK:
+// little endian).
+
+#define SARC_MAGIC 0x43524153 // "SARC"
+#define SFAT_MAGIC 0x54414653 // "SFAT"
+#define SFNT_MAGIC 0x544E4653 // "SFNT"
+
+#define BOMARKER_BIG 0xFFFE
+#define BOMARKER_LITTLE 0xFEFF
+
+// SfatNode.nameAttribute: one 32-bit field in the archive's byte order, a
+// flag in the top byte & the name's SFNT pool offset / 4 below it.
+#define SFAT_NAME_PRESENT 0x01000000
+#define SFAT_NAME_HAS_OFFSET(attribute) (((attribute) >> 24) != 0)
+#define SFAT_NAME_OFFSET(attribute) (((attribute) & 0xFFFFFF) * 4)
+#define SFAT_NAME_OFFSET_MAX (0xFFFFFF * 4)
+
+typedef struct __attribute((packed)) {
+    uint32_t magic; // Compare to SARC_MAGIC
+    uint16_t headerSize; // Always 0x14
+    uint16_t boMarker; // Byte Order Mark: compare to BOMARKER_BIG and BOMARKER_LITTLE
+    uint32_t fileSize; // File size of whole binary.
+    uint32_t dataStart; // Offset to the archive data.
+
+    uint16_t versionNumber; // Usually 0x0100
+
+    uint16_t _reserved;
+} SarcFileHeader;
+
+typedef struct __attribute((packed)) {
+    uint32_t magic; // Compare to SFAT_MAGIC
+    uint16_t headerSize; // Usually 0xC
+
+    uint16_t nodeCount;
+    uint32_t hashKey; // Usually 0x65
+} SfatHeader;
+
+typedef struct __attribute((packed)) {
+    uint32_t nameHash; // CtrSarcHash of the name
+
+    uint32_t nameAttribute; // SFAT_NAME_PRESENT | name offset / 4, or 0
+
+    uint32_t dataOffsetStart; // Relative to the SARC header's dataStart
+    uint32_t dataOffsetEnd; // Relative to the SARC header's dataStart
+} SfatNode;
+
+typedef struct __attribute((packed)) {
+    uint32_t magic; // Compare to SFNT_MAGIC
+    uint16_t headerSize;
+
+    uint16_t _pad16;
+} SfntHeader;
+
+#define CTPK_MAGIC 0x4B505443 // "CTPK"
+
+typedef struct {
+    uint32_t magic; // Compare to CTPK_MAGIC
+    uint16_t version;
+
+    uint16_t textureCount;
+
+    uint32_t textureSectionOffset; // Offset to the texture section.
+    uint32_t textureSectionSize; // Size of the texture section.
+
+    uint32_t hashSectionOffset; // Offset to the hash section.
+
+    uint32_t textureInfoSection;
+
+    uint64_t pad64;
+} CtpkFileHeader;
+
+typedef struct {
+    uint32_t pathOffset; // Offset to file path
+
+    uint32_t dataSize; // Size of texture data.
+    uint32_t dataOffset; // Offset to texture data (relative to texture data block offset)
+    uint32_t dataFormat; // Texture data format.
+
+    uint16_t width; // Texture width
+    uint16_t height; // Texture height
+
+    uint8_t mipLevel; // Mipmap level
+    uint8_t type; // 0: Cube Map, 1: 1D, 2: 2D
+
+    uint16_t cubeDir;
+
+    uint32_t bitmapSizeOffset; // Relative to to this block
+
+    uint32_t srcTimestamp; // Unix timestamp of source texture.
+} TextureEntry;
+
+typedef struct {
+    uint32_t pathHash; // CRC32 hash of the file path.
+
+    uint32_t index;
+} HashBlockEntry;
+
+typedef struct {
+    uint8_t textureFormat;
+    uint8_t mipLevel;
+    uint8_t compressed;
+    uint8_t compressionMethod;
+} TextureContextEntry;
+
+#endif
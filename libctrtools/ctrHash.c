@@ -0,0 +1,101 @@
+#include "ctrInternal.h"
+
+/*
+    XXH64, as specified by its reference implementation: four accumulators
+    over 32-byte stripes, then the tail & a final avalanche. Input is read
+    little endian regardless of alignment, so any byte range can be hashed
+    in place.
+*/
+
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t I_CtrRotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t I_CtrRead64(const u8* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t I_CtrRead32(const u8* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t I_CtrHashRound(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = I_CtrRotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t I_CtrHashMerge(uint64_t acc, uint64_t val) {
+    acc ^= I_CtrHashRound(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t CtrHash64(const void* data, size_t size, uint64_t seed) {
+    const u8* p = (const u8*)data;
+    const u8* end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        const u8* limit = end - 32;
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        do {
+            v1 = I_CtrHashRound(v1, I_CtrRead64(p));
+            v2 = I_CtrHashRound(v2, I_CtrRead64(p + 8));
+            v3 = I_CtrHashRound(v3, I_CtrRead64(p + 16));
+            v4 = I_CtrHashRound(v4, I_CtrRead64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = I_CtrRotl64(v1, 1) + I_CtrRotl64(v2, 7) + I_CtrRotl64(v3, 12) + I_CtrRotl64(v4, 18);
+        h = I_CtrHashMerge(h, v1);
+        h = I_CtrHashMerge(h, v2);
+        h = I_CtrHashMerge(h, v3);
+        h = I_CtrHashMerge(h, v4);
+    }
+    else
+        h = seed + PRIME64_5;
+
+    h += (uint64_t)size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= I_CtrHashRound(0, I_CtrRead64(p));
+        h = I_CtrRotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)I_CtrRead32(p) * PRIME64_1;
+        h = I_CtrRotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (uint64_t)*p * PRIME64_5;
+        h = I_CtrRotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
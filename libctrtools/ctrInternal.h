@@ -0,0 +1,50 @@
+#ifndef CTRINTERNAL_H
+#define CTRINTERNAL_H
+
+#include <stdlib.h>
+
+#include <string.h>
+
+#include "ctrtools.h"
+#include "ctrFormats.h"
+
+// Shared by the library's translation units only; not installed.
+
+typedef unsigned long u64;
+typedef unsigned int u32;
+typedef unsigned short u16;
+typedef unsigned char u8;
+typedef signed long s64;
+typedef signed int s32;
+typedef signed short s16;
+typedef signed char s8;
+
+#define TRUE 1
+#define FALSE 0
+
+void* I_CtrAlloc(const CtrAllocator* allocator, size_t size);
+void I_CtrFree(const CtrAllocator* allocator, void* ptr);
+
+// Handles keep a copy, so the caller's allocator struct may be temporary.
+void I_CtrCopyAllocator(CtrAllocator* dst, const CtrAllocator* src);
+
+// ctrLz.c: Yaz0 & LZ11/LZ13 streams behind the CtrCodec calls. Decoders
+// expect the size from the matching GetDecompressedSize.
+CtrStatus I_CtrYaz0GetDecompressedSize(const u8* data, size_t size, size_t* sizeOut);
+CtrStatus I_CtrYaz0Decode(const u8* in, size_t inSize, u8* out, size_t outSize);
+CtrStatus I_CtrYaz0Encode(
+    const CtrAllocator* allocator, const u8* data, size_t size, int level,
+    void** dataOut, size_t* sizeOut
+);
+
+CtrStatus I_CtrLz11GetDecompressedSize(const u8* data, size_t size, int lz13, size_t* sizeOut);
+CtrStatus I_CtrLz11Decode(const u8* in, size_t inSize, int lz13, u8* out, size_t outSize);
+CtrStatus I_CtrLz11Encode(
+    const CtrAllocator* allocator, const u8* data, size_t size, int level, int lz13,
+    void** dataOut, size_t* sizeOut
+);
+
+// ETC1/etc1.cpp
+void unpackETC1Block(void* etc1Block, unsigned int* dstPixels, int preserveAlpha);
+
+#endif
@@ -0,0 +1,545 @@
+#include "ctrInternal.h"
+
+/*
+    Yaz0 & LZ11 are both LZ77 with a 4 KiB window & a flag byte in front of
+    every 8 tokens (MSB first). They differ in the flag polarity (Yaz0: 1 is
+    a literal, LZ11: 1 is a reference), in how lengths are packed & in the
+    header. LZ13 is an LZ11 stream behind one more 4-byte header.
+*/
+
+#define LZ_WINDOW 4096
+#define LZ_MIN_MATCH 3
+
+#define YAZ0_MAX_MATCH 0x111
+#define LZ11_MAX_MATCH 0x10110
+
+#define YAZ0_HEADER_SIZE 16
+
+// Largest expansion a stream can encode: 8 maximum-length references per
+// flag byte. Size prefixes beyond this are rejected before allocating.
+#define YAZ0_MAX_RATIO 88 // 8 * 0x111 / (1 + 8 * 3)
+#define LZ11_MAX_RATIO 15954 // 8 * 0x10110 / (1 + 8 * 4)
+
+static u32 I_CtrReadU32BE(const u8* bytes) {
+    return ((u32)bytes[0] << 24) | ((u32)bytes[1] << 16) | ((u32)bytes[2] << 8) | bytes[3];
+}
+
+static u32 I_CtrReadU32LE(const u8* bytes) {
+    return ((u32)bytes[3] << 24) | ((u32)bytes[2] << 16) | ((u32)bytes[1] << 8) | bytes[0];
+}
+
+// Copies a back reference; the ranges overlap when distance < length.
+static inline void I_CtrLzCopy(u8* out, size_t distance, size_t length) {
+    const u8* from = out - distance;
+
+    if (distance >= length)
+        memcpy(out, from, length);
+    else {
+        for (size_t i = 0; i < length; i++)
+            out[i] = from[i];
+    }
+}
+
+//////////////////////////////////////// Yaz0
+
+CtrStatus I_CtrYaz0GetDecompressedSize(const u8* data, size_t size, size_t* sizeOut) {
+    if (size < YAZ0_HEADER_SIZE)
+        return CTR_ERROR_TRUNCATED;
+    if (memcmp(data, "Yaz0", 4) != 0)
+        return CTR_ERROR_BAD_MAGIC;
+
+    size_t decompressedSize = I_CtrReadU32BE(data + 4);
+    if (decompressedSize > (size - YAZ0_HEADER_SIZE) * YAZ0_MAX_RATIO)
+        return CTR_ERROR_COMPRESSION;
+
+    *sizeOut = decompressedSize;
+    return CTR_OK;
+}
+
+CtrStatus I_CtrYaz0Decode(const u8* in, size_t inSize, u8* out, size_t outSize) {
+    size_t inPos = YAZ0_HEADER_SIZE;
+    size_t outPos = 0;
+
+    u8 code = 0;
+    u32 codeBits = 0;
+
+    while (outPos < outSize) {
+        if (codeBits == 0) {
+            if (inPos >= inSize)
+                return CTR_ERROR_COMPRESSION;
+
+            code = in[inPos++];
+            codeBits = 8;
+        }
+
+        if (code & 0x80) {
+            if (inPos >= inSize)
+                return CTR_ERROR_COMPRESSION;
+
+            out[outPos++] = in[inPos++];
+        }
+        else {
+            if (inPos + 2 > inSize)
+                return CTR_ERROR_COMPRESSION;
+
+            u8 b1 = in[inPos++];
+            u8 b2 = in[inPos++];
+
+            size_t distance = (((size_t)b1 & 0xF) << 8 | b2) + 1;
+            size_t length;
+
+            if (b1 >> 4)
+                length = (b1 >> 4) + 2;
+            else {
+                if (inPos >= inSize)
+                    return CTR_ERROR_COMPRESSION;
+
+                length = (size_t)in[inPos++] + 0x12;
+            }
+
+            if (distance > outPos || length > outSize - outPos)
+                return CTR_ERROR_COMPRESSION;
+
+            I_CtrLzCopy(out + outPos, distance, length);
+            outPos += length;
+        }
+
+        code <<= 1;
+        codeBits--;
+    }
+
+    return CTR_OK;
+}
+
+//////////////////////////////////////// LZ11 / LZ13
+
+// Size & header length of an LZ11 (type 0x11) or LZ13 (0x13) header at data.
+static CtrStatus I_CtrLzReadHeader(const u8* data, size_t size, u8 type, size_t* sizeOut, size_t* headerSizeOut) {
+    if (size < 4)
+        return CTR_ERROR_TRUNCATED;
+    if (data[0] != type)
+        return CTR_ERROR_BAD_MAGIC;
+
+    size_t decompressedSize = I_CtrReadU32LE(data) >> 8;
+    size_t headerSize = 4;
+
+    // Sizes past 24 bits follow as a separate 32-bit field
+    if (decompressedSize == 0) {
+        if (size < 8)
+            return CTR_ERROR_TRUNCATED;
+
+        decompressedSize = I_CtrReadU32LE(data + 4);
+        headerSize = 8;
+    }
+
+    *sizeOut = decompressedSize;
+    *headerSizeOut = headerSize;
+
+    return CTR_OK;
+}
+
+// Offset of the LZ11 stream in an LZ11 or LZ13 file & its size.
+static CtrStatus I_CtrLz11Locate(const u8* data, size_t size, int lz13, size_t* sizeOut, size_t* streamOut) {
+    size_t decompressedSize;
+    size_t headerSize;
+
+    CtrStatus status = I_CtrLzReadHeader(data, size, lz13 ? 0x13 : 0x11, &decompressedSize, &headerSize);
+    if (status != CTR_OK)
+        return status;
+
+    size_t stream = headerSize;
+
+    if (lz13) {
+        size_t innerSize;
+        status = I_CtrLzReadHeader(data + stream, size - stream, 0x11, &innerSize, &headerSize);
+        if (status != CTR_OK)
+            return status;
+
+        if (innerSize != decompressedSize)
+            return CTR_ERROR_COMPRESSION;
+
+        stream += headerSize;
+    }
+
+    if (decompressedSize > (size - stream) * LZ11_MAX_RATIO)
+        return CTR_ERROR_COMPRESSION;
+
+    *sizeOut = decompressedSize;
+    *streamOut = stream;
+
+    return CTR_OK;
+}
+
+CtrStatus I_CtrLz11GetDecompressedSize(const u8* data, size_t size, int lz13, size_t* sizeOut) {
+    size_t stream;
+    return I_CtrLz11Locate(data, size, lz13, sizeOut, &stream);
+}
+
+CtrStatus I_CtrLz11Decode(const u8* in, size_t inSize, int lz13, u8* out, size_t outSize) {
+    size_t decompressedSize;
+    size_t inPos;
+
+    CtrStatus status = I_CtrLz11Locate(in, inSize, lz13, &decompressedSize, &inPos);
+    if (status != CTR_OK)
+        return status;
+    if (decompressedSize > outSize)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    size_t outPos = 0;
+
+    u8 flags = 0;
+    u32 flagBits = 0;
+
+    while (outPos < decompressedSize) {
+        if (flagBits == 0) {
+            if (inPos >= inSize)
+                return CTR_ERROR_COMPRESSION;
+
+            flags = in[inPos++];
+            flagBits = 8;
+        }
+
+        if ((flags & 0x80) == 0) {
+            if (inPos >= inSize)
+                return CTR_ERROR_COMPRESSION;
+
+            out[outPos++] = in[inPos++];
+        }
+        else {
+            if (inPos + 2 > inSize)
+                return CTR_ERROR_COMPRESSION;
+
+            u8 b0 = in[inPos++];
+            size_t length;
+            size_t distance;
+
+            switch (b0 >> 4) {
+            case 0: {
+                if (inPos + 2 > inSize)
+                    return CTR_ERROR_COMPRESSION;
+
+                u8 b1 = in[inPos++];
+                u8 b2 = in[inPos++];
+
+                length = (((size_t)b0 & 0xF) << 4 | b1 >> 4) + 0x11;
+                distance = (((size_t)b1 & 0xF) << 8 | b2) + 1;
+                break;
+            }
+            case 1: {
+                if (inPos + 3 > inSize)
+                    return CTR_ERROR_COMPRESSION;
+
+                u8 b1 = in[inPos++];
+                u8 b2 = in[inPos++];
+                u8 b3 = in[inPos++];
+
+                length = (((size_t)b0 & 0xF) << 12 | (size_t)b1 << 4 | b2 >> 4) + 0x111;
+                distance = (((size_t)b2 & 0xF) << 8 | b3) + 1;
+                break;
+            }
+            default: {
+                u8 b1 = in[inPos++];
+
+                length = (b0 >> 4) + 1;
+                distance = (((size_t)b0 & 0xF) << 8 | b1) + 1;
+                break;
+            }
+            }
+
+            if (distance > outPos || length > decompressedSize - outPos)
+                return CTR_ERROR_COMPRESSION;
+
+            I_CtrLzCopy(out + outPos, distance, length);
+            outPos += length;
+        }
+
+        flags <<= 1;
+        flagBits--;
+    }
+
+    return CTR_OK;
+}
+
+//////////////////////////////////////// Encoding
+
+/*
+    Greedy match finder over hash chains of 3-byte prefixes. Chains only
+    reach back one window, so prev is a ring indexed by position. level
+    (0-9) bounds how many candidates are tried per position; at
+    CTR_CODEC_LEVEL_ULTRA that is all of them.
+*/
+
+#define LZ_HASH_BITS 15
+
+typedef struct {
+    s32 head[1 << LZ_HASH_BITS];
+    s32 prev[LZ_WINDOW];
+
+    u32 maxChain;
+} I_CtrLzMatcher;
+
+static inline u32 I_CtrLzHash(const u8* bytes) {
+    u32 value = bytes[0] | (u32)bytes[1] << 8 | (u32)bytes[2] << 16;
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void I_CtrLzMatcherInit(I_CtrLzMatcher* matcher, int level) {
+    for (u32 i = 0; i < (1 << LZ_HASH_BITS); i++)
+        matcher->head[i] = -1;
+
+    if (level < 0)
+        level = 0;
+
+    matcher->maxChain = level >= CTR_CODEC_LEVEL_ULTRA ? LZ_WINDOW : 1u << level;
+}
+
+static inline void I_CtrLzInsert(I_CtrLzMatcher* matcher, const u8* data, size_t size, size_t pos) {
+    if (pos + LZ_MIN_MATCH > size)
+        return;
+
+    u32 hash = I_CtrLzHash(data + pos);
+
+    matcher->prev[pos & (LZ_WINDOW - 1)] = matcher->head[hash];
+    matcher->head[hash] = (s32)pos;
+}
+
+// Longest match for pos within the window, up to maxLength. Returns its
+// length (0 if shorter than LZ_MIN_MATCH) & distance.
+static size_t I_CtrLzFindMatch(
+    const I_CtrLzMatcher* matcher, const u8* data, size_t size, size_t pos,
+    size_t maxLength, size_t* distanceOut
+) {
+    if (pos + LZ_MIN_MATCH > size)
+        return 0;
+
+    if (maxLength > size - pos)
+        maxLength = size - pos;
+
+    size_t bestLength = 0;
+    size_t bestDistance = 0;
+
+    s32 candidate = matcher->head[I_CtrLzHash(data + pos)];
+
+    for (u32 chain = 0; candidate >= 0 && chain < matcher->maxChain; chain++) {
+        size_t distance = pos - (size_t)candidate;
+        if (distance == 0 || distance > LZ_WINDOW)
+            break;
+
+        const u8* a = data + candidate;
+        const u8* b = data + pos;
+
+        if (a[bestLength] == b[bestLength]) {
+            size_t length = 0;
+            while (length < maxLength && a[length] == b[length])
+                length++;
+
+            if (length > bestLength) {
+                bestLength = length;
+                bestDistance = distance;
+
+                if (length == maxLength)
+                    break;
+            }
+        }
+
+        s32 next = matcher->prev[candidate & (LZ_WINDOW - 1)];
+        if (next >= candidate)
+            break; // Ring slot reused by a newer position
+
+        candidate = next;
+    }
+
+    if (bestLength < LZ_MIN_MATCH)
+        return 0;
+
+    *distanceOut = bestDistance;
+    return bestLength;
+}
+
+static void I_CtrLzSkip(I_CtrLzMatcher* matcher, const u8* data, size_t size, size_t pos, size_t length) {
+    for (size_t i = 0; i < length; i++)
+        I_CtrLzInsert(matcher, data, size, pos + i);
+}
+
+// Worst case: every token a literal, plus a flag byte per 8.
+static size_t I_CtrLzMaxSize(size_t size, size_t headerSize) {
+    return headerSize + size + (size + 7) / 8;
+}
+
+CtrStatus I_CtrYaz0Encode(
+    const CtrAllocator* allocator, const u8* data, size_t size, int level,
+    void** dataOut, size_t* sizeOut
+) {
+    if (size > 0xFFFFFFFF)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    u8* out = (u8*)I_CtrAlloc(allocator, I_CtrLzMaxSize(size, YAZ0_HEADER_SIZE));
+    I_CtrLzMatcher* matcher = (I_CtrLzMatcher*)I_CtrAlloc(allocator, sizeof(I_CtrLzMatcher));
+    if (!out || !matcher) {
+        I_CtrFree(allocator, matcher);
+        I_CtrFree(allocator, out);
+        return CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    I_CtrLzMatcherInit(matcher, level);
+
+    memcpy(out, "Yaz0", 4);
+    out[4] = (u8)(size >> 24);
+    out[5] = (u8)(size >> 16);
+    out[6] = (u8)(size >> 8);
+    out[7] = (u8)size;
+    memset(out + 8, 0, 8);
+
+    size_t outPos = YAZ0_HEADER_SIZE;
+    size_t pos = 0;
+
+    size_t codePos = 0;
+    u32 codeBits = 8;
+
+    while (pos < size) {
+        if (codeBits == 8) {
+            codePos = outPos++;
+            out[codePos] = 0;
+            codeBits = 0;
+        }
+
+        size_t distance;
+        size_t length = I_CtrLzFindMatch(matcher, data, size, pos, YAZ0_MAX_MATCH, &distance);
+
+        if (length == 0) {
+            out[codePos] |= 0x80 >> codeBits;
+            out[outPos++] = data[pos];
+
+            I_CtrLzInsert(matcher, data, size, pos);
+            pos++;
+        }
+        else {
+            distance--;
+
+            if (length < 0x12) {
+                out[outPos++] = (u8)((length - 2) << 4 | distance >> 8);
+                out[outPos++] = (u8)distance;
+            }
+            else {
+                out[outPos++] = (u8)(distance >> 8);
+                out[outPos++] = (u8)distance;
+                out[outPos++] = (u8)(length - 0x12);
+            }
+
+            I_CtrLzSkip(matcher, data, size, pos, length);
+            pos += length;
+        }
+
+        codeBits++;
+    }
+
+    I_CtrFree(allocator, matcher);
+
+    *dataOut = out;
+    *sizeOut = outPos;
+
+    return CTR_OK;
+}
+
+static size_t I_CtrLzWriteHeader(u8* out, u8 type, size_t size) {
+    // A 24-bit size of 0 announces the 32-bit field, so empty input needs it
+    if (size != 0 && size <= 0xFFFFFF) {
+        out[0] = type;
+        out[1] = (u8)size;
+        out[2] = (u8)(size >> 8);
+        out[3] = (u8)(size >> 16);
+
+        return 4;
+    }
+
+    out[0] = type;
+    out[1] = out[2] = out[3] = 0;
+    out[4] = (u8)size;
+    out[5] = (u8)(size >> 8);
+    out[6] = (u8)(size >> 16);
+    out[7] = (u8)(size >> 24);
+
+    return 8;
+}
+
+CtrStatus I_CtrLz11Encode(
+    const CtrAllocator* allocator, const u8* data, size_t size, int level, int lz13,
+    void** dataOut, size_t* sizeOut
+) {
+    if (size > 0xFFFFFFFF)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    u8* out = (u8*)I_CtrAlloc(allocator, I_CtrLzMaxSize(size, 16));
+    I_CtrLzMatcher* matcher = (I_CtrLzMatcher*)I_CtrAlloc(allocator, sizeof(I_CtrLzMatcher));
+    if (!out || !matcher) {
+        I_CtrFree(allocator, matcher);
+        I_CtrFree(allocator, out);
+        return CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    I_CtrLzMatcherInit(matcher, level);
+
+    size_t outPos = 0;
+    if (lz13)
+        outPos += I_CtrLzWriteHeader(out + outPos, 0x13, size);
+    outPos += I_CtrLzWriteHeader(out + outPos, 0x11, size);
+
+    size_t pos = 0;
+
+    size_t flagPos = 0;
+    u32 flagBits = 8;
+
+    while (pos < size) {
+        if (flagBits == 8) {
+            flagPos = outPos++;
+            out[flagPos] = 0;
+            flagBits = 0;
+        }
+
+        size_t distance;
+        size_t length = I_CtrLzFindMatch(matcher, data, size, pos, LZ11_MAX_MATCH, &distance);
+
+        if (length == 0) {
+            out[outPos++] = data[pos];
+
+            I_CtrLzInsert(matcher, data, size, pos);
+            pos++;
+        }
+        else {
+            out[flagPos] |= 0x80 >> flagBits;
+            distance--;
+
+            if (length <= 0x10) {
+                out[outPos++] = (u8)((length - 1) << 4 | distance >> 8);
+                out[outPos++] = (u8)distance;
+            }
+            else if (length <= 0x110) {
+                size_t packed = length - 0x11;
+
+                out[outPos++] = (u8)(packed >> 4);
+                out[outPos++] = (u8)((packed & 0xF) << 4 | distance >> 8);
+                out[outPos++] = (u8)distance;
+            }
+            else {
+                size_t packed = length - 0x111;
+
+                out[outPos++] = (u8)(0x10 | packed >> 12);
+                out[outPos++] = (u8)(packed >> 4);
+                out[outPos++] = (u8)((packed & 0xF) << 4 | distance >> 8);
+                out[outPos++] = (u8)distance;
+            }
+
+            I_CtrLzSkip(matcher, data, size, pos, length);
+            pos += length;
+        }
+
+        flagBits++;
+    }
+
+    I_CtrFree(allocator, matcher);
+
+    *dataOut = out;
+    *sizeOut = outPos;
+
+    return CTR_OK;
+}
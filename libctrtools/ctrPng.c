@@ -0,0 +1,290 @@
+#include <zlib.h>
+
+#include "ctrInternal.h"
+
+static const u8 pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+struct CtrPngWriter {
+    CtrAllocator allocator;
+
+    CtrPngWriteCallback write;
+    void* user;
+
+    u32 width;
+    u32 height;
+    u32 rowsAdded;
+
+    z_stream stream;
+
+    u8* row; // Filter type byte + width * 4
+    u8* chunk; // Length & type, CTR_PNG_CHUNK_SIZE of data, CRC
+
+    CtrStatus status; // First failure; later calls return it
+};
+
+static u8* I_CtrPngPutU32(u8* out, u32 value) {
+    out[0] = (u8)(value >> 24);
+    out[1] = (u8)(value >> 16);
+    out[2] = (u8)(value >> 8);
+    out[3] = (u8)value;
+
+    return out + 4;
+}
+
+// Length, type & CRC around a chunk whose data is already at out + 8.
+static u8* I_CtrPngFinishChunk(u8* out, const char* type, u32 length) {
+    I_CtrPngPutU32(out, length);
+    memcpy(out + 4, type, 4);
+
+    u32 crc = crc32(0, out + 4, 4 + length);
+    return I_CtrPngPutU32(out + 8 + length, crc);
+}
+
+static voidpf I_CtrPngAlloc(voidpf opaque, uInt items, uInt size) {
+    return I_CtrAlloc((const CtrAllocator*)opaque, (size_t)items * size);
+}
+
+static void I_CtrPngFree(voidpf opaque, voidpf address) {
+    I_CtrFree((const CtrAllocator*)opaque, address);
+}
+
+static CtrStatus I_CtrPngWrite(CtrPngWriter* writer, const void* data, size_t size) {
+    if (writer->write(writer->user, data, size) != 0)
+        return CTR_ERROR_ABORTED;
+
+    return CTR_OK;
+}
+
+// Writes out whatever deflate put into the chunk buffer as one IDAT.
+static CtrStatus I_CtrPngFlushIdat(CtrPngWriter* writer) {
+    u32 length = CTR_PNG_CHUNK_SIZE - writer->stream.avail_out;
+    if (length == 0)
+        return CTR_OK;
+
+    I_CtrPngFinishChunk(writer->chunk, "IDAT", length);
+
+    writer->stream.next_out = writer->chunk + 8;
+    writer->stream.avail_out = CTR_PNG_CHUNK_SIZE;
+
+    return I_CtrPngWrite(writer, writer->chunk, 12 + length);
+}
+
+// Runs deflate over the pending input, emitting every chunk it fills.
+static CtrStatus I_CtrPngDeflate(CtrPngWriter* writer, int flush) {
+    for (;;) {
+        int result = deflate(&writer->stream, flush);
+        if (result == Z_STREAM_ERROR)
+            return CTR_ERROR_COMPRESSION;
+
+        if (writer->stream.avail_out == 0) {
+            CtrStatus status = I_CtrPngFlushIdat(writer);
+            if (status != CTR_OK)
+                return status;
+
+            continue;
+        }
+
+        if (flush == Z_FINISH ? result == Z_STREAM_END : writer->stream.avail_in == 0)
+            return CTR_OK;
+    }
+}
+
+static void I_CtrPngWriterFree(CtrPngWriter* writer) {
+    deflateEnd(&writer->stream);
+
+    CtrAllocator allocator = writer->allocator;
+    I_CtrFree(&allocator, writer->chunk);
+    I_CtrFree(&allocator, writer->row);
+    I_CtrFree(&allocator, writer);
+}
+
+CtrStatus CtrPngWriterBegin(
+    const CtrAllocator* allocator, uint32_t width, uint32_t height, int level,
+    CtrPngWriteCallback write, void* user, CtrPngWriter** writerOut
+) {
+    if (!write || !writerOut || width == 0 || height == 0 || width > 0x3FFFFFFF)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    CtrPngWriter* writer = (CtrPngWriter*)I_CtrAlloc(allocator, sizeof(CtrPngWriter));
+    if (writer == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    memset(writer, 0, sizeof(CtrPngWriter));
+    I_CtrCopyAllocator(&writer->allocator, allocator);
+
+    writer->write = write;
+    writer->user = user;
+
+    writer->width = width;
+    writer->height = height;
+
+    writer->row = (u8*)I_CtrAlloc(&writer->allocator, (size_t)width * 4 + 1);
+    writer->chunk = (u8*)I_CtrAlloc(&writer->allocator, 12 + CTR_PNG_CHUNK_SIZE);
+    if (!writer->row || !writer->chunk) {
+        I_CtrFree(&writer->allocator, writer->chunk);
+        I_CtrFree(&writer->allocator, writer->row);
+        I_CtrFree(&writer->allocator, writer);
+        return CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    writer->stream.zalloc = I_CtrPngAlloc;
+    writer->stream.zfree = I_CtrPngFree;
+    writer->stream.opaque = (voidpf)&writer->allocator;
+
+    if (deflateInit(&writer->stream, level) != Z_OK) {
+        I_CtrFree(&writer->allocator, writer->chunk);
+        I_CtrFree(&writer->allocator, writer->row);
+        I_CtrFree(&writer->allocator, writer);
+        return CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    writer->stream.next_out = writer->chunk + 8;
+    writer->stream.avail_out = CTR_PNG_CHUNK_SIZE;
+
+    u8 header[sizeof(pngSignature) + 12 + 13];
+    memcpy(header, pngSignature, sizeof(pngSignature));
+
+    u8* ihdr = header + sizeof(pngSignature) + 8;
+    I_CtrPngPutU32(ihdr, width);
+    I_CtrPngPutU32(ihdr + 4, height);
+    ihdr[8] = 8; // Bit depth
+    ihdr[9] = 6; // Color type: RGBA
+    ihdr[10] = 0; // Compression: deflate
+    ihdr[11] = 0; // Filter method
+    ihdr[12] = 0; // Interlace: none
+    I_CtrPngFinishChunk(header + sizeof(pngSignature), "IHDR", 13);
+
+    CtrStatus status = I_CtrPngWrite(writer, header, sizeof(header));
+    if (status != CTR_OK) {
+        I_CtrPngWriterFree(writer);
+        return status;
+    }
+
+    *writerOut = writer;
+    return CTR_OK;
+}
+
+CtrStatus CtrPngWriterAddRows(CtrPngWriter* writer, const uint32_t* pixels, uint32_t rowCount) {
+    if (!writer || !pixels)
+        return CTR_ERROR_INVALID_ARGUMENT;
+    if (writer->status != CTR_OK)
+        return writer->status;
+
+    if (rowCount > writer->height - writer->rowsAdded)
+        return writer->status = CTR_ERROR_INVALID_ARGUMENT;
+
+    size_t rowSize = (size_t)writer->width * 4;
+
+    for (u32 y = 0; y < rowCount; y++) {
+        // Every scanline is prefixed with its filter type (0: none)
+        writer->row[0] = 0;
+        memcpy(writer->row + 1, pixels + (size_t)writer->width * y, rowSize);
+
+        writer->stream.next_in = writer->row;
+        writer->stream.avail_in = rowSize + 1;
+
+        CtrStatus status = I_CtrPngDeflate(writer, Z_NO_FLUSH);
+        if (status != CTR_OK)
+            return writer->status = status;
+    }
+
+    writer->rowsAdded += rowCount;
+    return CTR_OK;
+}
+
+CtrStatus CtrPngWriterFinish(CtrPngWriter* writer) {
+    if (!writer)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    CtrStatus status = writer->status;
+    if (status == CTR_OK && writer->rowsAdded != writer->height)
+        status = CTR_ERROR_INVALID_ARGUMENT;
+
+    if (status == CTR_OK)
+        status = I_CtrPngDeflate(writer, Z_FINISH);
+    if (status == CTR_OK)
+        status = I_CtrPngFlushIdat(writer);
+
+    if (status == CTR_OK) {
+        u8 iend[12];
+        I_CtrPngFinishChunk(iend, "IEND", 0);
+
+        status = I_CtrPngWrite(writer, iend, sizeof(iend));
+    }
+
+    I_CtrPngWriterFree(writer);
+    return status;
+}
+
+typedef struct {
+    const CtrAllocator* allocator;
+
+    u8* data;
+    size_t size;
+    size_t capacity;
+} I_CtrPngBuffer;
+
+static int I_CtrPngBufferWrite(void* user, const void* data, size_t size) {
+    I_CtrPngBuffer* buffer = (I_CtrPngBuffer*)user;
+
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity * 2;
+        while (capacity < buffer->size + size)
+            capacity *= 2;
+
+        // The allocator interface has no realloc
+        u8* grown = (u8*)I_CtrAlloc(buffer->allocator, capacity);
+        if (grown == NULL)
+            return 1;
+
+        memcpy(grown, buffer->data, buffer->size);
+        I_CtrFree(buffer->allocator, buffer->data);
+
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+
+    return 0;
+}
+
+CtrStatus CtrPngEncode(
+    const CtrAllocator* allocator, const uint32_t* pixels, uint32_t width, uint32_t height,
+    int level, void** dataOut, size_t* sizeOut
+) {
+    if (!pixels || !dataOut || !sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    I_CtrPngBuffer buffer;
+    buffer.allocator = allocator;
+    buffer.size = 0;
+    buffer.capacity = 64 * 1024;
+    buffer.data = (u8*)I_CtrAlloc(allocator, buffer.capacity);
+    if (buffer.data == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    CtrPngWriter* writer;
+    CtrStatus status = CtrPngWriterBegin(
+        allocator, width, height, level, I_CtrPngBufferWrite, &buffer, &writer
+    );
+    if (status != CTR_OK) {
+        I_CtrFree(allocator, buffer.data);
+        return status;
+    }
+
+    CtrPngWriterAddRows(writer, pixels, height);
+
+    status = CtrPngWriterFinish(writer);
+    if (status != CTR_OK) {
+        I_CtrFree(allocator, buffer.data);
+        // A failed buffer write is an allocation failure here
+        return status == CTR_ERROR_ABORTED ? CTR_ERROR_OUT_OF_MEMORY : status;
+    }
+
+    *dataOut = buffer.data;
+    *sizeOut = buffer.size;
+
+    return CTR_OK;
+}
@@ -0,0 +1,360 @@
+#include "ctrInternal.h"
+
+struct CtrSarc {
+    CtrAllocator allocator;
+
+    const u8* data;
+    size_t size;
+
+    const SfatNode* nodes; // In the archive's byte order
+    u16 nodeCount;
+    u32 hashKey;
+
+    const char* names; // SFNT string pool
+    const char* namesEnd;
+
+    u32 dataStart;
+
+    int bigEndian;
+    int sorted; // Nodes ascend by hash, so lookups can binary search
+};
+
+/*
+    Big endian archives are read as they are: header & node fields go
+    through these accessors, which swap on the fly. The buffer is never
+    written, so it can be a read-only mapping shared between threads.
+*/
+
+static inline u16 I_CtrSarcU16(int bigEndian, u16 value) {
+    return bigEndian ? __builtin_bswap16(value) : value;
+}
+
+static inline u32 I_CtrSarcU32(int bigEndian, u32 value) {
+    return bigEndian ? __builtin_bswap32(value) : value;
+}
+
+// Node index in host byte order.
+static inline SfatNode I_CtrSarcGetNode(const CtrSarc* sarc, u32 index) {
+    SfatNode node;
+    memcpy(&node, sarc->nodes + index, sizeof(SfatNode));
+
+    if (sarc->bigEndian) {
+        node.nameHash = __builtin_bswap32(node.nameHash);
+
+        node.nameAttribute = __builtin_bswap32(node.nameAttribute);
+
+        node.dataOffsetStart = __builtin_bswap32(node.dataOffsetStart);
+        node.dataOffsetEnd = __builtin_bswap32(node.dataOffsetEnd);
+    }
+
+    return node;
+}
+
+uint32_t CtrSarcHash(const char* name, size_t length, uint32_t key) {
+    u32 result = 0;
+    for (size_t i = 0; i < length; i++)
+        result = name[i] + result * key;
+
+    return result;
+}
+
+/*
+    Checks every node once, up front: data ranges lie inside the file & name
+    offsets point at a terminated string inside the SFNT pool. Lookups &
+    extraction then use node fields as they are, without checks of their own.
+*/
+static CtrStatus I_CtrSarcValidateNodes(CtrSarc* sarc) {
+    size_t dataSize = sarc->size - sarc->dataStart;
+
+    sarc->sorted = TRUE;
+
+    for (u32 i = 0; i < sarc->nodeCount; i++) {
+        SfatNode node = I_CtrSarcGetNode(sarc, i);
+
+        if (i > 0 && I_CtrSarcGetNode(sarc, i - 1).nameHash > node.nameHash)
+            sarc->sorted = FALSE;
+
+        if (
+            node.dataOffsetEnd < node.dataOffsetStart ||
+            node.dataOffsetEnd > dataSize
+        )
+            return CTR_ERROR_TRUNCATED;
+
+        if (SFAT_NAME_HAS_OFFSET(node.nameAttribute)) {
+            size_t nameOffset = SFAT_NAME_OFFSET(node.nameAttribute);
+            size_t poolSize = sarc->namesEnd - sarc->names;
+
+            if (
+                nameOffset >= poolSize ||
+                !memchr(sarc->names + nameOffset, '\0', poolSize - nameOffset)
+            )
+                return CTR_ERROR_TRUNCATED;
+        }
+    }
+
+    return CTR_OK;
+}
+
+CtrStatus CtrSarcOpen(const CtrAllocator* allocator, const void* data, size_t size, CtrSarc** sarcOut) {
+    if (!data || !sarcOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    const u8* sarcData = (const u8*)data;
+    const SarcFileHeader* fileHeader = (const SarcFileHeader*)sarcData;
+
+    if (size < sizeof(SarcFileHeader))
+        return CTR_ERROR_TRUNCATED;
+    if (fileHeader->magic != SARC_MAGIC)
+        return CTR_ERROR_BAD_MAGIC;
+    if (
+        fileHeader->boMarker != BOMARKER_LITTLE &&
+        fileHeader->boMarker != BOMARKER_BIG
+    )
+        return CTR_ERROR_BAD_BYTE_ORDER;
+
+    // Magic values are byte strings & read the same in either order
+    int bigEndian = fileHeader->boMarker == BOMARKER_BIG;
+
+    u16 headerSize = I_CtrSarcU16(bigEndian, fileHeader->headerSize);
+    u32 dataStart = I_CtrSarcU32(bigEndian, fileHeader->dataStart);
+
+    if ((size_t)headerSize + sizeof(SfatHeader) > size)
+        return CTR_ERROR_TRUNCATED;
+
+    const SfatHeader* sfatHeader = (const SfatHeader*)(sarcData + headerSize);
+    if (sfatHeader->magic != SFAT_MAGIC)
+        return CTR_ERROR_BAD_MAGIC;
+
+    u16 sfatHeaderSize = I_CtrSarcU16(bigEndian, sfatHeader->headerSize);
+    u16 nodeCount = I_CtrSarcU16(bigEndian, sfatHeader->nodeCount);
+
+    size_t sfntOffset = (size_t)headerSize + sfatHeaderSize + sizeof(SfatNode) * nodeCount;
+    if (sfntOffset + sizeof(SfntHeader) > size)
+        return CTR_ERROR_TRUNCATED;
+
+    const SfntHeader* sfntHeader = (const SfntHeader*)(sarcData + sfntOffset);
+    if (sfntHeader->magic != SFNT_MAGIC)
+        return CTR_ERROR_BAD_MAGIC;
+
+    u16 sfntHeaderSize = I_CtrSarcU16(bigEndian, sfntHeader->headerSize);
+
+    if (dataStart > size || sfntOffset + sfntHeaderSize > dataStart)
+        return CTR_ERROR_TRUNCATED;
+
+    CtrSarc* sarc = (CtrSarc*)I_CtrAlloc(allocator, sizeof(CtrSarc));
+    if (sarc == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    I_CtrCopyAllocator(&sarc->allocator, allocator);
+
+    sarc->data = sarcData;
+    sarc->size = size;
+
+    sarc->nodes = (const SfatNode*)((const u8*)sfatHeader + sfatHeaderSize);
+    sarc->nodeCount = nodeCount;
+    sarc->hashKey = I_CtrSarcU32(bigEndian, sfatHeader->hashKey);
+
+    sarc->names = (const char*)sfntHeader + sfntHeaderSize;
+    sarc->namesEnd = (const char*)sarcData + dataStart;
+
+    sarc->dataStart = dataStart;
+
+    sarc->bigEndian = bigEndian;
+
+    CtrStatus status = I_CtrSarcValidateNodes(sarc);
+    if (status != CTR_OK) {
+        I_CtrFree(&sarc->allocator, sarc);
+        return status;
+    }
+
+    *sarcOut = sarc;
+    return CTR_OK;
+}
+
+void CtrSarcClose(CtrSarc* sarc) {
+    if (sarc == NULL)
+        return;
+
+    CtrAllocator allocator = sarc->allocator;
+    I_CtrFree(&allocator, sarc);
+}
+
+uint32_t CtrSarcGetEntryCount(const CtrSarc* sarc) {
+    return sarc->nodeCount;
+}
+
+// Walks the (4-aligned) string pool for a name with the given hash.
+static const char* I_CtrSarcFindNameByHash(const CtrSarc* sarc, u32 hash) {
+    const char* stringPtr = sarc->names;
+
+    for (u32 i = 0; i < sarc->nodeCount && stringPtr < sarc->namesEnd; i++) {
+        const char* end = (const char*)memchr(stringPtr, '\0', sarc->namesEnd - stringPtr);
+        if (end == NULL)
+            return NULL;
+
+        u32 length = end - stringPtr;
+        if (CtrSarcHash(stringPtr, length, sarc->hashKey) == hash)
+            return stringPtr;
+
+        stringPtr += (length + 1 + 3) & ~3;
+    }
+
+    return NULL;
+}
+
+// Name of a node as entries report it; NULL if the archive doesn't carry it.
+static const char* I_CtrSarcNodeName(const CtrSarc* sarc, const SfatNode* node) {
+    // If the name offset isn't avaliable, search the string pool for a
+    // string with a matching hash
+    if (SFAT_NAME_HAS_OFFSET(node->nameAttribute))
+        return sarc->names + SFAT_NAME_OFFSET(node->nameAttribute);
+
+    return I_CtrSarcFindNameByHash(sarc, node->nameHash);
+}
+
+// Hashes collide, so a node with the right hash is only a candidate. Names
+// the archive doesn't carry can't be told apart & match by hash alone.
+static int I_CtrSarcNodeHasName(const CtrSarc* sarc, u32 index, const char* name) {
+    SfatNode node = I_CtrSarcGetNode(sarc, index);
+    const char* nodeName = I_CtrSarcNodeName(sarc, &node);
+
+    return nodeName == NULL || strcmp(nodeName, name) == 0;
+}
+
+CtrStatus CtrSarcGetEntry(const CtrSarc* sarc, uint32_t index, CtrSarcEntry* entryOut) {
+    if (!sarc || !entryOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+    if (index >= sarc->nodeCount)
+        return CTR_ERROR_NOT_FOUND;
+
+    // Offsets were validated by CtrSarcOpen
+    SfatNode node = I_CtrSarcGetNode(sarc, index);
+
+    entryOut->nameHash = node.nameHash;
+    entryOut->name = I_CtrSarcNodeName(sarc, &node);
+
+    entryOut->data = sarc->data + sarc->dataStart + node.dataOffsetStart;
+    entryOut->size = node.dataOffsetEnd - node.dataOffsetStart;
+    entryOut->offset = sarc->dataStart + node.dataOffsetStart;
+
+    return CTR_OK;
+}
+
+uint32_t CtrSarcHashName(const CtrSarc* sarc, const char* name) {
+    return CtrSarcHash(name, strlen(name), sarc->hashKey);
+}
+
+CtrStatus CtrSarcFind(const CtrSarc* sarc, const char* name, uint32_t* indexOut) {
+    if (!sarc || !name || !indexOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    u32 nameHash = CtrSarcHashName(sarc, name);
+
+    // The whole run of nodes with the hash is checked, lowest index first, as
+    // the scan below would
+    if (sarc->sorted) {
+        u32 low = 0;
+        u32 high = sarc->nodeCount;
+
+        while (low < high) {
+            u32 middle = low + (high - low) / 2;
+
+            if (I_CtrSarcU32(sarc->bigEndian, sarc->nodes[middle].nameHash) < nameHash)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        for (; low < sarc->nodeCount && I_CtrSarcU32(sarc->bigEndian, sarc->nodes[low].nameHash) == nameHash; low++) {
+            if (I_CtrSarcNodeHasName(sarc, low, name)) {
+                *indexOut = low;
+                return CTR_OK;
+            }
+        }
+
+        return CTR_ERROR_NOT_FOUND;
+    }
+
+    // Compare in the archive's byte order rather than swapping every node
+    nameHash = I_CtrSarcU32(sarc->bigEndian, nameHash);
+
+    for (u32 i = 0; i < sarc->nodeCount; i++) {
+        if (sarc->nodes[i].nameHash == nameHash && I_CtrSarcNodeHasName(sarc, i, name)) {
+            *indexOut = i;
+            return CTR_OK;
+        }
+    }
+
+    return CTR_ERROR_NOT_FOUND;
+}
+
+int CtrSarcIsBigEndian(const CtrSarc* sarc) {
+    return sarc->bigEndian;
+}
+
+// Swaps every header & node field of a little endian SARC to big endian.
+// The caller has checked the file header.
+static CtrStatus I_CtrSarcSwapToBigEndian(u8* sarcData, size_t size) {
+    SarcFileHeader* fileHeader = (SarcFileHeader*)sarcData;
+
+    if ((size_t)fileHeader->headerSize + sizeof(SfatHeader) > size)
+        return CTR_ERROR_TRUNCATED;
+
+    SfatHeader* sfatHeader = (SfatHeader*)(sarcData + fileHeader->headerSize);
+    if (sfatHeader->magic != SFAT_MAGIC)
+        return CTR_ERROR_BAD_MAGIC;
+
+    size_t sfntOffset =
+        (size_t)fileHeader->headerSize + sfatHeader->headerSize +
+        sizeof(SfatNode) * sfatHeader->nodeCount;
+    if (sfntOffset + sizeof(SfntHeader) > size)
+        return CTR_ERROR_TRUNCATED;
+
+    SfatNode* nodes = (SfatNode*)((u8*)sfatHeader + sfatHeader->headerSize);
+
+    SfntHeader* sfntHeader = (SfntHeader*)(sarcData + sfntOffset);
+    if (sfntHeader->magic != SFNT_MAGIC)
+        return CTR_ERROR_BAD_MAGIC;
+
+    for (u32 i = 0; i < sfatHeader->nodeCount; i++) {
+        SfatNode* node = nodes + i;
+
+        node->nameHash = __builtin_bswap32(node->nameHash);
+
+        node->nameAttribute = __builtin_bswap32(node->nameAttribute);
+
+        node->dataOffsetStart = __builtin_bswap32(node->dataOffsetStart);
+        node->dataOffsetEnd = __builtin_bswap32(node->dataOffsetEnd);
+    }
+
+    sfntHeader->headerSize = __builtin_bswap16(sfntHeader->headerSize);
+
+    sfatHeader->headerSize = __builtin_bswap16(sfatHeader->headerSize);
+    sfatHeader->nodeCount = __builtin_bswap16(sfatHeader->nodeCount);
+    sfatHeader->hashKey = __builtin_bswap32(sfatHeader->hashKey);
+
+    fileHeader->headerSize = __builtin_bswap16(fileHeader->headerSize);
+    fileHeader->fileSize = __builtin_bswap32(fileHeader->fileSize);
+    fileHeader->dataStart = __builtin_bswap32(fileHeader->dataStart);
+    fileHeader->versionNumber = __builtin_bswap16(fileHeader->versionNumber);
+
+    fileHeader->boMarker = BOMARKER_BIG;
+
+    return CTR_OK;
+}
+
+CtrStatus CtrSarcToBigEndian(void* data, size_t size) {
+    if (!data)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    SarcFileHeader* fileHeader = (SarcFileHeader*)data;
+
+    if (size < sizeof(SarcFileHeader))
+        return CTR_ERROR_TRUNCATED;
+    if (fileHeader->magic != SARC_MAGIC)
+        return CTR_ERROR_BAD_MAGIC;
+    if (fileHeader->boMarker != BOMARKER_LITTLE)
+        return CTR_ERROR_BAD_BYTE_ORDER;
+
+    return I_CtrSarcSwapToBigEndian((u8*)data, size);
+}
@@ -0,0 +1,214 @@
+#include <zlib.h>
+
+#ifdef CTR_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "ctrInternal.h"
+
+/*
+    Whole archives are (de)compressed in one call, with the size known up
+    front. Built with CTR_USE_LIBDEFLATE, those one-shot calls go through
+    libdeflate instead of zlib; it writes the same zlib framing, so either
+    build reads what the other wrote. zlib stays for the streaming PNG
+    writer.
+*/
+
+#define CTR_ZLIB_MAX_RATIO 1032
+
+static voidpf I_CtrZlibAlloc(voidpf opaque, uInt items, uInt size) {
+    return I_CtrAlloc((const CtrAllocator*)opaque, (size_t)items * size);
+}
+
+static void I_CtrZlibFree(voidpf opaque, voidpf address) {
+    I_CtrFree((const CtrAllocator*)opaque, address);
+}
+
+static void I_CtrZlibInitStream(z_stream* stream, const CtrAllocator* allocator) {
+    memset(stream, 0, sizeof(z_stream));
+
+    stream->zalloc = I_CtrZlibAlloc;
+    stream->zfree = I_CtrZlibFree;
+    stream->opaque = (voidpf)allocator;
+}
+
+const char* CtrZlibBackend(void) {
+#ifdef CTR_USE_LIBDEFLATE
+    return "libdeflate";
+#else
+    return "zlib";
+#endif
+}
+
+CtrStatus CtrZlibGetDecompressedSize(const void* data, size_t size, size_t* sizeOut) {
+    if (!data || !sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+    if (size < sizeof(u32))
+        return CTR_ERROR_TRUNCATED;
+
+    const u8* bytes = (const u8*)data;
+    size_t decompressedSize =
+        ((u32)bytes[0] << 24) | ((u32)bytes[1] << 16) | ((u32)bytes[2] << 8) | bytes[3];
+
+    // Deflate can't expand more than ~1032:1, so a larger prefix is a lie &
+    // would only make the caller allocate for nothing
+    if (decompressedSize > (size - sizeof(u32)) * CTR_ZLIB_MAX_RATIO)
+        return CTR_ERROR_COMPRESSION;
+
+    *sizeOut = decompressedSize;
+    return CTR_OK;
+}
+
+CtrStatus CtrZlibDecompressInto(
+    const CtrAllocator* allocator, const void* data, size_t size,
+    void* out, size_t outSize
+) {
+    size_t decompressedSize;
+    CtrStatus status = CtrZlibGetDecompressedSize(data, size, &decompressedSize);
+    if (status != CTR_OK)
+        return status;
+    if (!out && decompressedSize)
+        return CTR_ERROR_INVALID_ARGUMENT;
+    if (outSize < decompressedSize)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+#ifdef CTR_USE_LIBDEFLATE
+    // libdeflate allocates its (fixed size) state with malloc
+    struct libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor();
+    if (decompressor == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    // No actual size out: anything but exactly decompressedSize bytes fails
+    enum libdeflate_result result = libdeflate_zlib_decompress(
+        decompressor, (const u8*)data + sizeof(u32), size - sizeof(u32),
+        out, decompressedSize, NULL
+    );
+    libdeflate_free_decompressor(decompressor);
+
+    if (result != LIBDEFLATE_SUCCESS)
+        return CTR_ERROR_COMPRESSION;
+
+    return CTR_OK;
+#else
+    z_stream sInflate;
+    I_CtrZlibInitStream(&sInflate, allocator);
+
+    sInflate.avail_in = size - sizeof(u32);
+    sInflate.next_in = (Bytef*)data + sizeof(u32);
+    sInflate.avail_out = decompressedSize;
+    sInflate.next_out = (Bytef*)out;
+
+    if (inflateInit(&sInflate) != Z_OK)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    int result = inflate(&sInflate, Z_FINISH);
+    inflateEnd(&sInflate);
+
+    if (result != Z_STREAM_END || sInflate.total_out != decompressedSize)
+        return CTR_ERROR_COMPRESSION;
+
+    return CTR_OK;
+#endif
+}
+
+CtrStatus CtrZlibDecompress(
+    const CtrAllocator* allocator, const void* data, size_t size,
+    void** dataOut, size_t* sizeOut
+) {
+    if (!dataOut || !sizeOut)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+    size_t decompressedSize;
+    CtrStatus status = CtrZlibGetDecompressedSize(data, size, &decompressedSize);
+    if (status != CTR_OK)
+        return status;
+
+    u8* buffer = (u8*)I_CtrAlloc(allocator, decompressedSize ? decompressedSize : 1);
+    if (buffer == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    status = CtrZlibDecompressInto(allocator, data, size, buffer, decompressedSize);
+    if (status != CTR_OK) {
+        I_CtrFree(allocator, buffer);
+        return status;
+    }
+
+    *dataOut = buffer;
+    *sizeOut = decompressedSize;
+
+    return CTR_OK;
+}
+
+CtrStatus CtrZlibCompress(
+    const CtrAllocator* allocator, const void* data, size_t size, int level,
+    void** dataOut, size_t* sizeOut
+) {
+    if (!data || !dataOut || !sizeOut || size > 0xFFFFFFFF)
+        return CTR_ERROR_INVALID_ARGUMENT;
+
+#ifdef CTR_USE_LIBDEFLATE
+    struct libdeflate_compressor* compressor = libdeflate_alloc_compressor(level);
+    if (compressor == NULL)
+        return CTR_ERROR_OUT_OF_MEMORY;
+
+    u64 compressedMaxSize = libdeflate_zlib_compress_bound(compressor, size);
+#else
+    u64 compressedMaxSize = compressBound(size);
+#endif
+
+    u8* buffer = (u8*)I_CtrAlloc(allocator, compressedMaxSize + sizeof(u32));
+    if (buffer == NULL) {
+#ifdef CTR_USE_LIBDEFLATE
+        libdeflate_free_compressor(compressor);
+#endif
+        return CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    buffer[0] = (u8)(size >> 24);
+    buffer[1] = (u8)(size >> 16);
+    buffer[2] = (u8)(size >> 8);
+    buffer[3] = (u8)size;
+
+#ifdef CTR_USE_LIBDEFLATE
+    size_t compressedSize = libdeflate_zlib_compress(
+        compressor, data, size, buffer + sizeof(u32), compressedMaxSize
+    );
+    libdeflate_free_compressor(compressor);
+
+    if (compressedSize == 0) {
+        I_CtrFree(allocator, buffer);
+        return CTR_ERROR_COMPRESSION;
+    }
+
+    *dataOut = buffer;
+    *sizeOut = compressedSize + sizeof(u32);
+
+    return CTR_OK;
+#else
+    z_stream sDeflate;
+    I_CtrZlibInitStream(&sDeflate, allocator);
+
+    sDeflate.avail_in = size;
+    sDeflate.next_in = (Bytef*)data;
+    sDeflate.avail_out = compressedMaxSize;
+    sDeflate.next_out = buffer + sizeof(u32);
+
+    if (deflateInit(&sDeflate, level) != Z_OK) {
+        I_CtrFree(allocator, buffer);
+        return CTR_ERROR_OUT_OF_MEMORY;
+    }
+
+    int result = deflate(&sDeflate, Z_FINISH);
+    deflateEnd(&sDeflate);
+
+    if (result != Z_STREAM_END) {
+        I_CtrFree(allocator, buffer);
+        return CTR_ERROR_COMPRESSION;
+    }
+
+    *dataOut = buffer;
+    *sizeOut = sDeflate.total_out + sizeof(u32);
+
+    return CTR_OK;
+#endif
+}
@@ -0,0 +1,301 @@
+#ifndef CTRTOOLS_H
+#define CTRTOOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    libctrtools: parsing & decoding of 3DS SARC, ZLIB-SARC and CTPK files,
+    and of the Yaz0 (SZS) & LZ11/LZ13 containers they also ship in.
+    Decoded textures can be written out as PNG.
+
+    - Every fallible call returns a CtrStatus; nothing prints or exits.
+    - Memory comes from the CtrAllocator passed in (NULL: malloc & free).
+      Buffers returned to the caller are released with CtrFree using the
+      same allocator.
+    - Handles keep no global state & only read the buffer they were opened
+      over, so different handles may be used from different threads. The
+      buffer must outlive the handle.
+    - Opening a handle validates every offset, size & string in the file in
+      one pass; a handle that opened never reads outside its buffer, so
+      untrusted files can be handled in-process.
+*/
+
+typedef enum {
+    CTR_OK = 0,
+
+    CTR_ERROR_INVALID_ARGUMENT,
+    CTR_ERROR_OUT_OF_MEMORY,
+    CTR_ERROR_BAD_MAGIC, // Not the expected file type
+    CTR_ERROR_BAD_BYTE_ORDER, // SARC byte order mark is neither BE nor LE
+    CTR_ERROR_TRUNCATED, // A header or section runs past the end of the buffer
+    CTR_ERROR_UNSUPPORTED_FORMAT, // Texture format without a decoder
+    CTR_ERROR_NOT_FOUND,
+    CTR_ERROR_COMPRESSION, // Compressor failed or the stream is corrupt
+    CTR_ERROR_ABORTED // A callback asked to stop
+} CtrStatus;
+
+// Static, human-readable description of a status.
+const char* CtrStatusString(CtrStatus status);
+
+typedef struct {
+    void* (*alloc)(void* user, size_t size);
+    void (*free)(void* user, void* ptr);
+
+    void* user; // Passed through to alloc & free
+} CtrAllocator;
+
+void CtrFree(const CtrAllocator* allocator, void* ptr);
+
+//////////////////////////////////////// THREADS
+
+// Online logical CPUs, at least 1.
+uint32_t CtrGetCpuCount(void);
+
+// Runs worker(user) on threadCount threads (0: one per CPU), the calling
+// thread being one of them, & returns once every one has returned. Workers
+// are expected to take their work off a shared counter in user, so a thread
+// that can't be started (or a thread list the allocator can't provide) only
+// leaves its share to the others. Returns how many threads ran, at least 1.
+uint32_t CtrRunThreads(
+    const CtrAllocator* allocator, uint32_t threadCount,
+    void* (*worker)(void* user), void* user
+);
+
+//////////////////////////////////////// ZLIB
+
+// ZLIB-SARC framing: 32-bit big endian decompressed size, then a zlib stream.
+// The one-shot calls below use libdeflate when built with USE_LIBDEFLATE=1
+// (it keeps its own state with malloc, not the allocator) & zlib otherwise;
+// both produce & accept the same standard zlib streams.
+
+// "zlib" or "libdeflate".
+const char* CtrZlibBackend(void);
+
+CtrStatus CtrZlibDecompress(
+    const CtrAllocator* allocator, const void* data, size_t size,
+    void** dataOut, size_t* sizeOut
+);
+
+// Size from the prefix, so the caller can provide the output buffer (e.g. a
+// mapping) to CtrZlibDecompressInto. The allocator only backs zlib's state.
+// A prefix deflate couldn't reach from this much input is rejected.
+CtrStatus CtrZlibGetDecompressedSize(const void* data, size_t size, size_t* sizeOut);
+CtrStatus CtrZlibDecompressInto(
+    const CtrAllocator* allocator, const void* data, size_t size,
+    void* out, size_t outSize
+);
+
+// level is a zlib compression level (0-9).
+CtrStatus CtrZlibCompress(
+    const CtrAllocator* allocator, const void* data, size_t size, int level,
+    void** dataOut, size_t* sizeOut
+);
+
+// Optimal-parsing deflate for release builds: far slower than level 9 but
+// smaller (never larger), & still a standard zlib stream. Independent 1 MiB segments are
+// encoded on up to threadCount threads (0: one per CPU); the output is the
+// same for any count.
+CtrStatus CtrZlibCompressUltra(
+    const CtrAllocator* allocator, const void* data, size_t size, uint32_t threadCount,
+    void** dataOut, size_t* sizeOut
+);
+
+//////////////////////////////////////// CODEC
+
+/*
+    Container compression around a SARC or CTPK, told apart by its first
+    bytes with CtrCodecDetect:
+    - ZLIB: the ZLIB-SARC framing above
+    - YAZ0: "Yaz0", 32-bit big endian size, 8 reserved bytes, LZ stream
+    - LZ11: type byte 0x11 & 24-bit little endian size (0: 32-bit size
+      follows), LZ stream
+    - LZ13: 0x13 & size as for LZ11, then a complete LZ11 file
+    Anything unrecognised, including a bare SARC or CTPK, is NONE & passes
+    through unchanged.
+
+    Decoders write straight into the caller's buffer, check every reference
+    against it & reject size fields the stream couldn't reach.
+*/
+
+typedef enum {
+    CTR_CODEC_NONE = 0,
+    CTR_CODEC_ZLIB,
+    CTR_CODEC_YAZ0,
+    CTR_CODEC_LZ11,
+    CTR_CODEC_LZ13
+} CtrCodec;
+
+CtrCodec CtrCodecDetect(const void* data, size_t size);
+
+// Lowercase name ("zlib", "yaz0", ...) & its inverse, which also takes "szs".
+const char* CtrCodecName(CtrCodec codec);
+CtrStatus CtrCodecFromName(const char* name, CtrCodec* codecOut);
+
+CtrStatus CtrCodecGetDecompressedSize(CtrCodec codec, const void* data, size_t size, size_t* sizeOut);
+CtrStatus CtrCodecDecompressInto(
+    const CtrAllocator* allocator, CtrCodec codec, const void* data, size_t size,
+    void* out, size_t outSize
+);
+CtrStatus CtrCodecDecompress(
+    const CtrAllocator* allocator, CtrCodec codec, const void* data, size_t size,
+    void** dataOut, size_t* sizeOut
+);
+
+// level (0-9) is zlib's level, or how hard the LZ codecs search for matches.
+// CTR_CODEC_LEVEL_ULTRA: CtrZlibCompressUltra on every CPU for zlib, the
+// whole window searched at every position for the LZ codecs.
+#define CTR_CODEC_LEVEL_ULTRA 10
+
+CtrStatus CtrCodecCompress(
+    const CtrAllocator* allocator, CtrCodec codec, const void* data, size_t size, int level,
+    void** dataOut, size_t* sizeOut
+);
+
+//////////////////////////////////////// HASH
+
+// 64-bit XXH64 of data: fast & non-cryptographic, for telling contents apart
+// (e.g. archive diffs), not for anything an attacker controls.
+uint64_t CtrHash64(const void* data, size_t size, uint64_t seed);
+
+//////////////////////////////////////// SARC
+
+typedef struct CtrSarc CtrSarc;
+
+typedef struct {
+    const char* name; // NULL if the archive doesn't carry it
+    uint32_t nameHash;
+
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t offset; // From the start of the archive
+} CtrSarcEntry;
+
+// Either byte order is read in place; the buffer is never written, so it
+// may be a read-only mapping.
+CtrStatus CtrSarcOpen(const CtrAllocator* allocator, const void* data, size_t size, CtrSarc** sarcOut);
+void CtrSarcClose(CtrSarc* sarc);
+
+uint32_t CtrSarcGetEntryCount(const CtrSarc* sarc);
+CtrStatus CtrSarcGetEntry(const CtrSarc* sarc, uint32_t index, CtrSarcEntry* entryOut);
+// By exact name: nodes sharing the name's hash are told apart by the names
+// stored in the archive.
+CtrStatus CtrSarcFind(const CtrSarc* sarc, const char* name, uint32_t* indexOut);
+
+// SFAT name hash of length bytes of name under key (0x65 in practice), as
+// archives are built with.
+uint32_t CtrSarcHash(const char* name, size_t length, uint32_t key);
+
+// Name hash the archive uses for name (SFAT hash key applied).
+uint32_t CtrSarcHashName(const CtrSarc* sarc, const char* name);
+
+// Byte order the archive was stored in.
+int CtrSarcIsBigEndian(const CtrSarc* sarc);
+
+// Converts a little endian SARC (e.g. a fresh build) to big endian in place.
+CtrStatus CtrSarcToBigEndian(void* data, size_t size);
+
+//////////////////////////////////////// CTPK
+
+typedef struct CtrCtpk CtrCtpk;
+
+// Texture data formats
+#define CTR_CTPK_FORMAT_ETC1 0x0C
+#define CTR_CTPK_FORMAT_ETC1A4 0x0D
+
+typedef struct {
+    const char* path;
+
+    uint32_t format;
+    uint16_t width;
+    uint16_t height;
+    uint8_t mipCount;
+
+    const uint8_t* data;
+    uint32_t dataSize;
+    uint32_t dataOffset; // From the start of the archive
+
+    uint32_t timestamp; // Unix time of the source image
+} CtrCtpkTexture;
+
+CtrStatus CtrCtpkOpen(const CtrAllocator* allocator, const void* data, size_t size, CtrCtpk** ctpkOut);
+void CtrCtpkClose(CtrCtpk* ctpk);
+
+uint32_t CtrCtpkGetTextureCount(const CtrCtpk* ctpk);
+CtrStatus CtrCtpkGetTexture(const CtrCtpk* ctpk, uint32_t index, CtrCtpkTexture* textureOut);
+CtrStatus CtrCtpkFind(const CtrCtpk* ctpk, const char* path, uint32_t* indexOut);
+
+// "ETC1", "RGBA8888", .. or "UNKNOWN".
+const char* CtrCtpkFormatName(uint32_t format);
+
+// Decodes a texture to width * height row-major pixels, (R,G,B,A) in
+// memory. The buffer comes from the handle's allocator.
+CtrStatus CtrCtpkDecodeTexture(const CtrCtpk* ctpk, uint32_t index, uint32_t** pixelsOut, size_t* sizeOut);
+
+// Size in bytes of a texture's decoded pixels, or 0 if it can't be decoded.
+size_t CtrCtpkGetDecodedSize(const CtrCtpk* ctpk, uint32_t index);
+
+// Largest CtrCtpkGetDecodedSize over the archive; one buffer this size can
+// hold any of its textures.
+size_t CtrCtpkGetMaxDecodedSize(const CtrCtpk* ctpk);
+
+// Same as CtrCtpkDecodeTexture, into a caller-owned buffer of capacity bytes.
+CtrStatus CtrCtpkDecodeTextureInto(
+    const CtrCtpk* ctpk, uint32_t index, uint32_t* pixels, size_t capacity, size_t* sizeOut
+);
+
+// Receives rowCount rows of the texture's width, starting at row y. The
+// pixels are only valid during the call. Nonzero stops the decode.
+typedef int (*CtrCtpkRowCallback)(void* user, uint32_t y, uint32_t rowCount, const uint32_t* pixels);
+
+// Decodes one 8-pixel-tall tile row at a time & hands each to the callback,
+// top to bottom. Only one tile row is held in memory, so the working set
+// doesn't grow with the height; output can start after the first row.
+// Returns CTR_ERROR_ABORTED if the callback stopped it.
+CtrStatus CtrCtpkDecodeTextureRows(
+    const CtrCtpk* ctpk, uint32_t index, CtrCtpkRowCallback callback, void* user
+);
+
+//////////////////////////////////////// PNG
+
+// Encodes row-major (R,G,B,A) pixels as an 8-bit RGBA PNG. level is a zlib
+// compression level (0-9); previews want a low one.
+CtrStatus CtrPngEncode(
+    const CtrAllocator* allocator, const uint32_t* pixels, uint32_t width, uint32_t height,
+    int level, void** dataOut, size_t* sizeOut
+);
+
+/*
+    Incremental PNG encoder for rows that arrive over time (e.g. from
+    CtrCtpkDecodeTextureRows). Output goes to the write callback as it is
+    produced, in IDAT chunks of at most CTR_PNG_CHUNK_SIZE bytes; a nonzero
+    return from it fails the writer with CTR_ERROR_ABORTED.
+*/
+
+#define CTR_PNG_CHUNK_SIZE (64 * 1024)
+
+typedef struct CtrPngWriter CtrPngWriter;
+
+typedef int (*CtrPngWriteCallback)(void* user, const void* data, size_t size);
+
+CtrStatus CtrPngWriterBegin(
+    const CtrAllocator* allocator, uint32_t width, uint32_t height, int level,
+    CtrPngWriteCallback write, void* user, CtrPngWriter** writerOut
+);
+
+// Appends rowCount rows of width pixels.
+CtrStatus CtrPngWriterAddRows(CtrPngWriter* writer, const uint32_t* pixels, uint32_t rowCount);
+
+// Flushes the stream & writes IEND once every row was added, then frees the
+// writer whether or not that succeeded.
+CtrStatus CtrPngWriterFinish(CtrPngWriter* writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
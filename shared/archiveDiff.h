@@ -0,0 +1,221 @@
+#ifndef ARCHIVEDIFF_H
+#define ARCHIVEDIFF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <inttypes.h>
+
+#include "ctrtools.h"
+
+#include "listWriter.h"
+#include "stats.h"
+
+#include "common.h"
+
+// Compares the members of two archives that are already in memory. Entries
+// are matched by name; a pair whose size or metadata differs has changed
+// outright, & only the pairs that could still be equal are hashed
+// (CtrHash64), on a pool of worker threads taking entries off a shared
+// counter, largest first. Nothing is written besides the report.
+
+typedef struct {
+    const char* name;
+
+    const u8* data;
+    u64 size;
+
+    u64 meta; // Also compared (e.g. a texture's format & dimensions), 0 if unused
+    u64 hash;
+} DiffEntry;
+
+typedef struct {
+    u32 added;
+    u32 removed;
+    u32 changed;
+    u32 unchanged;
+} DiffSummary;
+
+StatsPhase statsDiffHash = { "content hash" };
+
+typedef struct {
+    DiffEntry** jobs;
+    u32 jobCount;
+
+    u32 nextJob; // Atomic
+} DiffHashContext;
+
+void* I_DiffHashWorker(void* arg) {
+    DiffHashContext* context = (DiffHashContext*)arg;
+
+    while (1) {
+        u32 jobIndex = __atomic_fetch_add(&context->nextJob, 1, __ATOMIC_RELAXED);
+        if (jobIndex >= context->jobCount)
+            break;
+
+        DiffEntry* entry = context->jobs[jobIndex];
+        entry->hash = CtrHash64(entry->data, entry->size, 0);
+    }
+
+    return NULL;
+}
+
+int I_DiffCompareName(const void* a, const void* b) {
+    return strcmp(((const DiffEntry*)a)->name, ((const DiffEntry*)b)->name);
+}
+
+int I_DiffCompareSizeDesc(const void* a, const void* b) {
+    u64 sizeA = (*(DiffEntry* const*)a)->size;
+    u64 sizeB = (*(DiffEntry* const*)b)->size;
+
+    return (sizeA < sizeB) - (sizeA > sizeB);
+}
+
+// Hashes every entry in jobs on threadCount threads (0: one per CPU).
+void DiffHashEntries(DiffEntry** jobs, u32 jobCount, u32 threadCount) {
+    if (jobCount == 0)
+        return;
+
+    // Big members first, so one of them can't be left for last on its own
+    qsort(jobs, jobCount, sizeof(DiffEntry*), I_DiffCompareSizeDesc);
+
+    DiffHashContext context;
+    context.jobs = jobs;
+    context.jobCount = jobCount;
+    context.nextJob = 0;
+
+    if (threadCount == 0)
+        threadCount = CtrGetCpuCount();
+    if (threadCount > jobCount)
+        threadCount = jobCount;
+
+    CtrRunThreads(NULL, threadCount, I_DiffHashWorker, &context);
+}
+
+void I_DiffWriteRecord(
+    FILE* fp, ListWriter* writer, ListFormat format, char status,
+    const DiffEntry* before, const DiffEntry* after
+) {
+    const char* name = before ? before->name : after->name;
+
+    if (format == LIST_FORMAT_HUMAN) {
+        if (before && after)
+            fprintf(
+                fp, "%c %s (size: %" PRIu64 " -> %" PRIu64 ")\n",
+                status, name, (uint64_t)before->size, (uint64_t)after->size
+            );
+        else
+            fprintf(
+                fp, "%c %s (size: %" PRIu64 ")\n",
+                status, name, (uint64_t)(before ? before->size : after->size)
+            );
+        return;
+    }
+
+    ListRecordBegin(writer);
+    ListFieldString(writer, "status", status == '+' ? "added" : status == '-' ? "removed" : "changed");
+    ListFieldString(writer, "name", name);
+    ListFieldU64(writer, "oldSize", before ? before->size : 0);
+    ListFieldU64(writer, "newSize", after ? after->size : 0);
+    ListRecordEnd(writer);
+}
+
+// Reports every added (+), removed (-) & changed (~) entry going from before
+// to after, in name order, to fp. Both arrays are reordered.
+DiffSummary DiffArchives(
+    DiffEntry* before, u32 beforeCount, DiffEntry* after, u32 afterCount,
+    u32 threadCount, FILE* fp, ListFormat format
+) {
+    DiffSummary summary = { 0 };
+
+    qsort(before, beforeCount, sizeof(DiffEntry), I_DiffCompareName);
+    qsort(after, afterCount, sizeof(DiffEntry), I_DiffCompareName);
+
+    // Collect the pairs that need their contents compared
+    DiffEntry** jobs = (DiffEntry**)malloc(sizeof(DiffEntry*) * ((u64)beforeCount + afterCount + 1));
+    if (jobs == NULL)
+        PANIC_MALLOC("hash jobs");
+
+    u32 jobCount = 0;
+    u64 bytesHashed = 0;
+
+    for (u32 i = 0, j = 0; i < beforeCount && j < afterCount;) {
+        int order = strcmp(before[i].name, after[j].name);
+
+        if (order < 0)
+            i++;
+        else if (order > 0)
+            j++;
+        else {
+            if (before[i].size == after[j].size && before[i].meta == after[j].meta) {
+                jobs[jobCount++] = before + i;
+                jobs[jobCount++] = after + j;
+                bytesHashed += before[i].size * 2;
+            }
+            i++;
+            j++;
+        }
+    }
+
+    double statsTime = StatsBegin();
+
+    DiffHashEntries(jobs, jobCount, threadCount);
+
+    StatsEnd(&statsDiffHash, statsTime, bytesHashed, 0);
+
+    free(jobs);
+
+    static const char* const columns[] = { "status", "name", "oldSize", "newSize" };
+
+    ListWriter writer;
+    if (format != LIST_FORMAT_HUMAN)
+        ListBegin(&writer, fp, format, columns, 4);
+
+    u32 i = 0, j = 0;
+    while (i < beforeCount || j < afterCount) {
+        int order =
+            i >= beforeCount ? 1 :
+            j >= afterCount ? -1 :
+            strcmp(before[i].name, after[j].name);
+
+        if (order < 0) {
+            I_DiffWriteRecord(fp, &writer, format, '-', before + i++, NULL);
+            summary.removed++;
+        }
+        else if (order > 0) {
+            I_DiffWriteRecord(fp, &writer, format, '+', NULL, after + j++);
+            summary.added++;
+        }
+        else {
+            const DiffEntry* a = before + i++;
+            const DiffEntry* b = after + j++;
+
+            if (a->size == b->size && a->meta == b->meta && a->hash == b->hash)
+                summary.unchanged++;
+            else {
+                I_DiffWriteRecord(fp, &writer, format, '~', a, b);
+                summary.changed++;
+            }
+        }
+    }
+
+    if (format != LIST_FORMAT_HUMAN)
+        ListEnd(&writer);
+
+    return summary;
+}
+
+void DiffLogSummary(DiffSummary summary) {
+    if (summary.added == 0 && summary.removed == 0 && summary.changed == 0)
+        LOG("No differences (%u entries)\n", summary.unchanged);
+    else {
+        LOG(
+            "\n%u added, %u removed, %u changed, %u unchanged\n",
+            summary.added, summary.removed, summary.changed, summary.unchanged
+        );
+    }
+}
+
+#endif
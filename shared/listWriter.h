@@ -0,0 +1,261 @@
+#ifndef LISTWRITER_H
+#define LISTWRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include "common.h"
+
+// Buffered writer for listing output. Every entry is formatted straight into
+// one large buffer which is only handed to stdio when it fills up, so large
+// listings cost one write per WRITER_BUFFER_SIZE bytes instead of one printf
+// per field.
+
+#define WRITER_BUFFER_SIZE (256 * 1024)
+
+typedef enum {
+    LIST_FORMAT_HUMAN,
+    LIST_FORMAT_JSON,
+    LIST_FORMAT_NDJSON,
+    LIST_FORMAT_TSV
+} ListFormat;
+
+typedef struct {
+    FILE* fp;
+
+    u8* buffer;
+    u32 length;
+
+    ListFormat format;
+
+    u32 recordCount; // Records started so far
+    u32 fieldCount; // Fields written to the current record
+} ListWriter;
+
+// Returns -1 if the name does not match any format.
+int ListFormatFromName(const char* name) {
+    if (strcasecmp(name, "human") == 0)
+        return LIST_FORMAT_HUMAN;
+    if (strcasecmp(name, "json") == 0)
+        return LIST_FORMAT_JSON;
+    if (strcasecmp(name, "ndjson") == 0)
+        return LIST_FORMAT_NDJSON;
+    if (strcasecmp(name, "tsv") == 0)
+        return LIST_FORMAT_TSV;
+
+    return -1;
+}
+
+void WriterFlush(ListWriter* writer) {
+    if (writer->length == 0)
+        return;
+
+    if (fwrite(writer->buffer, 1, writer->length, writer->fp) != writer->length)
+        panic("List output write failed");
+
+    writer->length = 0;
+}
+
+void WriterWrite(ListWriter* writer, const void* data, u32 size) {
+    if (writer->length + size > WRITER_BUFFER_SIZE) {
+        WriterFlush(writer);
+
+        // Too large to be worth buffering
+        if (size > WRITER_BUFFER_SIZE) {
+            if (fwrite(data, 1, size, writer->fp) != size)
+                panic("List output write failed");
+            return;
+        }
+    }
+
+    memcpy(writer->buffer + writer->length, data, size);
+    writer->length += size;
+}
+
+static inline void WriterPutc(ListWriter* writer, char c) {
+    if (writer->length == WRITER_BUFFER_SIZE)
+        WriterFlush(writer);
+
+    writer->buffer[writer->length++] = (u8)c;
+}
+
+void WriterPuts(ListWriter* writer, const char* str) {
+    WriterWrite(writer, str, strlen(str));
+}
+
+void WriterU64(ListWriter* writer, u64 value) {
+    char digits[20];
+    u32 count = 0;
+
+    do {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    while (count)
+        WriterPutc(writer, digits[--count]);
+}
+
+void WriterHex32(ListWriter* writer, u32 value) {
+    static const char hexDigits[] = "0123456789abcdef";
+
+    for (int shift = 28; shift >= 0; shift -= 4)
+        WriterPutc(writer, hexDigits[(value >> shift) & 0xF]);
+}
+
+// Writes a quoted & escaped JSON string.
+void WriterJsonString(ListWriter* writer, const char* str) {
+    static const char hexDigits[] = "0123456789abcdef";
+
+    WriterPutc(writer, '"');
+
+    const char* runStart = str;
+    for (; *str; str++) {
+        u8 c = (u8)*str;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        WriterWrite(writer, runStart, str - runStart);
+        runStart = str + 1;
+
+        WriterPutc(writer, '\\');
+        switch (c) {
+        case '"': WriterPutc(writer, '"'); break;
+        case '\\': WriterPutc(writer, '\\'); break;
+        case '\n': WriterPutc(writer, 'n'); break;
+        case '\r': WriterPutc(writer, 'r'); break;
+        case '\t': WriterPutc(writer, 't'); break;
+        default:
+            WriterPuts(writer, "u00");
+            WriterPutc(writer, hexDigits[c >> 4]);
+            WriterPutc(writer, hexDigits[c & 0xF]);
+            break;
+        }
+    }
+
+    WriterWrite(writer, runStart, str - runStart);
+
+    WriterPutc(writer, '"');
+}
+
+// Writes a TSV cell; tabs and newlines would break the row so they are
+// replaced with spaces.
+void WriterTsvString(ListWriter* writer, const char* str) {
+    const char* runStart = str;
+    for (; *str; str++) {
+        if (*str != '\t' && *str != '\n' && *str != '\r')
+            continue;
+
+        WriterWrite(writer, runStart, str - runStart);
+        WriterPutc(writer, ' ');
+        runStart = str + 1;
+    }
+
+    WriterWrite(writer, runStart, str - runStart);
+}
+
+// columns: field names in the order they will be written for every record.
+// Only TSV output uses them (as the header row).
+void ListBegin(ListWriter* writer, FILE* fp, ListFormat format, const char* const* columns, u32 columnCount) {
+    writer->fp = fp;
+
+    writer->buffer = (u8*)malloc(WRITER_BUFFER_SIZE);
+    if (writer->buffer == NULL)
+        PANIC_MALLOC("list writer buf");
+
+    writer->length = 0;
+    writer->format = format;
+    writer->recordCount = 0;
+    writer->fieldCount = 0;
+
+    if (format == LIST_FORMAT_JSON)
+        WriterPutc(writer, '[');
+    else if (format == LIST_FORMAT_TSV) {
+        for (u32 i = 0; i < columnCount; i++) {
+            if (i != 0)
+                WriterPutc(writer, '\t');
+            WriterPuts(writer, columns[i]);
+        }
+        WriterPutc(writer, '\n');
+    }
+}
+
+void ListRecordBegin(ListWriter* writer) {
+    if (writer->format == LIST_FORMAT_JSON) {
+        if (writer->recordCount != 0)
+            WriterPutc(writer, ',');
+        WriterPuts(writer, "\n  {");
+    }
+    else if (writer->format == LIST_FORMAT_NDJSON)
+        WriterPutc(writer, '{');
+
+    writer->recordCount++;
+    writer->fieldCount = 0;
+}
+
+void ListRecordEnd(ListWriter* writer) {
+    if (writer->format == LIST_FORMAT_JSON)
+        WriterPutc(writer, '}');
+    else if (writer->format == LIST_FORMAT_NDJSON)
+        WriterPuts(writer, "}\n");
+    else
+        WriterPutc(writer, '\n');
+}
+
+static inline void I_ListFieldKey(ListWriter* writer, const char* key) {
+    if (writer->format == LIST_FORMAT_TSV) {
+        if (writer->fieldCount++ != 0)
+            WriterPutc(writer, '\t');
+        return;
+    }
+
+    if (writer->fieldCount++ != 0)
+        WriterPutc(writer, ',');
+
+    WriterPutc(writer, '"');
+    WriterPuts(writer, key);
+    WriterPuts(writer, "\":");
+}
+
+void ListFieldString(ListWriter* writer, const char* key, const char* value) {
+    I_ListFieldKey(writer, key);
+
+    if (writer->format == LIST_FORMAT_TSV)
+        WriterTsvString(writer, value);
+    else
+        WriterJsonString(writer, value);
+}
+
+void ListFieldU64(ListWriter* writer, const char* key, u64 value) {
+    I_ListFieldKey(writer, key);
+    WriterU64(writer, value);
+}
+
+// Hex values are written as "0x%08x" strings since JSON has no hex literals.
+void ListFieldHex32(ListWriter* writer, const char* key, u32 value) {
+    I_ListFieldKey(writer, key);
+
+    if (writer->format != LIST_FORMAT_TSV)
+        WriterPutc(writer, '"');
+
+    WriterPuts(writer, "0x");
+    WriterHex32(writer, value);
+
+    if (writer->format != LIST_FORMAT_TSV)
+        WriterPutc(writer, '"');
+}
+
+void ListEnd(ListWriter* writer) {
+    if (writer->format == LIST_FORMAT_JSON)
+        WriterPuts(writer, writer->recordCount ? "\n]\n" : "]\n");
+
+    WriterFlush(writer);
+    fflush(writer->fp);
+
+    free(writer->buffer);
+    writer->buffer = NULL;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+// Single-line progress bar on stderr. It is only drawn at the normal log level
+// when stderr is a terminal, and redrawn at most every PROGRESS_INTERVAL
+// seconds, so updating it from a hot loop costs a clock read per item.
+
+#define PROGRESS_INTERVAL 0.1
+#define PROGRESS_BAR_WIDTH 24
+
+typedef struct {
+    const char* label;
+    int enabled;
+
+    u32 total;
+    u32 done;
+    u64 bytes;
+
+    double startTime;
+    double lastDrawTime;
+} Progress;
+
+void I_ProgressDraw(Progress* progress, double now) {
+    double elapsed = now - progress->startTime;
+
+    u32 filled = progress->total ?
+        (u32)((u64)progress->done * PROGRESS_BAR_WIDTH / progress->total) : 0;
+
+    char bar[PROGRESS_BAR_WIDTH + 1];
+    for (u32 i = 0; i < PROGRESS_BAR_WIDTH; i++)
+        bar[i] = i < filled ? '#' : '.';
+    bar[PROGRESS_BAR_WIDTH] = '\0';
+
+    double rate = elapsed > 0.0 ? progress->bytes / elapsed : 0.0;
+
+    u32 eta = 0;
+    if (progress->done && progress->done < progress->total)
+        eta = (u32)(elapsed * (progress->total - progress->done) / progress->done);
+
+    fprintf(
+        stderr, "\r%s [%s] %u/%u  %.1f MB/s  ETA %u:%02u ",
+        progress->label, bar, progress->done, progress->total,
+        rate / (1024.0 * 1024.0), eta / 60, eta % 60
+    );
+
+    progress->lastDrawTime = now;
+}
+
+void ProgressBegin(Progress* progress, const char* label, u32 total) {
+    progress->label = label;
+    progress->enabled =
+        logLevel == LOG_LEVEL_NORMAL && isatty(fileno(stderr));
+
+    progress->total = total;
+    progress->done = 0;
+    progress->bytes = 0;
+
+    progress->startTime = getTimeSeconds();
+    progress->lastDrawTime = 0.0;
+
+    if (progress->enabled)
+        I_ProgressDraw(progress, progress->startTime);
+}
+
+// Marks one more item (of size bytes) as done.
+static inline void ProgressStep(Progress* progress, u64 bytes) {
+    progress->done++;
+    progress->bytes += bytes;
+
+    if (!progress->enabled)
+        return;
+
+    double now = getTimeSeconds();
+    if (now - progress->lastDrawTime >= PROGRESS_INTERVAL)
+        I_ProgressDraw(progress, now);
+}
+
+void ProgressEnd(Progress* progress) {
+    if (!progress->enabled)
+        return;
+
+    I_ProgressDraw(progress, getTimeSeconds());
+    fputc('\n', stderr);
+}
+
+#endif
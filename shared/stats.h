@@ -0,0 +1,106 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "common.h"
+
+// Per-phase timing & throughput (--stats). Phases are plain globals owned by
+// the code they measure; a phase is added to the report the first time it is
+// ended, so the report follows pipeline order. When stats are disabled the
+// begin/end pair costs a branch each.
+
+#define STATS_MAX_PHASES 16
+
+typedef struct {
+    const char* name;
+
+    u32 calls;
+    double seconds;
+
+    u64 bytesIn;
+    u64 bytesOut;
+
+    int registered;
+} StatsPhase;
+
+int statsEnabled = 0;
+double statsStartTime;
+
+StatsPhase* statsPhases[STATS_MAX_PHASES];
+u32 statsPhaseCount = 0;
+
+void StatsInit(int enabled) {
+    statsEnabled = enabled;
+    statsStartTime = getTimeSeconds();
+}
+
+static inline double StatsBegin(void) {
+    return statsEnabled ? getTimeSeconds() : 0.0;
+}
+
+static inline void StatsEnd(StatsPhase* phase, double startTime, u64 bytesIn, u64 bytesOut) {
+    if (!statsEnabled)
+        return;
+
+    phase->seconds += getTimeSeconds() - startTime;
+    phase->bytesIn += bytesIn;
+    phase->bytesOut += bytesOut;
+    phase->calls++;
+
+    if (!phase->registered && statsPhaseCount < STATS_MAX_PHASES) {
+        statsPhases[statsPhaseCount++] = phase;
+        phase->registered = 1;
+    }
+}
+
+// Peak resident set size in KiB, or 0 if unknown.
+u64 StatsGetPeakRss(void) {
+    #ifdef _WIN32
+    return 0;
+    #else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    return (u64)usage.ru_maxrss;
+    #endif
+}
+
+// Throughput is taken over the larger of a phase's input & output, so both
+// inflate & deflate are rated by their uncompressed side.
+void StatsReport(void) {
+    if (!statsEnabled)
+        return;
+
+    const double mib = 1024.0 * 1024.0;
+
+    fprintf(stderr, "\n-- Stats --\n");
+    fprintf(
+        stderr, "%-20s %8s %12s %12s %12s %10s\n",
+        "phase", "calls", "time (ms)", "in (MiB)", "out (MiB)", "MiB/s"
+    );
+
+    for (u32 i = 0; i < statsPhaseCount; i++) {
+        StatsPhase* phase = statsPhases[i];
+
+        u64 bytes = phase->bytesIn > phase->bytesOut ? phase->bytesIn : phase->bytesOut;
+        double rate = phase->seconds > 0.0 ? bytes / mib / phase->seconds : 0.0;
+
+        fprintf(
+            stderr, "%-20s %8u %12.3f %12.3f %12.3f %10.1f\n",
+            phase->name, phase->calls, phase->seconds * 1000.0,
+            phase->bytesIn / mib, phase->bytesOut / mib, rate
+        );
+    }
+
+    fprintf(stderr, "Wall time: %.3f ms\n", (getTimeSeconds() - statsStartTime) * 1000.0);
+    fprintf(stderr, "Peak RSS: %lu KiB\n", StatsGetPeakRss());
+}
+
+#endif
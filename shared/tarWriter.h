@@ -0,0 +1,249 @@
+#ifndef TARWRITER_H
+#define TARWRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+// Streams a POSIX (ustar) tar archive, e.g. to stdout for "-o -". Every
+// member goes out as its header, its data straight from the caller's buffer
+// & the padding in one writev, so an extraction costs one system call per
+// member instead of the open/write/close/utime round trips of a directory
+// tree. Parent directories are left implicit; tar creates them on
+// extraction. Paths that don't fit the ustar name & prefix fields get a pax
+// extended header.
+
+#define TAR_BLOCK_SIZE 512
+
+typedef struct {
+    int fd;
+    u64 bytesWritten;
+} TarWriter;
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} TarHeader;
+
+static const u8 tarZeroBlock[TAR_BLOCK_SIZE] = { 0 };
+
+void TarBegin(TarWriter* writer, FILE* fp) {
+    fflush(fp);
+
+    #ifdef _WIN32
+    _setmode(_fileno(fp), _O_BINARY);
+    #endif
+
+    writer->fd = fileno(fp);
+    writer->bytesWritten = 0;
+}
+
+// Writes all of every part, across as many calls as a pipe needs.
+void I_TarWriteParts(TarWriter* writer, const void** parts, const u64* sizes, u32 partCount) {
+    #ifdef _WIN32
+    for (u32 i = 0; i < partCount; i++) {
+        const u8* data = (const u8*)parts[i];
+        u64 left = sizes[i];
+
+        while (left > 0) {
+            int chunk = left > 0x40000000 ? 0x40000000 : (int)left;
+            int written = _write(writer->fd, data, chunk);
+            if (written <= 0)
+                panic("The tar stream could not be written to.");
+
+            data += written;
+            left -= written;
+        }
+        writer->bytesWritten += sizes[i];
+    }
+    #else
+    struct iovec iov[4];
+    u32 iovCount = 0;
+
+    for (u32 i = 0; i < partCount; i++) {
+        if (sizes[i] == 0)
+            continue;
+
+        iov[iovCount].iov_base = (void*)parts[i];
+        iov[iovCount].iov_len = sizes[i];
+        iovCount++;
+    }
+
+    struct iovec* next = iov;
+    while (iovCount > 0) {
+        ssize_t written = writev(writer->fd, next, iovCount);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            panic("The tar stream could not be written to.");
+        }
+
+        writer->bytesWritten += written;
+
+        // Skip what went out; a short write resumes mid-part
+        while (iovCount > 0 && (size_t)written >= next->iov_len) {
+            written -= next->iov_len;
+            next++;
+            iovCount--;
+        }
+        if (iovCount > 0) {
+            next->iov_base = (u8*)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+    #endif
+}
+
+// Octal, zero padded & NUL terminated, as ustar stores numbers.
+void I_TarOctal(char* field, u32 fieldSize, u64 value) {
+    field[fieldSize - 1] = '\0';
+
+    for (int i = fieldSize - 2; i >= 0; i--) {
+        field[i] = '0' + (value & 7);
+        value >>= 3;
+    }
+}
+
+void I_TarFillHeader(TarHeader* header, char typeflag, u64 size, u32 mtime) {
+    memset(header, 0, sizeof(TarHeader));
+
+    I_TarOctal(header->mode, sizeof(header->mode), 0644);
+    I_TarOctal(header->uid, sizeof(header->uid), 0);
+    I_TarOctal(header->gid, sizeof(header->gid), 0);
+    I_TarOctal(header->size, sizeof(header->size), size);
+    I_TarOctal(header->mtime, sizeof(header->mtime), mtime);
+    header->typeflag = typeflag;
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+}
+
+void I_TarFinishHeader(TarHeader* header) {
+    // Summed with the checksum field itself taken as spaces
+    memset(header->checksum, ' ', sizeof(header->checksum));
+
+    u32 sum = 0;
+    for (u32 i = 0; i < sizeof(TarHeader); i++)
+        sum += ((const u8*)header)[i];
+
+    I_TarOctal(header->checksum, 7, sum);
+    header->checksum[7] = ' ';
+}
+
+// Splits path over prefix & name at a '/'; FALSE if it can't fit.
+int I_TarSplitPath(TarHeader* header, const char* path) {
+    u64 length = strlen(path);
+
+    if (length <= sizeof(header->name)) {
+        memcpy(header->name, path, length);
+        return TRUE;
+    }
+
+    for (u64 split = length - 1; split > 0; split--) {
+        if (path[split] != '/')
+            continue;
+        if (length - split - 1 > sizeof(header->name))
+            break;
+        if (split > sizeof(header->prefix))
+            continue;
+
+        memcpy(header->prefix, path, split);
+        memcpy(header->name, path + split + 1, length - split - 1);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+void TarAddFile(TarWriter* writer, const char* path, const void* data, u64 size, u32 mtime) {
+    if (size > 077777777777ull)
+        panic("A member is too large for a tar archive.");
+
+    TarHeader header;
+    I_TarFillHeader(&header, '0', size, mtime);
+
+    if (!I_TarSplitPath(&header, path)) {
+        // pax "path" record: "<length> path=<path>\n", length counting itself
+        u64 pathLength = strlen(path);
+        u64 baseLength = pathLength + 7;
+
+        // Adding the length's own digits can carry into one more digit
+        u64 recordLength = baseLength;
+        for (u64 n = baseLength; n > 0; n /= 10)
+            recordLength++;
+
+        u64 digits = 0;
+        for (u64 n = recordLength; n > 0; n /= 10)
+            digits++;
+        recordLength = baseLength + digits;
+
+        char* record = (char*)malloc(recordLength + 1);
+        if (record == NULL)
+            PANIC_MALLOC("tar pax record");
+
+        snprintf(record, recordLength + 1, "%lu path=%s\n", recordLength, path);
+
+        TarHeader paxHeader;
+        I_TarFillHeader(&paxHeader, 'x', recordLength, mtime);
+        snprintf(paxHeader.name, sizeof(paxHeader.name), "PaxHeaders/%.80s", getFilename(path));
+        I_TarFinishHeader(&paxHeader);
+
+        const void* parts[] = { &paxHeader, record, tarZeroBlock };
+        u64 sizes[] = {
+            TAR_BLOCK_SIZE, recordLength,
+            (TAR_BLOCK_SIZE - recordLength % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE
+        };
+        I_TarWriteParts(writer, parts, sizes, 3);
+
+        free(record);
+
+        // The ustar name is only a fallback for readers without pax
+        memcpy(header.name, path + pathLength - sizeof(header.name), sizeof(header.name));
+    }
+
+    I_TarFinishHeader(&header);
+
+    const void* parts[] = { &header, data, tarZeroBlock };
+    u64 sizes[] = {
+        TAR_BLOCK_SIZE, size,
+        (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE
+    };
+    I_TarWriteParts(writer, parts, sizes, 3);
+}
+
+// The end-of-archive marker: two zero blocks.
+void TarEnd(TarWriter* writer) {
+    const void* parts[] = { tarZeroBlock, tarZeroBlock };
+    u64 sizes[] = { TAR_BLOCK_SIZE, TAR_BLOCK_SIZE };
+
+    I_TarWriteParts(writer, parts, sizes, 2);
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include "ctrtools.h"
+
+#include "common.h"
+
+/*
+    Bump allocator for state that lives exactly as long as one command: build
+    file lists, names, member data & decompressed archives. Allocations are
+    carved out of large blocks & never freed one by one; ArenaFree releases
+    everything at once.
+
+    Requests bigger than a quarter of a block get a block of their own, so a
+    large archive doesn't waste the rest of a shared one.
+*/
+
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock {
+    ArenaBlock* next;
+
+    u64 used;
+    u64 capacity;
+
+    u64 _pad; // Keeps the data behind the header ARENA_ALIGN-aligned
+};
+
+typedef struct {
+    ArenaBlock* head; // Block being filled; older blocks follow
+
+    u64 allocated; // Bytes handed out
+    u64 reserved; // Bytes in blocks
+} Arena;
+
+void ArenaInit(Arena* arena) {
+    arena->head = NULL;
+
+    arena->allocated = 0;
+    arena->reserved = 0;
+}
+
+ArenaBlock* I_ArenaNewBlock(Arena* arena, u64 capacity) {
+    ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + capacity);
+    if (block == NULL)
+        PANIC_MALLOC("arena block");
+
+    block->used = 0;
+    block->capacity = capacity;
+
+    arena->reserved += capacity;
+
+    return block;
+}
+
+void* ArenaAlloc(Arena* arena, u64 size) {
+    size = (size + ARENA_ALIGN - 1) & ~(u64)(ARENA_ALIGN - 1);
+    if (size == 0)
+        size = ARENA_ALIGN;
+
+    arena->allocated += size;
+
+    // Oversized: own block, linked behind the current one so the current
+    // block keeps filling
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        ArenaBlock* block = I_ArenaNewBlock(arena, size);
+        block->used = size;
+
+        if (arena->head) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+        }
+        else {
+            block->next = NULL;
+            arena->head = block;
+        }
+
+        return block + 1;
+    }
+
+    ArenaBlock* block = arena->head;
+    if (block == NULL || block->capacity - block->used < size) {
+        block = I_ArenaNewBlock(arena, ARENA_BLOCK_SIZE);
+
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void* ptr = (u8*)(block + 1) + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+char* ArenaStrdup(Arena* arena, const char* str) {
+    u64 length = strlen(str) + 1;
+
+    char* copy = (char*)ArenaAlloc(arena, length);
+    memcpy(copy, str, length);
+
+    return copy;
+}
+
+void ArenaFree(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    ArenaInit(arena);
+}
+
+void* I_ArenaAllocatorAlloc(void* user, size_t size) {
+    return ArenaAlloc((Arena*)user, size);
+}
+
+void I_ArenaAllocatorFree(void* user, void* ptr) {
+    // Released with the arena
+}
+
+// libctrtools allocator drawing from the arena.
+CtrAllocator ArenaGetAllocator(Arena* arena) {
+    CtrAllocator allocator;
+    allocator.alloc = I_ArenaAllocatorAlloc;
+    allocator.free = I_ArenaAllocatorFree;
+    allocator.user = arena;
+
+    return allocator;
+}
+
+#endif
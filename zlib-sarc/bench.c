@@ -0,0 +1,411 @@
+#define _GNU_SOURCE // nftw
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ftw.h>
+
+#include "zlibProcess.h"
+#include "sarcProcess.h"
+
+#include "listWriter.h"
+
+#include "common.h"
+
+// Reproducible benchmark for the SARC pipeline. Every corpus is generated
+// from a fixed seed, so results are comparable between builds & machines.
+//
+// Output is one TSV row per corpus and operation:
+//   corpus  op  files  bytes  runs  median_ms  mib_s
+
+#define BENCH_RUNS 3
+
+typedef struct {
+    const char* name;
+
+    u32 fileCount;
+    u32 minSize;
+    u32 maxSize;
+
+    int bigEndian;
+} BenchCorpus;
+
+static const BenchCorpus corpora[] = {
+    { "small-le", 4096, 16, 2048, FALSE },
+    { "small-be", 4096, 16, 2048, TRUE },
+    { "large-le", 8, 512 * 1024, 1024 * 1024, FALSE },
+    { "large-be", 8, 512 * 1024, 1024 * 1024, TRUE }
+};
+
+static const char* const benchWords[] = {
+    "pane", "group", "anim", "layout", "texture", "material", "window",
+    "0000", "ffff", "\x01\x02\x03\x04", "\x3f\x80\x7f\x01", "RLPA", "FLYT"
+};
+
+// A standard big endian SARC, written out by hand rather than through
+// SarcToBigEndian: "a.txt" ("hello") at name offset 0 & "b/c.bin"
+// ("world!!"), each node's name attribute one u32 (01 00 hi lo).
+static const u8 benchBigEndianSarc[] = {
+    0x53, 0x41, 0x52, 0x43, 0x00, 0x14, 0xFE, 0xFF, 0x00, 0x00, 0x00, 0x70,
+    0x00, 0x00, 0x00, 0x60, 0x01, 0x00, 0x00, 0x00, 0x53, 0x46, 0x41, 0x54,
+    0x00, 0x0C, 0x00, 0x02, 0x00, 0x00, 0x00, 0x65, 0x5C, 0x89, 0x7A, 0xA7,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05,
+    0x8E, 0x34, 0xAB, 0x23, 0x01, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x08,
+    0x00, 0x00, 0x00, 0x0F, 0x53, 0x46, 0x4E, 0x54, 0x00, 0x08, 0x00, 0x00,
+    0x61, 0x2E, 0x74, 0x78, 0x74, 0x00, 0x00, 0x00, 0x62, 0x2F, 0x63, 0x2E,
+    0x62, 0x69, 0x6E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x68, 0x65, 0x6C, 0x6C, 0x6F, 0x00, 0x00, 0x00, 0x77, 0x6F, 0x72, 0x6C,
+    0x64, 0x21, 0x21, 0x00,
+};
+
+// Checked before anything is timed, so a reader that only handles the
+// tool's own output can't pass the big endian corpora unnoticed.
+void BenchCheckBigEndianSarc(void) {
+    static const char* const names[] = { "a.txt", "b/c.bin" };
+    static const char* const contents[] = { "hello", "world!!" };
+
+    CtrSarc* sarc = SarcOpen(benchBigEndianSarc, sizeof(benchBigEndianSarc));
+
+    for (u32 i = 0; i < 2; i++) {
+        u32 index;
+        if (CtrSarcFind(sarc, names[i], &index) != CTR_OK)
+            panic("Big endian fixture: member not found");
+
+        CtrSarcEntry entry = SarcGetEntry(sarc, index);
+        if (
+            entry.name == NULL || strcmp(entry.name, names[i]) != 0 ||
+            entry.size != strlen(contents[i]) || memcmp(entry.data, contents[i], entry.size) != 0
+        )
+            panic("Big endian fixture: member read back wrong");
+    }
+
+    CtrSarcClose(sarc);
+}
+
+typedef struct {
+    u32 state;
+} BenchRandom;
+
+static inline u32 BenchNext(BenchRandom* random) {
+    u32 x = random->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return random->state = x;
+}
+
+// Mixes dictionary words (compressible) with short runs of noise.
+void BenchFillData(BenchRandom* random, u8* data, u32 size) {
+    u32 i = 0;
+    while (i < size) {
+        u32 choice = BenchNext(random);
+
+        if ((choice & 7) == 0) {
+            u32 noise = 1 + (choice >> 8) % 16;
+            for (; noise && i < size; noise--)
+                data[i++] = (u8)BenchNext(random);
+            continue;
+        }
+
+        const char* word = benchWords[(choice >> 3) % (sizeof(benchWords) / sizeof(benchWords[0]))];
+        for (u32 j = 0; word[j] && i < size; j++)
+            data[i++] = (u8)word[j];
+    }
+}
+
+SarcBuildFile* BenchGenerateFiles(const BenchCorpus* corpus, u64* totalSizeOut) {
+    BenchRandom random = { 0x9E3779B9 };
+
+    SarcBuildFile* files = (SarcBuildFile*)malloc(sizeof(SarcBuildFile) * corpus->fileCount);
+    if (!files)
+        PANIC_MALLOC("bench files");
+
+    u64 totalSize = 0;
+    for (u32 i = 0; i < corpus->fileCount; i++) {
+        SarcBuildFile* file = files + i;
+
+        static const char* const dirs[] = { "anim", "blyt", "timg", "font" };
+
+        char name[64];
+        snprintf(
+            name, sizeof(name), "%s/bench_%05u.bin",
+            dirs[i % 4], i
+        );
+
+        file->name = strdup(name);
+        file->dataSize =
+            corpus->minSize + BenchNext(&random) % (corpus->maxSize - corpus->minSize + 1);
+        file->data = (u8*)malloc(file->dataSize);
+        if (!file->name || !file->data)
+            PANIC_MALLOC("bench file");
+        file->nil = 0;
+
+        BenchFillData(&random, file->data, file->dataSize);
+
+        totalSize += file->dataSize;
+    }
+
+    *totalSizeOut = totalSize;
+    return files;
+}
+
+int BenchCompareDouble(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+
+    return (da > db) - (da < db);
+}
+
+void BenchReport(const BenchCorpus* corpus, const char* op, u64 bytes, double* times) {
+    qsort(times, BENCH_RUNS, sizeof(double), BenchCompareDouble);
+    double median = times[BENCH_RUNS / 2];
+
+    printf(
+        "%s\t%s\t%u\t%lu\t%u\t%.3f\t%.1f\n",
+        corpus->name, op, corpus->fileCount, bytes, BENCH_RUNS,
+        median * 1000.0, median > 0.0 ? bytes / (1024.0 * 1024.0) / median : 0.0
+    );
+    fflush(stdout);
+}
+
+ZlibResult BenchConstruct(SarcBuildFile* files, const BenchCorpus* corpus) {
+    SarcBuildResult sarc = SarcBuild(files, corpus->fileCount);
+    if (corpus->bigEndian)
+        SarcToBigEndian(sarc.ptr, sarc.size);
+
+    ZlibResult zlibBin = compressData(sarc.ptr, sarc.size, CTR_CODEC_ZLIB, Z_BEST_COMPRESSION);
+
+    free(sarc.ptr);
+    return zlibBin;
+}
+
+void BenchList(const CtrSarc* sarc, FILE* fpNull) {
+    static const char* const columns[] = { "name", "hash", "offset", "size" };
+
+    ListWriter writer;
+    ListBegin(&writer, fpNull, LIST_FORMAT_NDJSON, columns, 4);
+
+    u16 nodeCount = CtrSarcGetEntryCount(sarc);
+    for (u16 i = 0; i < nodeCount; i++) {
+        CtrSarcEntry entry = SarcGetEntry(sarc, i);
+
+        ListRecordBegin(&writer);
+        ListFieldString(&writer, "name", entry.name);
+        ListFieldHex32(&writer, "hash", entry.nameHash);
+        ListFieldU64(&writer, "offset", entry.offset);
+        ListFieldU64(&writer, "size", entry.size);
+        ListRecordEnd(&writer);
+    }
+
+    ListEnd(&writer);
+}
+
+// Whole-buffer deflate & inflate of the raw SARC, through stock zlib & then
+// through the library's backend (libdeflate in a USE_LIBDEFLATE=1 build).
+// The backend's output must inflate with stock zlib, as on the console.
+void BenchZlibBackends(const BenchCorpus* corpus, const u8* sarc, u32 sarcSize) {
+    double times[BENCH_RUNS];
+    char op[64];
+
+    uLongf zlibMaxSize = compressBound(sarcSize);
+    u8* zlibBuffer = (u8*)malloc(zlibMaxSize);
+    u8* inflated = (u8*)malloc(sarcSize);
+    if (!zlibBuffer || !inflated)
+        PANIC_MALLOC("bench zlib buffers");
+
+    uLongf zlibSize;
+    for (u32 run = 0; run < BENCH_RUNS; run++) {
+        double start = getTimeSeconds();
+
+        zlibSize = zlibMaxSize;
+        if (compress2(zlibBuffer, &zlibSize, sarc, sarcSize, Z_BEST_COMPRESSION) != Z_OK)
+            panic("zlib compress2 failed");
+
+        times[run] = getTimeSeconds() - start;
+    }
+    BenchReport(corpus, "deflate-zlib", sarcSize, times);
+
+    for (u32 run = 0; run < BENCH_RUNS; run++) {
+        double start = getTimeSeconds();
+
+        uLongf inflatedSize = sarcSize;
+        if (uncompress(inflated, &inflatedSize, zlibBuffer, zlibSize) != Z_OK || inflatedSize != sarcSize)
+            panic("zlib uncompress failed");
+
+        times[run] = getTimeSeconds() - start;
+    }
+    BenchReport(corpus, "inflate-zlib", sarcSize, times);
+
+    if (strcmp(CtrZlibBackend(), "zlib") != 0) {
+        void* compressed = NULL;
+        size_t compressedSize;
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            free(compressed);
+
+            double start = getTimeSeconds();
+
+            CtrStatus status = CtrZlibCompress(
+                NULL, sarc, sarcSize, Z_BEST_COMPRESSION, &compressed, &compressedSize
+            );
+            if (status != CTR_OK)
+                panic(CtrStatusString(status));
+
+            times[run] = getTimeSeconds() - start;
+        }
+        snprintf(op, sizeof(op), "deflate-%s", CtrZlibBackend());
+        BenchReport(corpus, op, sarcSize, times);
+
+        uLongf inflatedSize = sarcSize;
+        if (
+            uncompress(inflated, &inflatedSize, (u8*)compressed + 4, compressedSize - 4) != Z_OK ||
+            inflatedSize != sarcSize || memcmp(inflated, sarc, sarcSize) != 0
+        )
+            panic("Backend output does not inflate with zlib");
+
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            CtrStatus status = CtrZlibDecompressInto(NULL, compressed, compressedSize, inflated, sarcSize);
+            if (status != CTR_OK)
+                panic(CtrStatusString(status));
+
+            times[run] = getTimeSeconds() - start;
+        }
+        snprintf(op, sizeof(op), "inflate-%s", CtrZlibBackend());
+        BenchReport(corpus, op, sarcSize, times);
+
+        // Ratio next to the timings, without adding a TSV column
+        fprintf(
+            stderr, "%s: zlib %lu bytes, %s %lu bytes\n",
+            corpus->name, (u64)zlibSize, CtrZlibBackend(), (u64)compressedSize - 4
+        );
+
+        free(compressed);
+    }
+
+    free(inflated);
+    free(zlibBuffer);
+}
+
+// Mirrors the extract command: directory tree, then one file per member.
+void BenchExtract(const CtrSarc* sarc, const char* outputPath) {
+    u16 nodeCount = CtrSarcGetEntryCount(sarc);
+    for (u16 i = 0; i < nodeCount; i++) {
+        CtrSarcEntry entry = SarcGetEntry(sarc, i);
+        const char* name = entry.name;
+
+        char nbuf[1024];
+        snprintf(nbuf, sizeof(nbuf), "%s" PATH_SEPARATOR_S "%.*s",
+            outputPath, (int)(getFilename(name) - name), name);
+        createDirectoryTree(nbuf);
+
+        snprintf(nbuf, sizeof(nbuf), "%s" PATH_SEPARATOR_S "%s", outputPath, name);
+
+        FILE* fpOut = fopen(nbuf, "wb");
+        if (fpOut == NULL)
+            panic("The output binary could not be opened.");
+
+        if (fwrite(entry.data, 1, entry.size, fpOut) != entry.size)
+            panic("The output binary could not be written to.");
+
+        fclose(fpOut);
+    }
+}
+
+int I_BenchRemoveEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    return remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    logStream = stderr;
+    logLevel = LOG_LEVEL_QUIET;
+
+    FILE* fpNull = fopen("/dev/null", "wb");
+    if (fpNull == NULL)
+        panic("Could not open /dev/null");
+
+    char tempDir[] = "/tmp/zlib-sarc-bench-XXXXXX";
+    if (mkdtemp(tempDir) == NULL)
+        panic("Could not create a temporary directory");
+
+    BenchCheckBigEndianSarc();
+
+    printf("corpus\top\tfiles\tbytes\truns\tmedian_ms\tmib_s\n");
+
+    for (u32 c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        const BenchCorpus* corpus = corpora + c;
+        double times[BENCH_RUNS];
+
+        u64 totalSize;
+        SarcBuildFile* files = BenchGenerateFiles(corpus, &totalSize);
+
+        ZlibResult zlibBin;
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            zlibBin = BenchConstruct(files, corpus);
+
+            times[run] = getTimeSeconds() - start;
+
+            if (run + 1 != BENCH_RUNS)
+                free(zlibBin.ptr);
+        }
+        BenchReport(corpus, "construct", totalSize, times);
+
+        ZlibResult sarcBin;
+        CtrSarc* sarc;
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            sarcBin = decompressData(zlibBin.ptr, zlibBin.size, NULL);
+            sarc = SarcOpen(sarcBin.ptr, sarcBin.size);
+
+            times[run] = getTimeSeconds() - start;
+
+            if (run + 1 != BENCH_RUNS) {
+                CtrSarcClose(sarc);
+                free(sarcBin.ptr);
+            }
+        }
+        BenchReport(corpus, "decode", sarcBin.size, times);
+
+        BenchZlibBackends(corpus, sarcBin.ptr, sarcBin.size);
+
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            BenchList(sarc, fpNull);
+
+            times[run] = getTimeSeconds() - start;
+        }
+        BenchReport(corpus, "list", sarcBin.size, times);
+
+        for (u32 run = 0; run < BENCH_RUNS; run++) {
+            double start = getTimeSeconds();
+
+            BenchExtract(sarc, tempDir);
+
+            times[run] = getTimeSeconds() - start;
+
+            nftw(tempDir, I_BenchRemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+            createDirectory(tempDir);
+        }
+        BenchReport(corpus, "extract", totalSize, times);
+
+        CtrSarcClose(sarc);
+        free(sarcBin.ptr);
+        free(zlibBin.ptr);
+
+        for (u32 i = 0; i < corpus->fileCount; i++) {
+            free(files[i].name);
+            free(files[i].data);
+        }
+        free(files);
+    }
+
+    nftw(tempDir, I_BenchRemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    fclose(fpNull);
+
+    return 0;
+}
@@ -0,0 +1,448 @@
+#ifndef CONSTRUCTINPUT_H
+#define CONSTRUCTINPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "arena.h"
+#include "tarWriter.h"
+#include "stats.h"
+
+#include "common.h"
+
+// Inputs for construct: an archive name for each member & either a path to
+// read it from later, or its data already. They come from argv, from a
+// manifest (one "<path>" or "<path>\t<name>" per line), from a tar stream,
+// whose members are read in order straight into arena buffers that go into
+// the build as they are (nothing is staged on disk), or from a directory walk
+// (dirWalk.h). Either list may be "-" for stdin, so very large file sets
+// never pass through argv.
+
+typedef struct {
+    char* name; // Path in the archive
+    char* path; // On disk; NULL for tar members
+    // Set up front for tar members & walked directories, else read on use
+
+    u8* data;
+    u32 dataSize;
+
+    int fromArgv; // Unexpanded globs are only possible here
+} ConstructInput;
+
+typedef struct {
+    ConstructInput* inputs;
+    u32 count;
+    u32 capacity;
+} ConstructInputList;
+
+StatsPhase statsStreamRead = { "input stream read" };
+
+void ConstructInputListInit(ConstructInputList* list) {
+    list->inputs = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void ConstructInputListFree(ConstructInputList* list) {
+    free(list->inputs);
+    ConstructInputListInit(list);
+}
+
+ConstructInput* I_ConstructInputAppend(ConstructInputList* list) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->inputs = (ConstructInput*)realloc(list->inputs, sizeof(ConstructInput) * list->capacity);
+        if (list->inputs == NULL)
+            PANIC_MALLOC("construct input list");
+    }
+
+    ConstructInput* input = list->inputs + list->count++;
+    memset(input, 0, sizeof(ConstructInput));
+
+    return input;
+}
+
+// name may be NULL to derive it from path as argv inputs are.
+void ConstructAddPath(ConstructInputList* list, const char* path, const char* name, int fromArgv, Arena* arena) {
+    ConstructInput* input = I_ConstructInputAppend(list);
+
+    input->path = ArenaStrdup(arena, path);
+    input->fromArgv = fromArgv;
+
+    if (name)
+        input->name = ArenaStrdup(arena, name);
+    else {
+        char sarcPath[512];
+        OSPathToSarcPath(input->path, sarcPath);
+
+        input->name = ArenaStrdup(arena, sarcPath);
+    }
+}
+
+// For data already read; path may be NULL. Strings & data are kept as given.
+void ConstructAddData(ConstructInputList* list, char* name, char* path, u8* data, u32 dataSize) {
+    ConstructInput* input = I_ConstructInputAppend(list);
+
+    input->name = name;
+    input->path = path;
+    input->data = data;
+    input->dataSize = dataSize;
+}
+
+typedef struct {
+    const char* name;
+    u32 index;
+} I_ConstructNameIndex;
+
+int I_ConstructNameIndexCompare(const void* a, const void* b) {
+    const I_ConstructNameIndex* nameA = (const I_ConstructNameIndex*)a;
+    const I_ConstructNameIndex* nameB = (const I_ConstructNameIndex*)b;
+
+    int order = strcmp(nameA->name, nameB->name);
+    if (order != 0)
+        return order;
+
+    return (nameA->index > nameB->index) - (nameA->index < nameB->index);
+}
+
+// A name given more than once (a walked directory & a manifest line for the
+// same file, overlapping roots, a tar stream repeating a member) keeps its
+// last occurrence, as tar extraction would; the others are dropped with a
+// warning. Inputs that remain keep their order.
+void ConstructDropDuplicates(ConstructInputList* list) {
+    if (list->count < 2)
+        return;
+
+    I_ConstructNameIndex* names = (I_ConstructNameIndex*)malloc(sizeof(I_ConstructNameIndex) * list->count);
+    u8* dropped = (u8*)calloc(list->count, sizeof(u8));
+    if (names == NULL || dropped == NULL)
+        PANIC_MALLOC("construct name index");
+
+    for (u32 i = 0; i < list->count; i++) {
+        names[i].name = list->inputs[i].name;
+        names[i].index = i;
+    }
+
+    qsort(names, list->count, sizeof(I_ConstructNameIndex), I_ConstructNameIndexCompare);
+
+    u32 droppedCount = 0;
+    for (u32 i = 0; i + 1 < list->count; i++) {
+        if (strcmp(names[i].name, names[i + 1].name) != 0)
+            continue;
+
+        LOG_WARN("Warning: %s is given more than once; only the last one is kept.\n", names[i].name);
+
+        dropped[names[i].index] = TRUE;
+        droppedCount++;
+    }
+
+    if (droppedCount > 0) {
+        u32 kept = 0;
+        for (u32 i = 0; i < list->count; i++) {
+            if (!dropped[i])
+                list->inputs[kept++] = list->inputs[i];
+        }
+        list->count = kept;
+    }
+
+    free(dropped);
+    free(names);
+}
+
+// Archive name for a path relative to a construct root: '/' separated with
+// no empty, "." or leading components. FALSE if it leaves the root ("..").
+int ConstructNormalizeName(const char* path, char* out, u32 outSize) {
+    u32 length = 0;
+
+    while (*path) {
+        const char* end = path;
+        while (*end && *end != '/' && *end != PATH_SEPARATOR_C)
+            end++;
+
+        u32 componentLength = end - path;
+
+        if (componentLength == 2 && path[0] == '.' && path[1] == '.')
+            return FALSE;
+
+        if (componentLength > 0 && !(componentLength == 1 && path[0] == '.')) {
+            if (length + (length > 0) + componentLength + 1 > outSize)
+                return FALSE;
+
+            if (length > 0)
+                out[length++] = '/';
+
+            memcpy(out + length, path, componentLength);
+            length += componentLength;
+        }
+
+        path = *end ? end + 1 : end;
+    }
+
+    out[length] = '\0';
+    return TRUE;
+}
+
+FILE* I_ConstructOpenList(const char* path, const char* what) {
+    if (strcmp(path, "-") == 0) {
+        #ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        #endif
+
+        return stdin;
+    }
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        LOG_ERROR("Error: the %s (%s) could not be opened.\n", what, path);
+        panic("Input list open failed");
+    }
+
+    return fp;
+}
+
+// Blank lines & lines starting with '#' are skipped. Paths are taken as
+// given, relative to the working directory.
+void ConstructReadManifest(ConstructInputList* list, const char* manifestPath, Arena* arena) {
+    FILE* fp = I_ConstructOpenList(manifestPath, "manifest");
+
+    char line[4096];
+    u32 lineNumber = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        lineNumber++;
+
+        u64 length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n' && !feof(fp)) {
+            LOG_ERROR("Error: manifest line %u is too long.\n", lineNumber);
+            panic("Manifest read failed");
+        }
+
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+
+        if (length == 0 || line[0] == '#')
+            continue;
+
+        char* name = strchr(line, '\t');
+        if (name)
+            *name++ = '\0';
+
+        if (line[0] == '\0' || (name && name[0] == '\0')) {
+            LOG_ERROR("Error: manifest line %u has an empty path or name.\n", lineNumber);
+            panic("Manifest read failed");
+        }
+
+        char normalName[sizeof(line)];
+        if (name && !ConstructNormalizeName(name, normalName, sizeof(normalName))) {
+            LOG_ERROR("Error: manifest line %u names a path outside the archive (%s).\n", lineNumber, name);
+            panic("Manifest read failed");
+        }
+
+        ConstructAddPath(list, line, name ? normalName : NULL, FALSE, arena);
+    }
+
+    if (ferror(fp))
+        panic("Manifest read failed");
+
+    if (fp != stdin)
+        fclose(fp);
+}
+
+void I_ConstructTarRead(FILE* fp, void* buffer, u64 size) {
+    if (fread(buffer, 1, size, fp) != size)
+        panic("The tar stream is truncated.");
+}
+
+void I_ConstructTarSkip(FILE* fp, u64 size) {
+    u8 block[TAR_BLOCK_SIZE];
+
+    while (size > 0) {
+        u64 chunk = size < TAR_BLOCK_SIZE ? size : TAR_BLOCK_SIZE;
+        I_ConstructTarRead(fp, block, chunk);
+        size -= chunk;
+    }
+}
+
+// Octal with optional spaces or NULs around it, or GNU base-256.
+u64 I_ConstructTarNumber(const char* field, u32 fieldSize) {
+    const u8* bytes = (const u8*)field;
+    u64 value = 0;
+
+    if (bytes[0] & 0x80) {
+        for (u32 i = 1; i < fieldSize; i++)
+            value = (value << 8) | bytes[i];
+        return value;
+    }
+
+    u32 i = 0;
+    while (i < fieldSize && bytes[i] == ' ')
+        i++;
+    for (; i < fieldSize && bytes[i] >= '0' && bytes[i] <= '7'; i++)
+        value = (value << 3) | (bytes[i] - '0');
+
+    return value;
+}
+
+int I_ConstructTarChecksumOk(const TarHeader* header) {
+    u32 sum = 0;
+    for (u32 i = 0; i < sizeof(TarHeader); i++) {
+        u32 offset = (u32)offsetof(TarHeader, checksum);
+        sum += i >= offset && i < offset + sizeof(header->checksum) ? ' ' : ((const u8*)header)[i];
+    }
+
+    return sum == I_ConstructTarNumber(header->checksum, sizeof(header->checksum));
+}
+
+// Copies a header field that is only NUL terminated when it is short.
+void I_ConstructTarField(char* out, const char* field, u32 fieldSize) {
+    u32 length = 0;
+    while (length < fieldSize && field[length])
+        length++;
+
+    memcpy(out, field, length);
+    out[length] = '\0';
+}
+
+// Takes "path" out of pax records ("<length> <key>=<value>\n").
+void I_ConstructTarPax(const char* records, u64 size, char** pathOut, Arena* arena) {
+    u64 offset = 0;
+
+    while (offset < size) {
+        u64 length = 0;
+        u64 i = offset;
+        while (i < size && records[i] >= '0' && records[i] <= '9')
+            length = length * 10 + (records[i++] - '0');
+
+        if (length == 0 || offset + length > size || i >= size || records[i] != ' ')
+            panic("The tar stream has a malformed pax header.");
+
+        const char* key = records + i + 1;
+        const char* end = records + offset + length - 1; // The newline
+
+        if (end - key > 5 && memcmp(key, "path=", 5) == 0) {
+            u64 valueLength = end - (key + 5);
+
+            *pathOut = (char*)ArenaAlloc(arena, valueLength + 1);
+            memcpy(*pathOut, key + 5, valueLength);
+            (*pathOut)[valueLength] = '\0';
+        }
+
+        offset += length;
+    }
+}
+
+// Regular files become inputs named by their path in the stream, less any
+// leading "./" or "/"; directories are implied by the names & anything else
+// (links, devices) is skipped with a warning.
+void ConstructReadTar(ConstructInputList* list, const char* tarPath, Arena* arena) {
+    FILE* fp = I_ConstructOpenList(tarPath, "tar stream");
+
+    double statsTime = StatsBegin();
+    u64 bytesRead = 0;
+
+    char* longName = NULL; // From a pax 'x' or GNU 'L' entry, for the next one
+
+    while (1) {
+        TarHeader header;
+        if (fread(&header, 1, TAR_BLOCK_SIZE, fp) != TAR_BLOCK_SIZE)
+            panic("The tar stream is truncated.");
+
+        bytesRead += TAR_BLOCK_SIZE;
+
+        if (memcmp(&header, tarZeroBlock, TAR_BLOCK_SIZE) == 0)
+            break;
+
+        if (!I_ConstructTarChecksumOk(&header))
+            panic("The tar stream has a bad header checksum (not a tar stream?).");
+
+        u64 size = I_ConstructTarNumber(header.size, sizeof(header.size));
+        u64 padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+        bytesRead += size + padding;
+
+        if (header.typeflag == 'x' || header.typeflag == 'L') {
+            char* records = (char*)ArenaAlloc(arena, size + 1);
+            I_ConstructTarRead(fp, records, size);
+            records[size] = '\0';
+            I_ConstructTarSkip(fp, padding);
+
+            if (header.typeflag == 'L')
+                longName = records;
+            else
+                I_ConstructTarPax(records, size, &longName, arena);
+            continue;
+        }
+
+        char* name = longName;
+        longName = NULL;
+
+        if (name == NULL) {
+            char fullName[sizeof(header.prefix) + 1 + sizeof(header.name) + 1];
+            u32 length = 0;
+
+            // Only POSIX ustar has the prefix; GNU tar keeps other fields there
+            if (memcmp(header.magic, "ustar", 6) == 0 && header.prefix[0]) {
+                I_ConstructTarField(fullName, header.prefix, sizeof(header.prefix));
+                length = strlen(fullName);
+                fullName[length++] = '/';
+            }
+            I_ConstructTarField(fullName + length, header.name, sizeof(header.name));
+
+            name = ArenaStrdup(arena, fullName);
+        }
+
+        u64 nameLength = strlen(name);
+
+        int isFile = header.typeflag == '0' || header.typeflag == '\0' || header.typeflag == '7';
+        if (!isFile || nameLength == 0 || name[nameLength - 1] == '/') {
+            if (header.typeflag != '5' && header.typeflag != 'g')
+                LOG_WARN("Warning: skipping %s, which is not a regular file.\n", name);
+
+            I_ConstructTarSkip(fp, size + padding);
+            continue;
+        }
+
+        // Same names as -C inputs: no leading "/" or "./", & nothing above the root
+        char* normalName = (char*)ArenaAlloc(arena, nameLength + 1);
+        if (!ConstructNormalizeName(name, normalName, nameLength + 1) || normalName[0] == '\0') {
+            LOG_ERROR("Error: the tar member %s is outside the archive root.\n", name);
+            panic("Invalid tar member name");
+        }
+        name = normalName;
+
+        if (size > 0xFFFFFFFF)
+            panic("A tar member is too large for a SARC archive.");
+
+        ConstructInput* input = I_ConstructInputAppend(list);
+        input->name = name;
+        input->dataSize = (u32)size;
+
+        // Read once, straight into the buffer the build takes
+        input->data = (u8*)ArenaAlloc(arena, size);
+        I_ConstructTarRead(fp, input->data, size);
+        I_ConstructTarSkip(fp, padding);
+
+        LOG_VERBOSE("Read %s from the tar stream (size: %u)\n", name, input->dataSize);
+    }
+
+    // Drain the rest (tar pads to whole records) so a writer on the other end
+    // of a pipe doesn't fail on a closed pipe
+    u8 block[TAR_BLOCK_SIZE];
+    while (fread(block, 1, TAR_BLOCK_SIZE, fp) > 0)
+        ;
+
+    StatsEnd(&statsStreamRead, statsTime, bytesRead, bytesRead);
+
+    if (fp != stdin)
+        fclose(fp);
+}
+
+#endif
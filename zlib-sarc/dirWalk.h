@@ -0,0 +1,360 @@
+#ifndef DIRWALK_H
+#define DIRWALK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ctrtools.h"
+
+#include "arena.h"
+#include "progress.h"
+#include "stats.h"
+
+#include "common.h"
+
+/*
+    Recursive directory input for construct, in two passes over a pool of
+    DIRWALK_THREADS threads (CtrRunThreads; the calling thread is one):
+
+    1. Traversal: directories are taken off a shared queue. A worker lists
+       one whole directory, stats its entries relative to the open directory
+       & only then takes the lock once to queue the subdirectories & record
+       the files with their sizes, so the full layout is known before any
+       data is read.
+    2. Reading: every file gets its arena buffer up front, then workers read
+       files into them off a shared counter.
+
+    Thread count is fixed rather than per CPU; both passes wait on the
+    filesystem far more than on the CPU. Symlinks to files are followed,
+    symlinks to directories are not (no cycles). Files come out sorted by
+    name, whatever order the threads finished in.
+*/
+
+#define DIRWALK_THREADS 8
+
+typedef struct {
+    char* path; // On disk
+    char* name; // Relative to the walk's root, '/' separated
+
+    u64 size;
+    u8* data;
+} DirWalkFile;
+
+typedef struct {
+    char* path;
+    char* name; // "" for a root
+} DirWalkDir;
+
+typedef struct {
+    Arena* arena; // Only used under lock
+
+    DirWalkFile* files;
+    u32 fileCount;
+    u32 fileCapacity;
+
+    DirWalkDir* queue;
+    u32 queueCount;
+    u32 queueCapacity;
+
+    u32 busyWorkers; // Listing a directory, so the queue may still grow
+
+    u32 nextRead; // Atomic
+    Progress* progress;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queueChanged;
+} DirWalk;
+
+StatsPhase statsDirWalk = { "directory walk" };
+StatsPhase statsDirRead = { "directory file read" };
+
+void DirWalkInit(DirWalk* walk, Arena* arena) {
+    memset(walk, 0, sizeof(DirWalk));
+    walk->arena = arena;
+
+    pthread_mutex_init(&walk->lock, NULL);
+    pthread_cond_init(&walk->queueChanged, NULL);
+}
+
+void DirWalkFree(DirWalk* walk) {
+    free(walk->files);
+    free(walk->queue);
+
+    pthread_mutex_destroy(&walk->lock);
+    pthread_cond_destroy(&walk->queueChanged);
+}
+
+// Both strings are copied into the arena. Callers hold the lock once the
+// walk has started.
+void I_DirWalkQueueDir(DirWalk* walk, const char* path, const char* name) {
+    if (walk->queueCount == walk->queueCapacity) {
+        walk->queueCapacity = walk->queueCapacity ? walk->queueCapacity * 2 : 64;
+        walk->queue = (DirWalkDir*)realloc(walk->queue, sizeof(DirWalkDir) * walk->queueCapacity);
+        if (walk->queue == NULL)
+            PANIC_MALLOC("directory queue");
+    }
+
+    DirWalkDir* dir = walk->queue + walk->queueCount++;
+    dir->path = ArenaStrdup(walk->arena, path);
+    dir->name = ArenaStrdup(walk->arena, name);
+}
+
+void I_DirWalkAddFile(DirWalk* walk, const char* path, const char* name, u64 size) {
+    if (walk->fileCount == walk->fileCapacity) {
+        walk->fileCapacity = walk->fileCapacity ? walk->fileCapacity * 2 : 256;
+        walk->files = (DirWalkFile*)realloc(walk->files, sizeof(DirWalkFile) * walk->fileCapacity);
+        if (walk->files == NULL)
+            PANIC_MALLOC("walked file list");
+    }
+
+    DirWalkFile* file = walk->files + walk->fileCount++;
+    file->path = ArenaStrdup(walk->arena, path);
+    file->name = ArenaStrdup(walk->arena, name);
+    file->size = size;
+    file->data = NULL;
+}
+
+// Queues a directory to walk; files below it are named name/... ("" for none).
+void DirWalkAddRoot(DirWalk* walk, const char* path, const char* name) {
+    I_DirWalkQueueDir(walk, path, name);
+}
+
+// Entries of one directory, gathered without the lock.
+typedef struct {
+    char* buffer; // Packed "path\0name\0" pairs
+    u64 length;
+    u64 capacity;
+
+    u64* sizes; // Per file; directories carry ~0
+    u32 count;
+    u32 sizeCapacity;
+} I_DirWalkBatch;
+
+void I_DirWalkBatchPush(I_DirWalkBatch* batch, const char* path, const char* name, u64 size) {
+    u64 pathLength = strlen(path) + 1;
+    u64 nameLength = strlen(name) + 1;
+
+    if (batch->length + pathLength + nameLength > batch->capacity) {
+        while (batch->length + pathLength + nameLength > batch->capacity)
+            batch->capacity = batch->capacity ? batch->capacity * 2 : 4096;
+
+        batch->buffer = (char*)realloc(batch->buffer, batch->capacity);
+        if (batch->buffer == NULL)
+            PANIC_MALLOC("directory batch");
+    }
+    if (batch->count == batch->sizeCapacity) {
+        batch->sizeCapacity = batch->sizeCapacity ? batch->sizeCapacity * 2 : 64;
+        batch->sizes = (u64*)realloc(batch->sizes, sizeof(u64) * batch->sizeCapacity);
+        if (batch->sizes == NULL)
+            PANIC_MALLOC("directory batch");
+    }
+
+    memcpy(batch->buffer + batch->length, path, pathLength);
+    memcpy(batch->buffer + batch->length + pathLength, name, nameLength);
+    batch->length += pathLength + nameLength;
+
+    batch->sizes[batch->count++] = size;
+}
+
+void I_DirWalkList(const DirWalkDir* dir, I_DirWalkBatch* batch) {
+    DIR* handle = opendir(dir->path);
+    if (handle == NULL) {
+        LOG_ERROR("Error: the directory %s could not be opened.\n", dir->path);
+        panic("Directory walk failed");
+    }
+
+    int dirFd = dirfd(handle);
+
+    char path[4096];
+    char name[4096];
+
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        const char* entryName = entry->d_name;
+        if (strcmp(entryName, ".") == 0 || strcmp(entryName, "..") == 0)
+            continue;
+
+        if (
+            (u32)snprintf(path, sizeof(path), "%s/%s", dir->path, entryName) >= sizeof(path) ||
+            (u32)snprintf(name, sizeof(name), "%s%s%s", dir->name, dir->name[0] ? "/" : "", entryName) >= sizeof(name)
+        )
+            panic("A path in the directory walk is too long.");
+
+        // d_type saves the stat for subdirectories; files need one for the size.
+        // Some filesystems only report DT_UNKNOWN, so the entry itself is
+        // stat'ed (not what a link points to) before anything is followed.
+        if (entry->d_type == DT_DIR) {
+            I_DirWalkBatchPush(batch, path, name, ~(u64)0);
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirFd, entryName, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            LOG_WARN("Warning: skipping %s, which could not be stat'ed.\n", path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            I_DirWalkBatchPush(batch, path, name, ~(u64)0);
+            continue;
+        }
+
+        // Links are only followed to regular files
+        if (S_ISLNK(st.st_mode) && fstatat(dirFd, entryName, &st, 0) != 0) {
+            LOG_WARN("Warning: skipping %s, a dangling link.\n", path);
+            continue;
+        }
+
+        if (S_ISREG(st.st_mode))
+            I_DirWalkBatchPush(batch, path, name, (u64)st.st_size);
+        else if (S_ISDIR(st.st_mode))
+            LOG_VERBOSE("Not following the directory link %s\n", path);
+        else
+            LOG_WARN("Warning: skipping %s, which is not a regular file.\n", path);
+    }
+
+    closedir(handle);
+}
+
+void* I_DirWalkWorker(void* arg) {
+    DirWalk* walk = (DirWalk*)arg;
+
+    I_DirWalkBatch batch;
+    memset(&batch, 0, sizeof(batch));
+
+    pthread_mutex_lock(&walk->lock);
+
+    while (1) {
+        while (walk->queueCount == 0 && walk->busyWorkers > 0)
+            pthread_cond_wait(&walk->queueChanged, &walk->lock);
+
+        if (walk->queueCount == 0)
+            break;
+
+        DirWalkDir dir = walk->queue[--walk->queueCount];
+        walk->busyWorkers++;
+
+        pthread_mutex_unlock(&walk->lock);
+
+        batch.length = 0;
+        batch.count = 0;
+        I_DirWalkList(&dir, &batch);
+
+        pthread_mutex_lock(&walk->lock);
+
+        const char* cursor = batch.buffer;
+        for (u32 i = 0; i < batch.count; i++) {
+            const char* path = cursor;
+            const char* name = path + strlen(path) + 1;
+            cursor = name + strlen(name) + 1;
+
+            if (batch.sizes[i] == ~(u64)0)
+                I_DirWalkQueueDir(walk, path, name);
+            else
+                I_DirWalkAddFile(walk, path, name, batch.sizes[i]);
+        }
+
+        walk->busyWorkers--;
+        pthread_cond_broadcast(&walk->queueChanged);
+    }
+
+    pthread_cond_broadcast(&walk->queueChanged);
+    pthread_mutex_unlock(&walk->lock);
+
+    free(batch.buffer);
+    free(batch.sizes);
+
+    return NULL;
+}
+
+void* I_DirWalkReadWorker(void* arg) {
+    DirWalk* walk = (DirWalk*)arg;
+
+    while (1) {
+        u32 index = __atomic_fetch_add(&walk->nextRead, 1, __ATOMIC_RELAXED);
+        if (index >= walk->fileCount)
+            break;
+
+        DirWalkFile* file = walk->files + index;
+
+        int fd = open(file->path, O_RDONLY);
+        if (fd < 0) {
+            LOG_ERROR("Error: %s could not be opened.\n", file->path);
+            panic("Directory file read failed");
+        }
+
+        u64 done = 0;
+        while (done < file->size) {
+            ssize_t bytesRead = read(fd, file->data + done, file->size - done);
+            if (bytesRead <= 0) {
+                LOG_ERROR("Error: %s could not be read, or shrank while being read.\n", file->path);
+                panic("Directory file read failed");
+            }
+
+            done += bytesRead;
+        }
+
+        close(fd);
+
+        if (walk->progress) {
+            pthread_mutex_lock(&walk->lock);
+
+            ProgressStep(walk->progress, file->size);
+
+            pthread_mutex_unlock(&walk->lock);
+        }
+    }
+
+    return NULL;
+}
+
+int I_DirWalkCompareName(const void* a, const void* b) {
+    return strcmp(((const DirWalkFile*)a)->name, ((const DirWalkFile*)b)->name);
+}
+
+// Walks every queued root, then reads every file found into the arena.
+void DirWalkRun(DirWalk* walk) {
+    double statsTime = StatsBegin();
+
+    CtrRunThreads(NULL, DIRWALK_THREADS, I_DirWalkWorker, walk);
+
+    qsort(walk->files, walk->fileCount, sizeof(DirWalkFile), I_DirWalkCompareName);
+
+    u64 totalSize = 0;
+    for (u32 i = 0; i < walk->fileCount; i++) {
+        if (walk->files[i].size > 0xFFFFFFFF)
+            panic("A file is too large for a SARC archive.");
+
+        totalSize += walk->files[i].size;
+    }
+
+    StatsEnd(&statsDirWalk, statsTime, 0, 0);
+
+    LOG_VERBOSE("Found %u file(s), %lu bytes in total.\n", walk->fileCount, totalSize);
+
+    for (u32 i = 0; i < walk->fileCount; i++)
+        walk->files[i].data = (u8*)ArenaAlloc(walk->arena, walk->files[i].size);
+
+    Progress progress;
+    ProgressBegin(&progress, "Reading", walk->fileCount);
+    walk->progress = &progress;
+
+    statsTime = StatsBegin();
+
+    CtrRunThreads(NULL, DIRWALK_THREADS, I_DirWalkReadWorker, walk);
+
+    StatsEnd(&statsDirRead, statsTime, totalSize, totalSize);
+
+    ProgressEnd(&progress);
+    walk->progress = NULL;
+}
+
+#endif
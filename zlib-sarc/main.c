@@ -1,59 +1,124 @@
+#define _GNU_SOURCE // memfd_create, accept4, open_memstream
+
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "zlibProcess.h"
 #include "sarcProcess.h"
+#include "arena.h"
+#ifndef _WIN32
+#include "serve.h"
+#endif
+
+#include "listWriter.h"
+#include "archiveDiff.h"
+#include "tarWriter.h"
+#include "constructInput.h"
+#ifndef _WIN32
+#include "dirWalk.h"
+#endif
+#include "progress.h"
+#include "stats.h"
 
 #include "common.h"
 
 #define CHECK_OUTPUT_GIVEN() { \
     if (args.outputPath == NULL) { \
-        printf("Error: missing output path.\n\n"); \
+        LOG_ERROR("Error: missing output path.\n\n"); \
         usage(0); \
     } \
 }
 
-ZlibResult ReadZLIBFromPath(char* zlibPath) {
-    printf("Read & copy ZLIB binary ..");
+StatsPhase statsFileRead = { "file read" };
+StatsPhase statsInflate = { "decompress" };
+StatsPhase statsOpen = { "SARC open" };
+StatsPhase statsNameResolve = { "name resolution" };
+StatsPhase statsCreateDir = { "directory creation" };
+StatsPhase statsMemberWrite = { "member write" };
+StatsPhase statsBuild = { "SarcBuild" };
+StatsPhase statsDeflate = { "compressData" };
+StatsPhase statsArchiveWrite = { "archive write" };
+
+// The buffer comes from arena, or from malloc if arena is NULL.
+u8* ReadFileFromPath(const char* path, u32* sizeOut, Arena* arena) {
+    double statsTime = StatsBegin();
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        panic("The file could not be opened.");
+
+    fseek(fp, 0, SEEK_END);
+    u64 size = ftell(fp);
+    rewind(fp);
+
+    u8* buffer = arena ? (u8*)ArenaAlloc(arena, size) : (u8*)malloc(size);
+    if (buffer == NULL) {
+        fclose(fp);
+
+        PANIC_MALLOC("file buf");
+    }
 
-    FILE* fpZlib = fopen(zlibPath, "rb");
-    if (fpZlib == NULL)
-        panic("The ZLIB binary could not be opened.");
+    u64 bytesCopied = fread(buffer, 1, size, fp);
+    if (bytesCopied != size) {
+        fclose(fp);
 
-    fseek(fpZlib, 0, SEEK_END);
-    u64 compressedSize = ftell(fpZlib);
-    rewind(fpZlib);
+        panic("Buffer readin fail");
+    }
 
-    u8* compressedBuf = (u8 *)malloc(compressedSize);
-    if (compressedBuf == NULL) {
-        fclose(fpZlib);
+    fclose(fp);
 
-        PANIC_MALLOC("compressed buf");
-    }
+    StatsEnd(&statsFileRead, statsTime, size, size);
 
-    u64 bytesCopied = fread(compressedBuf, 1, compressedSize, fpZlib);
-    if (bytesCopied != compressedSize) {
-        free(compressedBuf);
-        fclose(fpZlib);
+    *sizeOut = size;
+    return buffer;
+}
 
-        panic("Buffer readin fail");
+// Tar members arrive with their data; everything else is read now.
+u8* LoadConstructInput(ConstructInput* input, u32* sizeOut, Arena* arena) {
+    if (input->data) {
+        *sizeOut = input->dataSize;
+        return input->data;
     }
 
-    fclose(fpZlib);
+    return ReadFileFromPath(input->path, sizeOut, arena);
+}
+
+// Decompresses into the arena; the compressed copy is dropped right away.
+ZlibResult ReadArchiveFromPath(char* archivePath, Arena* arena) {
+    LOG("Read & copy archive binary ..");
+
+    u32 compressedSize;
+    u8* compressedBuf = ReadFileFromPath(archivePath, &compressedSize, NULL);
 
     LOG_OK;
 
-    ZlibResult decompression = decompressZlib(compressedBuf, compressedSize);
+    double statsTime = StatsBegin();
+
+    CtrAllocator allocator = ArenaGetAllocator(arena);
+    ZlibResult decompression = decompressData(compressedBuf, compressedSize, &allocator);
+
+    StatsEnd(&statsInflate, statsTime, compressedSize, decompression.size);
 
     free(compressedBuf);
 
     return decompression;
 }
 
+CtrSarc* OpenSarc(u8* sarcData, u32 sarcSize) {
+    double statsTime = StatsBegin();
+
+    CtrSarc* sarc = SarcOpen(sarcData, sarcSize);
+
+    StatsEnd(&statsOpen, statsTime, sarcSize, 0);
+
+    return sarc;
+}
+
 void usage(int title) {
     if (title) {
         printf("ZLIB-SARC Tool v2.0\n");
-        printf("A tool for ZLIB-SARC (.zlib) archives.\n\n");
+        printf("A tool for ZLIB-SARC (.zlib) archives.\n");
+        printf("Yaz0 (.szs), LZ11/LZ13 & uncompressed SARC archives are read too.\n\n");
     }
 
     printf("Usage:\n");
@@ -61,17 +126,58 @@ void usage(int title) {
 
     printf("Commands:\n");
     printf("    extract   Extracts the contents of a ZLIB-SARC archive.\n");
-    printf("    construct Constructs a ZLIB-SARC archive from individual files.\n");
+    printf("    construct Constructs a ZLIB-SARC archive from files & directories.\n");
     printf("    list      Lists the contents for a ZLIB-SARC archive.\n");
-    printf("    raw       Export the raw SARC archive from a ZLIB-SARC archive.\n\n");
+    printf("    raw       Export the raw SARC archive from a ZLIB-SARC archive.\n");
+    printf("    diff      Lists the files added, removed or changed between two archives,\n");
+    printf("              comparing their contents in memory.\n");
+    printf("    serve     Answer LIST/GET/PNG requests for archives on a Unix socket,\n");
+    printf("              keeping recently used archives decompressed in memory.\n");
+    printf("    request   Send one request to a serve socket & write the response.\n\n");
 
     printf("Options:\n");
-    printf("    -o <path> Specifies the output path.\n");
-    printf("    -l <path> Replicate the structure of the archive specified by this path.\n\n");
+    printf("    -o <path> Specifies the output path. For extract, - streams a tar archive\n");
+    printf("              to stdout instead of writing a directory.\n");
+    printf("    -l <path> Replicate the structure of the archive specified by this path.\n");
+    printf("    -C <root> Construct inputs are relative to this directory & named by their\n");
+    printf("              path below it. Directory inputs are always walked recursively,\n");
+    printf("              relative to the working directory without -C.\n");
+    printf("    --format <human|json|ndjson|tsv>\n");
+    printf("              Output format for list & diff (default: human).\n");
+    printf("    -q        Quiet: only print errors.\n");
+    printf("    -v        Verbose: log every step and every file.\n");
+    printf("    --stats   Print per-phase timing, throughput & peak memory on exit.\n");
+    printf("    --root <dir>\n");
+    printf("              Required for serve: archive paths in requests are relative to\n");
+    printf("              this directory & may not leave it.\n");
+    printf("    --cache <MiB>\n");
+    printf("              Memory cap for decompressed archives in serve mode (default: 256).\n");
+    printf("    --align <extension|default>=<bytes>\n");
+    printf("              Data alignment for members of a type when constructing. Textures\n");
+    printf("              default to 128, layout & text files to 4, anything else to 128.\n");
+    printf("    --codec <zlib|yaz0|lz11|lz13|none>\n");
+    printf("              Compression for the constructed archive (default: yaz0 if the\n");
+    printf("              output ends in .szs, zlib otherwise).\n");
+    printf("    --ultra   Smallest output for release builds: optimal-parsing deflate on\n");
+    printf("              every CPU (or an exhaustive LZ search), much slower to construct.\n");
+    printf("    --manifest <path|->\n");
+    printf("              Also construct from the files listed in this file (- for stdin),\n");
+    printf("              one <path> or <path><tab><archive name> per line.\n");
+    printf("    --tar <path|->\n");
+    printf("              Also construct from the regular files in this tar archive (- for\n");
+    printf("              stdin), named by their paths in it.\n\n");
 
     printf("Examples:\n");
     printf("    zlib-sarc extract example.zlib -o ./output_directory\n");
     printf("    zlib-sarc construct ./example/anim/* ./example/blyt/* ./example/timg/* -o example.zlib\n");
+    printf("    zlib-sarc construct ./example/blyt/* -o example.szs\n");
+    printf("    zlib-sarc diff old/example.zlib new/example.zlib\n");
+    printf("    zlib-sarc extract example.zlib -o - | tar -x -C ./output_directory\n");
+    printf("    tar -c -C ./example . | zlib-sarc construct --tar - -o example.zlib\n");
+    printf("    zlib-sarc construct -C ./example anim blyt timg -o example.zlib\n");
+    printf("    zlib-sarc serve /tmp/ctrtools.sock --root . --cache 512\n");
+    printf("    zlib-sarc request /tmp/ctrtools.sock GET example.zlib blyt/a.bclyt -o a.bclyt\n");
+    printf("    zlib-sarc request /tmp/ctrtools.sock PNG example.zlib timg/a.ctpk a.tga -o a.png\n");
 
     exit(1);
 }
@@ -81,21 +187,57 @@ typedef struct {
 
     char* outputPath; // -o
     char* likePath; // -l
+    char* rootPath; // -C
+
+    ListFormat format; // --format
+
+    char* serveRoot; // --root
+    u64 cacheSize; // --cache
+
+    CtrCodec codec; // --codec
+    int codecGiven;
+
+    int ultra; // --ultra
+
+    char* manifestPath; // --manifest
+    char* tarPath; // --tar
 
     u32 inputFileCount;
     char** inputFiles;
 } Arguments;
 
 int main(int argc, char* argv[]) {
+    logStream = stdout;
+
     Arguments args;
     args.command = NULL;
 
     args.outputPath = NULL;
     args.likePath = NULL;
-    
+    args.rootPath = NULL;
+
+    args.format = LIST_FORMAT_HUMAN;
+
+    args.serveRoot = NULL;
+    args.cacheSize = 0;
+
+    args.codec = CTR_CODEC_ZLIB;
+    args.codecGiven = FALSE;
+
+    args.ultra = FALSE;
+
+    args.manifestPath = NULL;
+    args.tarPath = NULL;
+
     args.inputFileCount = 0;
     args.inputFiles = NULL;
 
+    StatsInit(0);
+
+    // Everything a command allocates for the archive it works on
+    Arena arena;
+    ArenaInit(&arena);
+
     if (argc < 3)
         usage(1);
 
@@ -108,7 +250,7 @@ int main(int argc, char* argv[]) {
                 if (i + 1 < argc)
                     args.outputPath = argv[++i];
                 else {
-                    printf("Error: missing output path after -o.\n\n");
+                    LOG_ERROR("Error: missing output path after -o.\n\n");
                     usage(0);
                 }
             }
@@ -116,12 +258,86 @@ int main(int argc, char* argv[]) {
                 if (i + 1 < argc)
                     args.likePath = argv[++i];
                 else {
-                    printf("Error: missing output path after -o.\n\n");
+                    LOG_ERROR("Error: missing like path after -l.\n\n");
+                    usage(0);
+                }
+            }
+            else if (strcmp(argv[i], "-C") == 0) {
+                if (i + 1 < argc)
+                    args.rootPath = argv[++i];
+                else {
+                    LOG_ERROR("Error: missing root path after -C.\n\n");
+                    usage(0);
+                }
+            }
+            else if (strcmp(argv[i], "-q") == 0)
+                logLevel = LOG_LEVEL_QUIET;
+            else if (strcmp(argv[i], "-v") == 0)
+                logLevel = LOG_LEVEL_VERBOSE;
+            else if (strcasecmp(argv[i], "--stats") == 0)
+                statsEnabled = 1;
+            else if (strcasecmp(argv[i], "--format") == 0) {
+                int format = i + 1 < argc ? ListFormatFromName(argv[i + 1]) : -1;
+                if (format < 0) {
+                    LOG_ERROR("Error: missing or unknown format after --format.\n\n");
+                    usage(0);
+                }
+
+                args.format = (ListFormat)format;
+                i++;
+            }
+            else if (strcasecmp(argv[i], "--root") == 0) {
+                if (i + 1 >= argc) {
+                    LOG_ERROR("Error: missing directory after --root.\n\n");
+                    usage(0);
+                }
+                args.serveRoot = argv[++i];
+            }
+            else if (strcasecmp(argv[i], "--cache") == 0) {
+                long size = i + 1 < argc ? atol(argv[i + 1]) : 0;
+                if (size <= 0) {
+                    LOG_ERROR("Error: missing or invalid size after --cache.\n\n");
                     usage(0);
                 }
+
+                args.cacheSize = (u64)size * 1024 * 1024;
+                i++;
+            }
+            else if (strcasecmp(argv[i], "--align") == 0) {
+                if (i + 1 >= argc || !SarcSetAlignment(argv[i + 1])) {
+                    LOG_ERROR("Error: missing or invalid <extension>=<bytes> after --align.\n\n");
+                    usage(0);
+                }
+
+                i++;
+            }
+            else if (strcasecmp(argv[i], "--ultra") == 0)
+                args.ultra = TRUE;
+            else if (strcasecmp(argv[i], "--manifest") == 0) {
+                if (i + 1 >= argc) {
+                    LOG_ERROR("Error: missing path after --manifest.\n\n");
+                    usage(0);
+                }
+                args.manifestPath = argv[++i];
+            }
+            else if (strcasecmp(argv[i], "--tar") == 0) {
+                if (i + 1 >= argc) {
+                    LOG_ERROR("Error: missing path after --tar.\n\n");
+                    usage(0);
+                }
+                args.tarPath = argv[++i];
+            }
+            else if (strcasecmp(argv[i], "--codec") == 0) {
+                if (i + 1 >= argc || CtrCodecFromName(argv[i + 1], &args.codec) != CTR_OK) {
+                    LOG_ERROR("Error: missing or unknown codec after --codec.\n\n");
+                    usage(0);
+                }
+
+                args.codecGiven = TRUE;
+                i++;
             }
             else {
-                printf("Error: unknown option (%s)\n\n", argv[i]);
+                LOG_ERROR("Error: unknown option (%s)\n\n", argv[i]);
                 usage(0);
             }
         }
@@ -134,36 +350,81 @@ int main(int argc, char* argv[]) {
         i++;
     }
 
-    if (args.inputFileCount <= 0) {
-        printf("Error: missing input file(s).\n\n");
+    // Only construct can take all of its inputs from --manifest or --tar
+    int isConstruct = strcasecmp(args.command, "construct") == 0;
+    if (args.inputFileCount == 0 && !(isConstruct && (args.manifestPath || args.tarPath))) {
+        LOG_ERROR("Error: missing input file(s).\n\n");
+        usage(0);
+    }
+    if (!isConstruct && (args.manifestPath || args.tarPath))
+        LOG_WARN("Warning: --manifest & --tar are only used by construct.\n");
+    if (
+        args.manifestPath && args.tarPath &&
+        strcmp(args.manifestPath, "-") == 0 && strcmp(args.tarPath, "-") == 0
+    ) {
+        LOG_ERROR("Error: only one of --manifest & --tar can read stdin.\n\n");
         usage(0);
     }
 
     if (strcasecmp(args.command, "extract") == 0) {
         CHECK_OUTPUT_GIVEN();
 
-        printf("-- Extracting archive --\n\n");
+        // -o -: a tar stream on stdout instead of a directory tree
+        int toTar = strcmp(args.outputPath, "-") == 0;
+        if (toTar)
+            logStream = stderr;
+
+        LOG("-- Extracting archive --\n\n");
 
         if (args.likePath)
-            printf("Warning: a like path was passed but will not be used.\n");
+            LOG_WARN("Warning: a like path was passed but will not be used.\n");
 
-        ZlibResult sarcBin = ReadZLIBFromPath(args.inputFiles[0]);
+        ZlibResult sarcBin = ReadArchiveFromPath(args.inputFiles[0], &arena);
 
-        SarcPreprocess(sarcBin.ptr);
+        CtrSarc* sarc = OpenSarc(sarcBin.ptr, sarcBin.size);
+
+        u16 nodeCount = CtrSarcGetEntryCount(sarc);
+
+        // Members are stamped with the extraction time, as files written out are
+        TarWriter tar;
+        u32 tarTimestamp = (u32)time(NULL);
+        if (toTar)
+            TarBegin(&tar, stdout);
+
+        Progress progress;
+        ProgressBegin(&progress, "Extracting", nodeCount);
 
-        u16 nodeCount = SarcGetNodeCount(sarcBin.ptr);
         for (u16 i = 0; i < nodeCount; i++) {
-            FindResult result = SarcGetFileFromIndex(sarcBin.ptr, i);
+            double statsTime = StatsBegin();
 
-            char* name = SarcGetNameFromIndex(sarcBin.ptr, i);
+            CtrSarcEntry entry = SarcGetEntry(sarc, i);
+            const char* name = entry.name;
             char nbuf[1024];
 
-            if (!result.ptr)
-                panic("A file could not be found.");
+            StatsEnd(&statsNameResolve, statsTime, 0, 0);
+
             if (!name)
                 panic("A file's name could not be found.");
 
-            printf("Writing file no. %u (%s) ..", i+1, name);
+            if (!SarcNameIsSafe(name)) {
+                LOG_WARN("Warning: skipping %s, which would be written outside the output.\n", name);
+                ProgressStep(&progress, 0);
+                continue;
+            }
+
+            LOG_VERBOSE("Writing file no. %u (%s) ..", i+1, name);
+
+            if (toTar) {
+                statsTime = StatsBegin();
+
+                TarAddFile(&tar, name, entry.data, entry.size, tarTimestamp);
+
+                StatsEnd(&statsMemberWrite, statsTime, entry.size, entry.size);
+
+                LOG_VERBOSE_OK;
+                ProgressStep(&progress, entry.size);
+                continue;
+            }
 
             int truncateAt = getFilename(name) - name;
             u32 outDirLen = strlen(args.outputPath);
@@ -173,16 +434,22 @@ int main(int argc, char* argv[]) {
             memcpy(nbuf + outDirLen + 1, name, truncateAt);
             nbuf[outDirLen + 1 + truncateAt] = '\0';
 
+            statsTime = StatsBegin();
+
             createDirectoryTree(nbuf);
 
+            StatsEnd(&statsCreateDir, statsTime, 0, 0);
+
             memcpy(nbuf + outDirLen + 1, name, strlen(name) + 1);
 
+            statsTime = StatsBegin();
+
             FILE* fpOut = fopen(nbuf, "wb");
             if (fpOut == NULL)
                 panic("The output binary could not be opened.");
 
-            u64 bytesWritten = fwrite(result.ptr, 1, result.size, fpOut);
-            if (bytesWritten != result.size) {
+            u64 bytesWritten = fwrite(entry.data, 1, entry.size, fpOut);
+            if (bytesWritten != entry.size) {
                 fclose(fpOut);
 
                 panic("The output binary could not be written to.");
@@ -190,38 +457,134 @@ int main(int argc, char* argv[]) {
 
             fclose(fpOut);
 
-            LOG_OK;
+            StatsEnd(&statsMemberWrite, statsTime, entry.size, entry.size);
+
+            LOG_VERBOSE_OK;
+            ProgressStep(&progress, entry.size);
         }
 
-        free(sarcBin.ptr);
+        ProgressEnd(&progress);
+
+        if (toTar)
+            TarEnd(&tar);
+
+        CtrSarcClose(sarc);
     }
     else if (strcasecmp(args.command, "construct") == 0) {
         CHECK_OUTPUT_GIVEN();
 
-        printf("-- Constructing archive --\n\n");
+        LOG("-- Constructing archive --\n\n");
 
         SarcBuildFile* files = NULL;
         u32 fileCount = 0;
 
+        // Archive paths of the inputs, converted once
+        ConstructInputList inputList;
+        ConstructInputListInit(&inputList);
+
+        #ifndef _WIN32
+        DirWalk walk;
+        DirWalkInit(&walk, &arena);
+        int walking = FALSE;
+        #endif
+
+        for (u32 j = 0; j < args.inputFileCount; j++) {
+            const char* input = args.inputFiles[j];
+
+            char diskPath[4096];
+            if (args.rootPath)
+                snprintf(diskPath, sizeof(diskPath), "%s" PATH_SEPARATOR_S "%s", args.rootPath, input);
+            else
+                snprintf(diskPath, sizeof(diskPath), "%s", input);
+
+            struct stat st;
+            int isDirectory = stat(diskPath, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+
+            // Loose files keep their old two-component names unless a root is given
+            if (!isDirectory && !args.rootPath) {
+                ConstructAddPath(&inputList, input, NULL, TRUE, &arena);
+                continue;
+            }
+
+            char name[4096];
+            if (!ConstructNormalizeName(input, name, sizeof(name))) {
+                LOG_ERROR("Error: %s is outside the construct root (see -C).\n", input);
+                panic("Invalid construct input");
+            }
+
+            if (!isDirectory) {
+                ConstructAddPath(&inputList, diskPath, name, TRUE, &arena);
+                continue;
+            }
+
+            #ifdef _WIN32
+            panic("Directory inputs are not supported on Windows.");
+            #else
+            DirWalkAddRoot(&walk, diskPath, name);
+            walking = TRUE;
+            #endif
+        }
+
+        #ifndef _WIN32
+        if (walking) {
+            LOG("Walking directories ..");
+            LOG_VERBOSE("\n");
+
+            DirWalkRun(&walk);
+
+            for (u32 j = 0; j < walk.fileCount; j++) {
+                DirWalkFile* file = walk.files + j;
+                ConstructAddData(&inputList, file->name, file->path, file->data, (u32)file->size);
+            }
+
+            LOG_OK;
+        }
+        DirWalkFree(&walk);
+        #endif
+
+        if (args.manifestPath)
+            ConstructReadManifest(&inputList, args.manifestPath, &arena);
+        if (args.tarPath)
+            ConstructReadTar(&inputList, args.tarPath, &arena);
+
+        ConstructDropDuplicates(&inputList);
+
+        if (inputList.count == 0)
+            panic("There are no files to construct from.");
+
+        // SFAT counts nodes in 16 bits
+        if (inputList.count > 0xFFFF) {
+            LOG_ERROR("Error: %u files to construct from, a SARC archive holds at most 65535.\n", inputList.count);
+            panic("Too many input files.");
+        }
+
+        ConstructInput* inputs = inputList.inputs;
+        u32 inputCount = inputList.count;
+
         if (args.likePath) {
-            ZlibResult likeSarc = ReadZLIBFromPath(args.likePath);
-            SarcPreprocess(likeSarc.ptr);
+            ZlibResult likeSarc = ReadArchiveFromPath(args.likePath, &arena);
+            CtrSarc* like = OpenSarc(likeSarc.ptr, likeSarc.size);
 
-            fileCount = SarcGetNodeCount(likeSarc.ptr);
+            u32 likeCount = CtrSarcGetEntryCount(like);
 
-            printf("Construct matching build files:\n");
+            LOG_VERBOSE("Construct matching build files:\n");
 
             // Array to track used input files
-            int usedInputFiles[args.inputFileCount];
-            memset(usedInputFiles, 0, sizeof(usedInputFiles));
+            u8* usedInputFiles = (u8*)ArenaAlloc(&arena, inputCount);
+            memset(usedInputFiles, 0, inputCount);
+
+            // Room for every additive file, so the list never moves
+            files = (SarcBuildFile*)ArenaAlloc(
+                &arena, sizeof(SarcBuildFile) * (likeCount + inputCount)
+            );
+            fileCount = likeCount;
 
-            files = (SarcBuildFile*)malloc(sizeof(SarcBuildFile) * fileCount);
-            if (!files)
-                PANIC_MALLOC("build files");
+            Progress progress;
+            ProgressBegin(&progress, "Reading", inputCount);
 
             // Match files
             for (u32 a = 0; a < fileCount; a++) {
-                char* sarcFileName = SarcGetNameFromIndex(likeSarc.ptr, a);
+                const char* sarcFileName = SarcGetEntry(like, a).name;
                 SarcBuildFile* file = files + a;
 
                 file->data = NULL;
@@ -230,143 +593,114 @@ int main(int argc, char* argv[]) {
                 file->nil = 1;
 
                 // Search for matching input files
-                for (u32 b = 0; b < args.inputFileCount; b++) {
-                    char bPath[512];
-                    OSPathToSarcPath(args.inputFiles[b], bPath);
-
-                    if (strcmp(sarcFileName, bPath) == 0) {
-                        file->name = strdup(sarcFileName);
-                        printf("Match found (%03u. %s), copying..\n", a + 1, file->name);
-
-                        FILE* fpBin = fopen(args.inputFiles[b], "rb");
-                        if (!fpBin)
-                            panic("The file could not be opened.");
-
-                        fseek(fpBin, 0, SEEK_END);
-                        file->dataSize = ftell(fpBin);
-                        rewind(fpBin);
-
-                        file->data = (u8*)malloc(file->dataSize);
-                        if (!file->data) {
-                            fclose(fpBin);
-                            PANIC_MALLOC("file buf");
-                        }
-
-                        u64 bytesCopied = fread(file->data, 1, file->dataSize, fpBin);
-                        if (bytesCopied != file->dataSize) {
-                            free(file->data);
-                            fclose(fpBin);
-                            panic("Buffer reading failed");
-                        }
-
-                        fclose(fpBin);
+                for (u32 b = 0; b < inputCount; b++) {
+                    if (strcmp(sarcFileName, inputs[b].name) == 0) {
+                        file->name = inputs[b].name;
+                        LOG_VERBOSE("Match found (%03u. %s), copying..", a + 1, file->name);
+
+                        file->data = LoadConstructInput(inputs + b, &file->dataSize, &arena);
                         file->nil = 0;
                         usedInputFiles[b] = 1;
 
-                        LOG_OK;
+                        LOG_VERBOSE_OK;
+                        ProgressStep(&progress, file->dataSize);
                         break;
                     }
                 }
 
                 if (!file->data)
-                    printf("Match not found for file no. %u (%s).\n", a + 1, sarcFileName);
+                    LOG_VERBOSE("Match not found for file no. %u (%s).\n", a + 1, sarcFileName);
             }
 
             // Process additive files
-            for (u32 b = 0; b < args.inputFileCount; b++) {
-                if (!usedInputFiles[b] && !strchr(args.inputFiles[b], '*')) {
-                    files = realloc(files, sizeof(SarcBuildFile) * (++fileCount));
-                    if (!files)
-                        PANIC_MALLOC("realloc build files");
-
-                    SarcBuildFile* file = files + fileCount - 1;
-
-                    char bPath[512];
-                    OSPathToSarcPath(args.inputFiles[b], bPath);
-                    file->name = strdup(bPath);
-
-                    printf("Additive file found (%s), copying..", file->name);
-
-                    FILE* fpBin = fopen(args.inputFiles[b], "rb");
-                    if (!fpBin)
-                        panic("The file could not be opened.");
+            for (u32 b = 0; b < inputCount; b++) {
+                if (!usedInputFiles[b] && !(inputs[b].fromArgv && strchr(inputs[b].path, '*'))) {
+                    SarcBuildFile* file = files + fileCount++;
 
-                    fseek(fpBin, 0, SEEK_END);
-                    file->dataSize = ftell(fpBin);
-                    rewind(fpBin);
+                    file->name = inputs[b].name;
 
-                    file->data = (u8*)malloc(file->dataSize);
-                    if (!file->data) {
-                        fclose(fpBin);
-                        PANIC_MALLOC("file buf");
-                    }
+                    LOG_VERBOSE("Additive file found (%s), copying..", file->name);
 
-                    u64 bytesCopied = fread(file->data, 1, file->dataSize, fpBin);
-                    if (bytesCopied != file->dataSize) {
-                        free(file->data);
-                        fclose(fpBin);
-                        panic("Buffer reading failed");
-                    }
+                    file->data = LoadConstructInput(inputs + b, &file->dataSize, &arena);
+                    file->nil = 0;
 
-                    fclose(fpBin);
-                    LOG_OK;
+                    LOG_VERBOSE_OK;
+                    ProgressStep(&progress, file->dataSize);
                 }
             }
 
+            ProgressEnd(&progress);
+
+            CtrSarcClose(like);
         }
         else {
-            printf("Construct build files: \n");
+            LOG_VERBOSE("Construct build files: \n");
 
-            fileCount = args.inputFileCount;
+            fileCount = inputCount;
 
-            files = (SarcBuildFile*)malloc(sizeof(SarcBuildFile) * fileCount);
-            if (files == NULL)
-                PANIC_MALLOC("build files");
+            files = (SarcBuildFile*)ArenaAlloc(&arena, sizeof(SarcBuildFile) * fileCount);
+
+            Progress progress;
+            ProgressBegin(&progress, "Reading", fileCount);
 
             for (u32 j = 0; j < fileCount; j++) {
                 SarcBuildFile* file = files + j;
 
-                file->name = (char*)malloc(512);
-                OSPathToSarcPath(args.inputFiles[j], file->name);
+                file->name = inputs[j].name;
+
+                LOG_VERBOSE("Read & copy file no. %u (%s) ..", j + 1, file->name);
+
+                file->data = LoadConstructInput(inputs + j, &file->dataSize, &arena);
+                file->nil = 0;
 
-                printf("Read & copy file no. %u (%s) ..", j + 1, file->name);
+                LOG_VERBOSE_OK;
+                ProgressStep(&progress, file->dataSize);
+            }
 
-                FILE* fpBin = fopen(args.inputFiles[j], "rb");
-                if (fpBin == NULL)
-                    panic("The file could not be opened.");
+            ProgressEnd(&progress);
+        }
 
-                fseek(fpBin, 0, SEEK_END);
-                file->dataSize = ftell(fpBin);
-                rewind(fpBin);
+        LOG_VERBOSE("\n");
 
-                file->data = (u8 *)malloc(file->dataSize);
-                if (file->data == NULL) {
-                    fclose(fpBin);
+        double statsTime = StatsBegin();
 
-                    PANIC_MALLOC("file buf");
-                }
+        SarcBuildResult result = SarcBuild(files, fileCount);
 
-                u64 bytesCopied = fread(file->data, 1, file->dataSize, fpBin);
-                if (bytesCopied != file->dataSize) {
-                    free(file->data);
-                    fclose(fpBin);
+        ConstructInputListFree(&inputList);
 
-                    panic("Buffer readin fail");
-                }
+        u64 buildBytesIn = 0;
+        for (u32 j = 0; j < fileCount; j++)
+            buildBytesIn += files[j].dataSize;
 
-                fclose(fpBin);
+        StatsEnd(&statsBuild, statsTime, buildBytesIn, result.size);
 
-                LOG_OK;
-            }
+        if (result.duplicateCount)
+            LOG(
+                "Deduplicated %u member(s) with identical data, %u bytes saved.\n",
+                result.duplicateCount, result.duplicateBytes
+            );
+
+        CtrCodec codec = args.codec;
+        if (!args.codecGiven) {
+            size_t pathLength = strlen(args.outputPath);
+            if (pathLength >= 4 && strcasecmp(args.outputPath + pathLength - 4, ".szs") == 0)
+                codec = CTR_CODEC_YAZ0;
         }
 
-        printf("\n");
+        statsTime = StatsBegin();
 
-        SarcBuildResult result = SarcBuild(files, fileCount);
+        ZlibResult zlibBin = compressData(
+            result.ptr, result.size, codec,
+            args.ultra ? CTR_CODEC_LEVEL_ULTRA : Z_BEST_COMPRESSION
+        );
+
+        StatsEnd(&statsDeflate, statsTime, result.size, zlibBin.size);
 
-        ZlibResult zlibBin = compressData(result.ptr, result.size);
+        free(result.ptr);
 
-        printf("Writing file data ..");
+        LOG("Writing file data ..");
+
+        statsTime = StatsBegin();
 
         FILE* fpOut = fopen(args.outputPath, "wb");
         if (fpOut == NULL)
@@ -377,58 +711,130 @@ int main(int argc, char* argv[]) {
         
         fclose(fpOut);
 
-        // Free build files
-        for (u32 j = 0; j < args.inputFileCount; j++) {
-            SarcBuildFile* file = files + j;
-
-            if (file->name)
-                free(file->name);
-            if (file->data)
-                free(file->data);
-        }
-        free(files);
+        StatsEnd(&statsArchiveWrite, statsTime, zlibBin.size, zlibBin.size);
 
         free(zlibBin.ptr);
 
         LOG_OK;
     }
     else if (strcasecmp(args.command, "list") == 0) {
-        printf("-- Listing archive --\n\n");
+        // Keep stdout clean for the listing itself
+        if (args.format != LIST_FORMAT_HUMAN)
+            logStream = stderr;
+
+        LOG("-- Listing archive --\n\n");
 
         if (args.likePath)
-            printf("Warning: a like path was passed but will not be used.\n");
+            LOG_WARN("Warning: a like path was passed but will not be used.\n");
 
-        ZlibResult sarcBin = ReadZLIBFromPath(args.inputFiles[0]);
+        ZlibResult sarcBin = ReadArchiveFromPath(args.inputFiles[0], &arena);
 
-        SarcPreprocess(sarcBin.ptr);
+        CtrSarc* sarc = OpenSarc(sarcBin.ptr, sarcBin.size);
 
-        char prevPath[256] = "";  
-        int prevDepth = 0;
+        u16 nodeCount = CtrSarcGetEntryCount(sarc);
 
-        u16 nodeCount = SarcGetNodeCount(sarcBin.ptr);
-        for (u16 i = 0; i < nodeCount; i++) {
-            char* name = SarcGetNameFromIndex(sarcBin.ptr, i);
-            FindResult file = SarcGetFileFromIndex(sarcBin.ptr, i);
-            
-            if (!name)
-                panic("A file's name could not be found.");
+        if (args.format == LIST_FORMAT_HUMAN) {
+            for (u16 i = 0; i < nodeCount; i++) {
+                CtrSarcEntry entry = SarcGetEntry(sarc, i);
 
-            printf("%03u. %s (size: %u)\n", i+1, name, file.size);
+                if (!entry.name)
+                    panic("A file's name could not be found.");
+
+                printf("%03u. %s (size: %u)\n", i+1, entry.name, entry.size);
+            }
+        }
+        else {
+            static const char* const columns[] = { "name", "hash", "offset", "size" };
+
+            ListWriter writer;
+            ListBegin(&writer, stdout, args.format, columns, 4);
+
+            for (u16 i = 0; i < nodeCount; i++) {
+                CtrSarcEntry entry = SarcGetEntry(sarc, i);
+
+                if (!entry.name)
+                    panic("A file's name could not be found.");
+
+                ListRecordBegin(&writer);
+                ListFieldString(&writer, "name", entry.name);
+                ListFieldHex32(&writer, "hash", entry.nameHash);
+                ListFieldU64(&writer, "offset", entry.offset);
+                ListFieldU64(&writer, "size", entry.size);
+                ListRecordEnd(&writer);
+            }
+
+            ListEnd(&writer);
         }
 
-        free(sarcBin.ptr);
+        CtrSarcClose(sarc);
+    }
+    else if (strcasecmp(args.command, "diff") == 0) {
+        if (args.inputFileCount != 2) {
+            LOG_ERROR("Error: diff takes exactly two archives.\n\n");
+            usage(0);
+        }
+
+        if (args.format != LIST_FORMAT_HUMAN)
+            logStream = stderr;
+
+        LOG("-- Comparing archives --\n\n");
+
+        if (args.likePath)
+            LOG_WARN("Warning: a like path was passed but will not be used.\n");
+
+        DiffEntry* sides[2];
+        u32 sideCounts[2];
+        CtrSarc* sarcs[2];
+
+        for (u32 side = 0; side < 2; side++) {
+            ZlibResult sarcBin = ReadArchiveFromPath(args.inputFiles[side], &arena);
+
+            sarcs[side] = OpenSarc(sarcBin.ptr, sarcBin.size);
+            sideCounts[side] = CtrSarcGetEntryCount(sarcs[side]);
+
+            sides[side] = (DiffEntry*)ArenaAlloc(&arena, sizeof(DiffEntry) * (sideCounts[side] + 1));
+            if (sides[side] == NULL)
+                PANIC_MALLOC("diff entries");
+
+            for (u32 j = 0; j < sideCounts[side]; j++) {
+                CtrSarcEntry entry = SarcGetEntry(sarcs[side], j);
+
+                if (!entry.name)
+                    panic("A file's name could not be found.");
+
+                DiffEntry* diffEntry = sides[side] + j;
+                diffEntry->name = entry.name;
+                diffEntry->data = (const u8*)entry.data;
+                diffEntry->size = entry.size;
+                diffEntry->meta = 0;
+                diffEntry->hash = 0;
+            }
+        }
+
+        LOG("\n");
+
+        DiffSummary summary = DiffArchives(
+            sides[0], sideCounts[0], sides[1], sideCounts[1], 0, stdout, args.format
+        );
+
+        DiffLogSummary(summary);
+
+        CtrSarcClose(sarcs[0]);
+        CtrSarcClose(sarcs[1]);
     }
     else if (strcasecmp(args.command, "raw") == 0) {
         CHECK_OUTPUT_GIVEN();
 
         if (args.likePath)
-            printf("Warning: a like path was passed but will not be used.\n");
+            LOG_WARN("Warning: a like path was passed but will not be used.\n");
 
-        printf("-- Exporting archive --\n\n");
+        LOG("-- Exporting archive --\n\n");
 
-        ZlibResult sarcBin = ReadZLIBFromPath(args.inputFiles[0]);
+        ZlibResult sarcBin = ReadArchiveFromPath(args.inputFiles[0], &arena);
 
-        printf("Writing file data ..");
+        LOG("Writing file data ..");
+
+        double statsTime = StatsBegin();
 
         FILE* fpOut = fopen(args.outputPath, "wb");
         if (fpOut == NULL)
@@ -439,14 +845,57 @@ int main(int argc, char* argv[]) {
         
         fclose(fpOut);
 
-        free(sarcBin.ptr);
+        StatsEnd(&statsArchiveWrite, statsTime, sarcBin.size, sarcBin.size);
+    }
+#ifndef _WIN32
+    else if (strcasecmp(args.command, "serve") == 0) {
+        if (args.likePath || args.outputPath)
+            LOG_WARN("Warning: -l and -o are not used by serve.\n");
+
+        if (args.serveRoot == NULL) {
+            LOG_ERROR("Error: serve needs --root, the directory requests may read from.\n\n");
+            usage(0);
+        }
+
+        Serve(
+            args.inputFiles[0], args.serveRoot,
+            args.cacheSize ? args.cacheSize : SERVE_DEFAULT_CACHE_SIZE
+        );
+    }
+    else if (strcasecmp(args.command, "request") == 0) {
+        // Keep stdout clean for the response body
+        logStream = stderr;
+
+        if (args.inputFileCount < 2) {
+            LOG_ERROR("Error: missing request after the socket path.\n\n");
+            usage(0);
+        }
+
+        FILE* fpOut = stdout;
+        if (args.outputPath) {
+            fpOut = fopen(args.outputPath, "wb");
+            if (fpOut == NULL)
+                panic("Failed to open the output file");
+        }
+
+        ServeClientRequest(args.inputFiles[0], args.inputFiles + 1, args.inputFileCount - 1, fpOut);
+
+        if (fpOut != stdout)
+            fclose(fpOut);
     }
+#endif
     else {
-        printf("Error: unknown command (%s)\n\n", args.command);
+        LOG_ERROR("Error: unknown command (%s)\n\n", args.command);
         usage(0);
     }
 
-    printf("\nFinished! Exiting ..\n");
+    LOG_VERBOSE("Arena: %lu bytes allocated in %lu bytes of blocks\n", arena.allocated, arena.reserved);
+
+    ArenaFree(&arena);
+
+    StatsReport();
+
+    LOG("\nFinished! Exiting ..\n");
 
     free(args.inputFiles);
 
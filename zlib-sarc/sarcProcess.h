@@ -5,270 +5,305 @@
 #include <stdlib.h>
 
 #include <string.h>
+#include <strings.h>
 
-#include "common.h"
-
-#define SARC_MAGIC 0x43524153 // "SARC"
-#define SFAT_MAGIC 0x54414653 // "SFAT"
-#define SFNT_MAGIC 0x544E4653 // "SFNT"
+#include "ctrtools.h"
+#include "ctrFormats.h"
 
-#define BOMARKER_BIG 0xFFFE
-#define BOMARKER_LITTLE 0xFEFF
+#include "common.h"
 
-#define SARC_DATA_ALIGN 128
+#define SARC_DATA_ALIGN 128 // Default member data alignment
 #define SARC_NAME_ALIGN 4
 
 #define SARC_DUMMY_NAME "DMY" // sizeof must be SARC_NAME_ALIGN
 
-typedef struct __attribute((packed)) {
-    u32 magic; // Compare to SARC_MAGIC
-    u16 headerSize; // Always 0x14
-    u16 boMarker; // Byte Order Mark: compare to BOMARKER_BIG and BOMARKER_LITTLE
-    u32 fileSize; // File size of whole binary.
-    u32 dataStart; // Offset to the archive data.
-
-    u16 versionNumber; // Usually 0x0100
-
-    u16 _reserved;
-} SarcFileHeader;
-
-typedef struct __attribute((packed)) {
-    u32 magic; // Compare to SFAT_MAGIC
-    u16 headerSize; // Usually 0xC
+#define SARC_HASH_KEY 0x65 // Name hash multiplier of built archives
 
-    u16 nodeCount;
-    u32 hashKey; // Usually 0x65
-} SfatHeader;
+// FALSE if a member name would leave the directory it is extracted into:
+// absolute, drive-relative or with a ".." component. Both slashes count as
+// separators so the check holds on Windows too.
+int SarcNameIsSafe(const char* name) {
+    if (name[0] == '\0' || name[0] == '/' || name[0] == '\\' || (name[0] && name[1] == ':'))
+        return FALSE;
 
-typedef struct __attribute((packed)) {
-    u32 nameHash;
+    for (const char* component = name; *component; ) {
+        const char* end = component;
+        while (*end && *end != '/' && *end != '\\')
+            end++;
 
-    u16 nameOffsetDiv4;
-    u16 isNameOffsetAvaliable;
+        if (end - component == 2 && component[0] == '.' && component[1] == '.')
+            return FALSE;
 
-    u32 dataOffsetStart; // Relative to the SARC header's dataStart
-    u32 dataOffsetEnd; // Relative to the SARC header's dataStart
-} SfatNode;
+        component = *end ? end + 1 : end;
+    }
 
-typedef struct __attribute((packed)) {
-    u32 magic; // Compare to SFNT_MAGIC
-    u16 headerSize;
+    return TRUE;
+}
 
-    u16 _pad16;
-} SfntHeader;
+// Opens a decompressed SARC of either byte order; the data is only read.
+CtrSarc* SarcOpen(const u8* sarcData, u32 sarcSize) {
+    CtrSarc* sarc;
 
-u32 GetHash(const char* name, u32 length, u32 key) {
-    u32 result = 0;
-	for (u32 i = 0; i < length; i++)
-		result = name[i] + result * key;
+    CtrStatus status = CtrSarcOpen(NULL, sarcData, sarcSize, &sarc);
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
 
-	return result;
+    return sarc;
 }
 
-void SarcPreprocess(u8* sarcData) {
-    SarcFileHeader* fileHeader = (SarcFileHeader*)sarcData;
-    if (fileHeader->magic != SARC_MAGIC)
-        panic("SARC header magic is nonmatching");
-
-    if (
-        fileHeader->boMarker != BOMARKER_LITTLE &&
-        fileHeader->boMarker != BOMARKER_BIG
-    )
-        panic("SARC byte order mark is invalid");
-
-    SfatHeader* sfatHeader = (SfatHeader*)(sarcData + fileHeader->headerSize);
-    if (sfatHeader->magic != SFAT_MAGIC)
-        panic("SFAT header magic is nonmatching");
+CtrSarcEntry SarcGetEntry(const CtrSarc* sarc, u32 index) {
+    CtrSarcEntry entry;
 
-    SfntHeader* sfntHeader = (SfntHeader*)(
-        ((SfatNode*)((u8*)sfatHeader + sfatHeader->headerSize)) +
-        sfatHeader->nodeCount
-    );
-    if (sfntHeader->magic != SFNT_MAGIC)
-        panic("SFNT header magic is nonmatching");
+    CtrStatus status = CtrSarcGetEntry(sarc, index, &entry);
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
 
-    if (fileHeader->boMarker != BOMARKER_BIG)
-        return;
+    return entry;
+}
 
-    fileHeader->headerSize = __builtin_bswap16(fileHeader->headerSize);
-    fileHeader->dataStart = __builtin_bswap32(fileHeader->dataStart);
+// Converts a little endian SARC (e.g. a fresh build) to big endian in place.
+void SarcToBigEndian(u8* sarcData, u32 sarcSize) {
+    CtrStatus status = CtrSarcToBigEndian(sarcData, sarcSize);
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
+}
 
-    sfatHeader->headerSize = __builtin_bswap16(sfatHeader->headerSize);
-    sfatHeader->nodeCount = __builtin_bswap16(sfatHeader->nodeCount);
-    sfatHeader->hashKey = __builtin_bswap32(sfatHeader->hashKey);
+typedef struct {
+    u8* ptr;
+    u32 size;
 
-    // SFAT nodes
-    for (u32 i = 0; i < sfatHeader->nodeCount; i++) {
-        SfatNode* node =
-            ((SfatNode*)((u8*)sfatHeader + sfatHeader->headerSize)) + i;
+    u32 duplicateCount; // Members sharing an earlier member's data
+    u32 duplicateBytes; // Data bytes not stored because of it
+} SarcBuildResult;
 
-        node->nameHash = __builtin_bswap32(node->nameHash);
+typedef struct {
+    char* name;
 
-        node->nameOffsetDiv4 = __builtin_bswap16(node->nameOffsetDiv4);
-        node->isNameOffsetAvaliable = __builtin_bswap16(node->isNameOffsetAvaliable);
+    u8* data;
+    u32 dataSize;
 
-        node->dataOffsetStart = __builtin_bswap32(node->dataOffsetStart);
-        node->dataOffsetEnd = __builtin_bswap32(node->dataOffsetEnd);
-    }
+    int nil;
+} SarcBuildFile;
 
-    sfntHeader->headerSize = __builtin_bswap16(sfntHeader->headerSize);
+typedef struct {
+    u32 hash;
+    const char* name;
 
-    fileHeader->boMarker = BOMARKER_LITTLE;
-    return;
-}
+    u32 index; // Into the build files
+} I_SarcBuildOrder;
 
-typedef struct {
-    u8* ptr;
-    u32 size;
-} FindResult;
+int I_SarcBuildOrderCompare(const void* a, const void* b) {
+    const I_SarcBuildOrder* orderA = (const I_SarcBuildOrder*)a;
+    const I_SarcBuildOrder* orderB = (const I_SarcBuildOrder*)b;
 
-u16 SarcGetNodeCount(const u8* sarcData) {
-    SarcFileHeader* fileHeader = (SarcFileHeader*)sarcData;
+    if (orderA->hash != orderB->hash)
+        return orderA->hash < orderB->hash ? -1 : 1;
 
-    SfatHeader* sfatHeader = (SfatHeader*)(sarcData + fileHeader->headerSize);
+    int nameOrder = strcmp(orderA->name, orderB->name);
+    if (nameOrder != 0)
+        return nameOrder;
 
-    return sfatHeader->nodeCount;
+    // qsort isn't stable; keep the output reproducible
+    return (orderA->index > orderB->index) - (orderA->index < orderB->index);
 }
 
-char* SarcGetNameFromHash(const u8* sarcData, u32 hash) {
-    SarcFileHeader* fileHeader = (SarcFileHeader*)sarcData;
+/*
+    Loaders binary-search SFAT by name hash, so nodes are emitted sorted by
+    hash (name as the tiebreak), with names & data laid out in the same
+    order. Distinct names sharing a hash can't be told apart by such a
+    lookup & are reported.
+*/
+I_SarcBuildOrder* I_SarcBuildSortFiles(const SarcBuildFile* files, u32 fileCount, u32 hashKey) {
+    I_SarcBuildOrder* order = (I_SarcBuildOrder*)malloc(sizeof(I_SarcBuildOrder) * (fileCount ? fileCount : 1));
+    if (order == NULL)
+        PANIC_MALLOC("build order");
 
-    SfatHeader* sfatHeader = (SfatHeader*)(sarcData + fileHeader->headerSize);
+    for (u32 i = 0; i < fileCount; i++) {
+        const char* name = files[i].nil ? SARC_DUMMY_NAME : files[i].name;
 
-    SfntHeader* sfntHeader = (SfntHeader*)(
-        ((SfatNode*)(
-            sarcData + fileHeader->headerSize + sfatHeader->headerSize
-        )) + sfatHeader->nodeCount
-    );
+        order[i].hash = CtrSarcHash(name, strlen(name), hashKey);
+        order[i].name = name;
+        order[i].index = i;
+    }
 
-    char* stringPtr = (char*)sfntHeader + sfntHeader->headerSize;
-    for (u32 i = 0; i < sfatHeader->nodeCount; i++) {
-        if (GetHash(stringPtr, strlen(stringPtr), sfatHeader->hashKey) == hash)
-            return stringPtr;
+    qsort(order, fileCount, sizeof(I_SarcBuildOrder), I_SarcBuildOrderCompare);
 
-        u32 length = strlen(stringPtr) + 1;
-        stringPtr += (length + 3) & ~3;
+    for (u32 i = 1; i < fileCount; i++) {
+        if (order[i].hash == order[i - 1].hash && strcmp(order[i].name, order[i - 1].name) != 0)
+            LOG_WARN(
+                "Warning: hash collision between %s & %s (0x%08X).\n",
+                order[i - 1].name, order[i].name, order[i].hash
+            );
     }
 
-    return NULL;
+    return order;
 }
 
-char* SarcGetNameFromIndex(const u8* sarcData, u16 nodeIndex) {
-    SarcFileHeader* fileHeader = (SarcFileHeader*)sarcData;
-
-    const u8* dataStart = sarcData + fileHeader->dataStart;
+/*
+    Member data alignment by file extension. Textures (BCLIM/BFLIM, CTPK,
+    font sheets, CGFX/H3D resources) are read by the GPU straight from the
+    archive & need 128 bytes; layout, animation & text files are parsed by
+    the CPU & only need 4. Anything else gets sarcDefaultAlignment.
+    SarcSetAlignment (--align) changes or adds entries.
+*/
 
-    SfatHeader* sfatHeader = (SfatHeader*)(sarcData + fileHeader->headerSize);
+#define SARC_MAX_ALIGNMENTS 32
+#define SARC_MAX_ALIGNMENT 4096
 
-    if (nodeIndex >= sfatHeader->nodeCount)
-        return NULL;
+typedef struct {
+    char extension[16]; // Without the dot
+    u32 alignment; // Power of two
+} SarcAlignment;
 
-    SfatNode* node =
-        ((SfatNode*)((u8*)sfatHeader + sfatHeader->headerSize)) + nodeIndex;
+SarcAlignment sarcAlignments[SARC_MAX_ALIGNMENTS] = {
+    { "bclim", 128 }, { "bflim", 128 }, { "ctpk", 128 },
+    { "bcfnt", 128 }, { "bffnt", 128 }, { "bcres", 128 }, { "bch", 128 },
 
-    SfntHeader* sfntHeader = (SfntHeader*)(
-        ((SfatNode*)(
-            sarcData + fileHeader->headerSize + sfatHeader->headerSize
-        )) + sfatHeader->nodeCount
-    );
-    char* stringPtr = (char*)sfntHeader + sfntHeader->headerSize;
+    { "bclyt", 4 }, { "bflyt", 4 }, { "bclan", 4 }, { "bflan", 4 },
+    { "msbt", 4 }, { "txt", 4 }, { "xml", 4 }, { "json", 4 }, { "csv", 4 }
+};
+u32 sarcAlignmentCount = 16;
 
-    if (node->isNameOffsetAvaliable != 0x0000)
-        return stringPtr + (node->nameOffsetDiv4 * 4);
+u32 sarcDefaultAlignment = SARC_DATA_ALIGN;
 
-    // If name offset isn't avaliable, search the string pool for a string with
-    // a matching hash
-    for (u16 i = 0; i < sfatHeader->nodeCount; i++) {
-        if (GetHash(stringPtr, strlen(stringPtr), sfatHeader->hashKey) == node->nameHash)
-            return stringPtr;
+u32 SarcGetAlignment(const char* name) {
+    const char* extension = name ? strrchr(name, '.') : NULL;
+    if (extension == NULL || strchr(extension, '/'))
+        return sarcDefaultAlignment;
 
-        u32 length = strlen(stringPtr) + 1;
-        stringPtr += (length + 3) & ~3;
+    for (u32 i = 0; i < sarcAlignmentCount; i++) {
+        if (strcasecmp(extension + 1, sarcAlignments[i].extension) == 0)
+            return sarcAlignments[i].alignment;
     }
 
-    return NULL;
+    return sarcDefaultAlignment;
 }
 
-FindResult SarcGetFileFromIndex(u8* sarcData, u16 nodeIndex) {
-    SarcFileHeader* fileHeader = (SarcFileHeader*)sarcData;
-
-    u8* dataStart = sarcData + fileHeader->dataStart;
-
-    SfatHeader* sfatHeader = (SfatHeader*)(sarcData + fileHeader->headerSize);
+// Applies "<extension>=<bytes>" or "default=<bytes>". Returns FALSE if the
+// spec is malformed or the alignment isn't a power of two up to 4096.
+int SarcSetAlignment(const char* spec) {
+    const char* equals = strchr(spec, '=');
+    if (equals == NULL || equals == spec)
+        return FALSE;
+
+    u32 extensionLength = equals - spec;
+    if (spec[0] == '.') {
+        spec++;
+        extensionLength--;
+    }
 
-    FindResult result;
-    result.ptr = NULL;
-    result.size = 0;
+    char* end;
+    long alignment = strtol(equals + 1, &end, 10);
+    if (
+        *end != '\0' || alignment <= 0 || alignment > SARC_MAX_ALIGNMENT ||
+        (alignment & (alignment - 1)) != 0
+    )
+        return FALSE;
 
-    if (nodeIndex >= sfatHeader->nodeCount)
-        return result;
+    if (extensionLength == 0 || extensionLength >= sizeof(sarcAlignments[0].extension))
+        return FALSE;
 
-    SfatNode* node =
-        ((SfatNode*)((u8*)sfatHeader + sfatHeader->headerSize)) + nodeIndex;
+    char extension[sizeof(sarcAlignments[0].extension)];
+    memcpy(extension, spec, extensionLength);
+    extension[extensionLength] = '\0';
 
-    result.ptr = dataStart + node->dataOffsetStart;
-    result.size = node->dataOffsetEnd - node->dataOffsetStart;
+    if (strcasecmp(extension, "default") == 0) {
+        sarcDefaultAlignment = alignment;
+        return TRUE;
+    }
 
-    return result;
-}
+    for (u32 i = 0; i < sarcAlignmentCount; i++) {
+        if (strcasecmp(extension, sarcAlignments[i].extension) == 0) {
+            sarcAlignments[i].alignment = alignment;
+            return TRUE;
+        }
+    }
 
-FindResult SarcFindFile(u8* sarcData, const char* name) {
-    SarcFileHeader* fileHeader = (SarcFileHeader*)sarcData;
+    if (sarcAlignmentCount == SARC_MAX_ALIGNMENTS)
+        return FALSE;
 
-    u8* dataStart = sarcData + fileHeader->dataStart;
+    strcpy(sarcAlignments[sarcAlignmentCount].extension, extension);
+    sarcAlignments[sarcAlignmentCount].alignment = alignment;
+    sarcAlignmentCount++;
 
-    SfatHeader* sfatHeader = (SfatHeader*)(sarcData + fileHeader->headerSize);
-    u32 nameHash = GetHash(name, strlen(name), sfatHeader->hashKey);
+    return TRUE;
+}
 
-    FindResult result;
-    result.ptr = NULL;
-    result.size = 0;
+u64 I_SarcBuildHashData(const u8* data, u32 size) {
+    u64 hash = size * 0x9E3779B97F4A7C15;
 
-    for (u32 i = 0; i < sfatHeader->nodeCount; i++) {
-        SfatNode* node =
-            ((SfatNode*)((u8*)sfatHeader + sfatHeader->headerSize)) + i;
+    u32 i = 0;
+    for (; i + 8 <= size; i += 8) {
+        u64 word;
+        memcpy(&word, data + i, sizeof(u64));
 
-        if (node->nameHash == nameHash) {
-            result.ptr = dataStart + node->dataOffsetStart;
-            result.size = node->dataOffsetEnd - node->dataOffsetStart;
-            break;
-        }
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15;
+        hash ^= hash >> 32;
     }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001B3;
 
-    return result;
+    return hash;
 }
 
 typedef struct {
-    u8* ptr;
-    u32 size;
-} SarcBuildResult;
-
-typedef struct {
-    char* name;
-
-    u8* data;
-    u32 dataSize;
+    u64 hash;
+    u32 node; // + 1; 0 if the slot is free
+} I_SarcBuildPayload;
+
+/*
+    Members with byte-identical data (placeholder textures, repeated layout
+    fragments) share one copy: their nodes point at the same data range.
+    Payloads are found by hash in an open-addressed table & confirmed with a
+    full compare.
+*/
+I_SarcBuildPayload* I_SarcBuildPayloadSlot(
+    I_SarcBuildPayload* table, u32 tableSize, u64 hash,
+    const SarcBuildFile* files, const I_SarcBuildOrder* order, const SarcBuildFile* buildFile
+) {
+    for (u32 slot = (u32)hash & (tableSize - 1);; slot = (slot + 1) & (tableSize - 1)) {
+        I_SarcBuildPayload* payload = table + slot;
+        if (payload->node == 0)
+            return payload;
+
+        if (payload->hash != hash)
+            continue;
 
-    int nil;
-} SarcBuildFile;
+        const SarcBuildFile* other = files + order[payload->node - 1].index;
+        if (
+            other->dataSize == buildFile->dataSize &&
+            memcmp(other->data, buildFile->data, buildFile->dataSize) == 0
+        )
+            return payload;
+    }
+}
 
 SarcBuildResult SarcBuild(SarcBuildFile* files, u32 fileCount) {
     SarcBuildResult result;
 
+    result.duplicateCount = 0;
+    result.duplicateBytes = 0;
+
+    // Also reached with -l, where the archive's members add to the inputs
+    if (fileCount > 0xFFFF)
+        panic("Too many files for a SARC archive (at most 65535).");
+
+    I_SarcBuildOrder* order = I_SarcBuildSortFiles(files, fileCount, SARC_HASH_KEY);
+
     u32 initialSize =
         sizeof(SarcFileHeader) +
         sizeof(SfatHeader) +
         (sizeof(SfatNode) * fileCount);
 
-    printf("Alloc initial buffer (size : %u) ..", initialSize);
+    LOG_VERBOSE("Alloc initial buffer (size : %u) ..", initialSize);
 
     result.ptr = (u8*)malloc(initialSize);
     if (result.ptr == NULL)
         PANIC_MALLOC("initial build buf");
 
-    LOG_OK;
+    LOG_VERBOSE_OK;
 
-    printf("Building file header & SFAT section ..");
+    LOG_VERBOSE("Building file header & SFAT section ..");
 
     SarcFileHeader* fileHeader = (SarcFileHeader*)result.ptr;
     SfatHeader* sfatHeader = (SfatHeader*)(fileHeader + 1);
@@ -282,60 +317,105 @@ SarcBuildResult SarcBuild(SarcBuildFile* files, u32 fileCount) {
     sfatHeader->magic = SFAT_MAGIC;
     sfatHeader->headerSize = sizeof(SfatHeader);
     sfatHeader->nodeCount = fileCount;
-    sfatHeader->hashKey = 0x65;
+    sfatHeader->hashKey = SARC_HASH_KEY;
 
     u32 nextNameOffset = 0;
     u32 nextDataOffset = 0;
 
+    // The data section starts on the strictest member alignment, so offsets
+    // aligned relative to it are aligned in the file too
+    u32 maxAlignment = 32;
+
+    u32 tableSize = 1;
+    while (tableSize < fileCount * 2)
+        tableSize <<= 1;
+
+    I_SarcBuildPayload* payloads = (I_SarcBuildPayload*)calloc(tableSize, sizeof(I_SarcBuildPayload));
+    u8* duplicate = (u8*)calloc(fileCount ? fileCount : 1, sizeof(u8));
+    if (payloads == NULL || duplicate == NULL)
+        PANIC_MALLOC("payload table");
+
     for (u32 i = 0; i < fileCount; i++) {
-        SarcBuildFile* buildFile = files + i;
+        SarcBuildFile* buildFile = files + order[i].index;
         SfatNode* node = (SfatNode*)(sfatHeader + 1) + i;
 
+        if (nextNameOffset > SFAT_NAME_OFFSET_MAX)
+            panic("The member names are too long for a SARC archive.");
+
         if (buildFile->nil) {
-            node->nameHash = GetHash(SARC_DUMMY_NAME, 3, sfatHeader->hashKey);
+            node->nameHash = order[i].hash;
 
-            node->nameOffsetDiv4 = nextNameOffset / 4;
-            node->isNameOffsetAvaliable = 0x0100;
+            node->nameAttribute = SFAT_NAME_PRESENT | (nextNameOffset / 4);
 
             nextNameOffset += SARC_NAME_ALIGN;
 
+            // Placeholders carry no data
             node->dataOffsetStart = nextDataOffset;
-            node->dataOffsetEnd = nextDataOffset + SARC_DATA_ALIGN;
-
-            nextDataOffset += SARC_DATA_ALIGN;
+            node->dataOffsetEnd = nextDataOffset;
 
             continue;
         }
 
-        node->nameHash =
-            GetHash(buildFile->name, strlen(buildFile->name), sfatHeader->hashKey);
+        node->nameHash = order[i].hash;
 
-        node->nameOffsetDiv4 = nextNameOffset / 4;
-        node->isNameOffsetAvaliable = 0x0100;
+        node->nameAttribute = SFAT_NAME_PRESENT | (nextNameOffset / 4);
 
         nextNameOffset += strlen(buildFile->name) + 1;
         if (i + 1 != fileCount)
             nextNameOffset = (nextNameOffset + SARC_NAME_ALIGN - 1) & ~(SARC_NAME_ALIGN - 1);
 
+        u32 alignment = SarcGetAlignment(buildFile->name);
+        if (alignment > maxAlignment)
+            maxAlignment = alignment;
+
+        u64 dataHash = I_SarcBuildHashData(buildFile->data, buildFile->dataSize);
+        I_SarcBuildPayload* payload = I_SarcBuildPayloadSlot(
+            payloads, tableSize, dataHash, files, order, buildFile
+        );
+
+        const SfatNode* original = payload->node != 0 ?
+            (SfatNode*)(sfatHeader + 1) + (payload->node - 1) : NULL;
+
+        // A copy stored for a less strict type can't be shared
+        if (original && (original->dataOffsetStart & (alignment - 1)) == 0) {
+            node->dataOffsetStart = original->dataOffsetStart;
+            node->dataOffsetEnd = original->dataOffsetEnd;
+
+            duplicate[i] = TRUE;
+
+            result.duplicateCount++;
+            result.duplicateBytes += buildFile->dataSize;
+
+            continue;
+        }
+
+        if (original == NULL) {
+            payload->hash = dataHash;
+            payload->node = i + 1;
+        }
+
+        // Only the gaps between payloads are padded; the last one ends the file
+        nextDataOffset = (nextDataOffset + alignment - 1) & ~(alignment - 1);
+
         node->dataOffsetStart = nextDataOffset;
         node->dataOffsetEnd = nextDataOffset + buildFile->dataSize;
 
         nextDataOffset += buildFile->dataSize;
-        if (i + 1 != fileCount)
-            nextDataOffset = (nextDataOffset + SARC_DATA_ALIGN - 1) & ~(SARC_DATA_ALIGN - 1);
     }
 
-    LOG_OK;
+    free(payloads);
+
+    LOG_VERBOSE_OK;
 
     fileHeader->dataStart = (
         initialSize +
         sizeof(SfntHeader) + nextNameOffset +
-        31
-    ) & ~31;
+        maxAlignment - 1
+    ) & ~(maxAlignment - 1);
 
     u32 newSize = fileHeader->dataStart + nextDataOffset;
 
-    printf("Realloc buffer (size : %u) ..", newSize);
+    LOG_VERBOSE("Realloc buffer (size : %u) ..", newSize);
 
     result.ptr = realloc(result.ptr, newSize);
     if (result.ptr == NULL)
@@ -343,12 +423,16 @@ SarcBuildResult SarcBuild(SarcBuildFile* files, u32 fileCount) {
 
     result.size = newSize;
 
+    // Alignment gaps between names & between data blocks are never written;
+    // zero them so the output doesn't depend on what the heap handed back
+    memset(result.ptr + initialSize, 0x00, newSize - initialSize);
+
     fileHeader = (SarcFileHeader*)result.ptr;
     sfatHeader = (SfatHeader*)(fileHeader + 1);
 
     fileHeader->fileSize = newSize;
 
-    LOG_OK;
+    LOG_VERBOSE_OK;
 
     SfntHeader* sfntHeader = (SfntHeader*)(result.ptr + initialSize);
 
@@ -357,10 +441,12 @@ SarcBuildResult SarcBuild(SarcBuildFile* files, u32 fileCount) {
     sfntHeader->_pad16 = 0x0000;
 
     char* nextString = (char*)(sfntHeader + 1);
-    u8* nextData = (u8*)(result.ptr + fileHeader->dataStart);
+    u8* dataBase = (u8*)(result.ptr + fileHeader->dataStart);
+
+    const SfatNode* nodes = (const SfatNode*)(sfatHeader + 1);
 
     for (u32 i = 0; i < fileCount; i++) {
-        SarcBuildFile* buildFile = files + i;
+        SarcBuildFile* buildFile = files + order[i].index;
 
         if (buildFile->name) {
             strcpy(nextString, buildFile->name);
@@ -371,16 +457,13 @@ SarcBuildResult SarcBuild(SarcBuildFile* files, u32 fileCount) {
             nextString += SARC_NAME_ALIGN;
         }
 
-        if (buildFile->data) {
-            memcpy(nextData, buildFile->data, buildFile->dataSize);
-            nextData += (buildFile->dataSize + SARC_DATA_ALIGN - 1) & ~(SARC_DATA_ALIGN - 1);
-        }
-        else {
-            memset(nextData, 0x00, SARC_DATA_ALIGN);
-            nextData += SARC_DATA_ALIGN;
-        }
+        if (buildFile->data && !duplicate[i])
+            memcpy(dataBase + nodes[i].dataOffsetStart, buildFile->data, buildFile->dataSize);
     }
 
+    free(duplicate);
+    free(order);
+
     return result;
 }
 
@@ -0,0 +1,891 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "ctrtools.h"
+
+#include "listWriter.h"
+
+#include "common.h"
+
+/*
+    Daemon mode. Archives stay decompressed between requests, so a preview
+    costs a lookup & a write instead of a process start, a file read & a full
+    inflate.
+
+    Requests are single lines of tab-separated fields; a connection may send
+    any number of them:
+        LIST <archive>                     Members (SARC) or textures (CTPK), as TSV
+        GET <archive> <member>             Raw member data
+        PNG <archive> <member> <texture>   CTPK texture as PNG. member is empty
+                                           when the archive itself is a CTPK
+        STATS                              Cache counters, as TSV
+    Each answer is "OK <size>\n" followed by size bytes, or "ERR <message>\n".
+
+    Archive paths are taken relative to the serve root & resolved with
+    realpath; anything that resolves outside the root, or isn't a regular
+    file, is answered as not found, & errors never carry the server's own
+    error text. The socket is created owner-only (0600).
+
+    Archives (ZLIB-SARC, SARC or CTPK, told apart by magic) are decompressed
+    into a memfd mapping, so members go out with sendfile straight from the
+    cache. Least recently used archives are dropped once the decompressed
+    total exceeds the cache cap; an archive whose file changed is reloaded.
+*/
+
+#define SERVE_DEFAULT_CACHE_SIZE (256ul * 1024 * 1024)
+
+#define SERVE_MAX_CLIENTS 64
+#define SERVE_LINE_MAX 4096
+#define SERVE_SEND_TIMEOUT 5 // Seconds a client may stall a response
+
+#define SERVE_PNG_LEVEL 1 // Previews favour latency over size
+
+typedef struct ServeArchive ServeArchive;
+
+struct ServeArchive {
+    char* path;
+
+    // Identity of the source file; a change means the cached copy is stale
+    dev_t dev;
+    ino_t ino;
+    off_t fileSize;
+    struct timespec mtime;
+
+    int fd; // memfd holding the decompressed archive
+    u8* data;
+    size_t size;
+
+    CtrSarc* sarc; // Exactly one of these is set
+    CtrCtpk* ctpk;
+
+    ServeArchive* prev; // Towards the most recently used
+    ServeArchive* next;
+};
+
+typedef struct {
+    char root[PATH_MAX]; // Canonical, without a trailing '/' (except "/" itself)
+    u32 rootLength;
+
+    ServeArchive* head; // Most recently used
+    ServeArchive* tail;
+
+    u32 count;
+    u64 size; // Decompressed bytes held
+    u64 capacity;
+
+    u64 hits;
+    u64 misses;
+    u64 evictions;
+} ServeCache;
+
+void I_ServeArchiveFree(ServeArchive* archive) {
+    CtrSarcClose(archive->sarc);
+    CtrCtpkClose(archive->ctpk);
+
+    if (archive->data)
+        munmap(archive->data, archive->size);
+    if (archive->fd >= 0)
+        close(archive->fd);
+
+    free(archive->path);
+    free(archive);
+}
+
+#define I_SERVE_LOAD_FAIL(msg) do { error = (msg); goto fail; } while (0)
+
+// Reads & decompresses an archive into a fresh memfd. Returns NULL & sets
+// *errorOut on failure.
+ServeArchive* I_ServeArchiveLoad(const char* path, const struct stat* st, const char** errorOut) {
+    const char* error = NULL;
+
+    u8* source = MAP_FAILED;
+
+    ServeArchive* archive = (ServeArchive*)calloc(1, sizeof(ServeArchive));
+    if (archive == NULL) {
+        *errorOut = CtrStatusString(CTR_ERROR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    archive->fd = -1;
+
+    archive->path = strdup(path);
+    if (archive->path == NULL)
+        I_SERVE_LOAD_FAIL(CtrStatusString(CTR_ERROR_OUT_OF_MEMORY));
+
+    archive->dev = st->st_dev;
+    archive->ino = st->st_ino;
+    archive->fileSize = st->st_size;
+    archive->mtime = st->st_mtim;
+
+    if (st->st_size < 4)
+        I_SERVE_LOAD_FAIL(CtrStatusString(CTR_ERROR_TRUNCATED));
+
+    // path is canonical; a link swapped in since it was resolved is refused
+    int fileFd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fileFd < 0)
+        I_SERVE_LOAD_FAIL("Archive could not be read");
+
+    source = (u8*)mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fileFd, 0);
+    close(fileFd);
+    if (source == MAP_FAILED)
+        I_SERVE_LOAD_FAIL("Archive could not be read");
+
+    // Bare SARC & CTPK files come out as CTR_CODEC_NONE & are just copied
+    CtrCodec codec = CtrCodecDetect(source, st->st_size);
+
+    CtrStatus status = CtrCodecGetDecompressedSize(codec, source, st->st_size, &archive->size);
+    if (status != CTR_OK)
+        I_SERVE_LOAD_FAIL(CtrStatusString(status));
+
+    if (archive->size == 0)
+        I_SERVE_LOAD_FAIL(CtrStatusString(CTR_ERROR_TRUNCATED));
+
+    archive->fd = memfd_create("ctrtools-archive", MFD_CLOEXEC);
+    if (archive->fd < 0 || ftruncate(archive->fd, archive->size) != 0)
+        I_SERVE_LOAD_FAIL(CtrStatusString(CTR_ERROR_OUT_OF_MEMORY));
+
+    archive->data = (u8*)mmap(
+        NULL, archive->size, PROT_READ | PROT_WRITE, MAP_SHARED, archive->fd, 0
+    );
+    if (archive->data == MAP_FAILED) {
+        archive->data = NULL;
+        I_SERVE_LOAD_FAIL(CtrStatusString(CTR_ERROR_OUT_OF_MEMORY));
+    }
+
+    status = CtrCodecDecompressInto(NULL, codec, source, st->st_size, archive->data, archive->size);
+    if (status != CTR_OK)
+        I_SERVE_LOAD_FAIL(CtrStatusString(status));
+
+    munmap(source, st->st_size);
+    source = MAP_FAILED;
+
+    // Handles only read, big endian SARCs included; anything writing to a
+    // cached archive from here on is a bug
+    if (mprotect(archive->data, archive->size, PROT_READ) != 0)
+        I_SERVE_LOAD_FAIL("Archive could not be cached");
+
+    status = memcmp(archive->data, "CTPK", 4) == 0 ?
+        CtrCtpkOpen(NULL, archive->data, archive->size, &archive->ctpk) :
+        CtrSarcOpen(NULL, archive->data, archive->size, &archive->sarc);
+    if (status != CTR_OK)
+        I_SERVE_LOAD_FAIL(CtrStatusString(status));
+
+    return archive;
+
+fail:
+    if (source != MAP_FAILED)
+        munmap(source, st->st_size);
+
+    I_ServeArchiveFree(archive);
+
+    *errorOut = error;
+    return NULL;
+}
+
+void I_ServeCacheUnlink(ServeCache* cache, ServeArchive* archive) {
+    if (archive->prev)
+        archive->prev->next = archive->next;
+    else
+        cache->head = archive->next;
+
+    if (archive->next)
+        archive->next->prev = archive->prev;
+    else
+        cache->tail = archive->prev;
+
+    archive->prev = archive->next = NULL;
+
+    cache->count--;
+    cache->size -= archive->size;
+}
+
+void I_ServeCachePushFront(ServeCache* cache, ServeArchive* archive) {
+    archive->prev = NULL;
+    archive->next = cache->head;
+
+    if (cache->head)
+        cache->head->prev = archive;
+    else
+        cache->tail = archive;
+
+    cache->head = archive;
+
+    cache->count++;
+    cache->size += archive->size;
+}
+
+// Panics if root isn't an existing directory.
+void ServeCacheInit(ServeCache* cache, const char* root, u64 capacity) {
+    memset(cache, 0, sizeof(ServeCache));
+    cache->capacity = capacity;
+
+    struct stat st;
+    if (realpath(root, cache->root) == NULL || stat(cache->root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        LOG_ERROR("Error: the serve root %s is not a directory.\n", root);
+        panic("Invalid serve root");
+    }
+
+    cache->rootLength = strlen(cache->root);
+    if (cache->rootLength == 1)
+        cache->rootLength = 0; // "/": every path is below it
+}
+
+// Resolves a client's archive path against the root into resolved
+// (PATH_MAX). FALSE if it doesn't exist or lies outside the root.
+int I_ServeResolvePath(const ServeCache* cache, const char* path, char* resolved) {
+    char joined[PATH_MAX];
+    if ((u32)snprintf(joined, sizeof(joined), "%s/%s", cache->root, path) >= sizeof(joined))
+        return FALSE;
+
+    if (realpath(joined, resolved) == NULL)
+        return FALSE;
+
+    return
+        strncmp(resolved, cache->root, cache->rootLength) == 0 &&
+        resolved[cache->rootLength] == '/';
+}
+
+void ServeCacheFree(ServeCache* cache) {
+    while (cache->head) {
+        ServeArchive* archive = cache->head;
+
+        I_ServeCacheUnlink(cache, archive);
+        I_ServeArchiveFree(archive);
+    }
+}
+
+// Returns the cached archive for a path below the root, loading it if
+// needed. The archive stays valid until the next call.
+ServeArchive* ServeCacheGet(ServeCache* cache, const char* requestPath, const char** errorOut) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (
+        !I_ServeResolvePath(cache, requestPath, path) ||
+        stat(path, &st) != 0 || !S_ISREG(st.st_mode)
+    ) {
+        LOG_VERBOSE("Refused archive path (%s)\n", requestPath);
+
+        *errorOut = CtrStatusString(CTR_ERROR_NOT_FOUND);
+        return NULL;
+    }
+
+    for (ServeArchive* archive = cache->head; archive; archive = archive->next) {
+        if (strcmp(archive->path, path) != 0)
+            continue;
+
+        I_ServeCacheUnlink(cache, archive);
+
+        if (
+            archive->dev == st.st_dev && archive->ino == st.st_ino &&
+            archive->fileSize == st.st_size &&
+            archive->mtime.tv_sec == st.st_mtim.tv_sec &&
+            archive->mtime.tv_nsec == st.st_mtim.tv_nsec
+        ) {
+            I_ServeCachePushFront(cache, archive);
+
+            cache->hits++;
+            return archive;
+        }
+
+        LOG_VERBOSE("Reloading changed archive (%s)\n", path);
+
+        I_ServeArchiveFree(archive);
+        break;
+    }
+
+    cache->misses++;
+
+    ServeArchive* archive = I_ServeArchiveLoad(path, &st, errorOut);
+    if (archive == NULL)
+        return NULL;
+
+    I_ServeCachePushFront(cache, archive);
+
+    // The new archive is kept even if it alone is over the cap
+    while (cache->size > cache->capacity && cache->tail != archive) {
+        ServeArchive* victim = cache->tail;
+
+        LOG_VERBOSE("Evicting %s (%lu bytes)\n", victim->path, (u64)victim->size);
+
+        I_ServeCacheUnlink(cache, victim);
+        I_ServeArchiveFree(victim);
+
+        cache->evictions++;
+    }
+
+    return archive;
+}
+
+//////////////////////////////////////// Responses
+
+// Loops over partial writes. Returns FALSE if the client went away.
+int I_ServeWritev(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (u8*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return TRUE;
+}
+
+int I_ServeSendError(int fd, const char* message) {
+    char header[256];
+    int length = snprintf(header, sizeof(header), "ERR %s\n", message);
+
+    struct iovec iov = { header, (size_t)length };
+    return I_ServeWritev(fd, &iov, 1);
+}
+
+// Header & body leave in one writev; the body isn't copied.
+int I_ServeSendBuffer(int fd, const void* data, size_t size) {
+    char header[32];
+    int length = snprintf(header, sizeof(header), "OK %lu\n", (u64)size);
+
+    struct iovec iov[2] = {
+        { header, (size_t)length },
+        { (void*)data, size }
+    };
+    return I_ServeWritev(fd, iov, 2);
+}
+
+// Sends size bytes at offset of a cached archive with sendfile, falling back
+// to a plain write where the kernel can't splice from a memfd.
+int I_ServeSendArchiveRange(int fd, const ServeArchive* archive, size_t offset, size_t size) {
+    char header[32];
+    int length = snprintf(header, sizeof(header), "OK %lu\n", (u64)size);
+
+    struct iovec iov = { header, (size_t)length };
+    if (!I_ServeWritev(fd, &iov, 1))
+        return FALSE;
+
+    off_t fileOffset = offset;
+    size_t remaining = size;
+
+    while (remaining > 0) {
+        ssize_t sent = sendfile(fd, archive->fd, &fileOffset, remaining);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL || errno == ENOSYS)
+                break;
+            return FALSE;
+        }
+        if (sent == 0)
+            return FALSE;
+
+        remaining -= sent;
+    }
+
+    if (remaining > 0) {
+        struct iovec rest = { archive->data + fileOffset, remaining };
+        return I_ServeWritev(fd, &rest, 1);
+    }
+
+    return TRUE;
+}
+
+//////////////////////////////////////// Requests
+
+int I_ServeList(int fd, const ServeArchive* archive) {
+    static const char* const sarcColumns[] = { "name", "hash", "offset", "size" };
+    static const char* const ctpkColumns[] = {
+        "path", "format", "width", "height", "dataOffset", "dataSize"
+    };
+
+    char* text = NULL;
+    size_t textSize = 0;
+
+    FILE* fp = open_memstream(&text, &textSize);
+    if (fp == NULL)
+        return I_ServeSendError(fd, CtrStatusString(CTR_ERROR_OUT_OF_MEMORY));
+
+    ListWriter writer;
+    CtrStatus status = CTR_OK;
+
+    if (archive->sarc) {
+        ListBegin(&writer, fp, LIST_FORMAT_TSV, sarcColumns, 4);
+
+        for (u32 i = 0; i < CtrSarcGetEntryCount(archive->sarc) && status == CTR_OK; i++) {
+            CtrSarcEntry entry;
+            status = CtrSarcGetEntry(archive->sarc, i, &entry);
+            if (status != CTR_OK)
+                break;
+
+            ListRecordBegin(&writer);
+            ListFieldString(&writer, "name", entry.name ? entry.name : "");
+            ListFieldHex32(&writer, "hash", entry.nameHash);
+            ListFieldU64(&writer, "offset", entry.offset);
+            ListFieldU64(&writer, "size", entry.size);
+            ListRecordEnd(&writer);
+        }
+    }
+    else {
+        ListBegin(&writer, fp, LIST_FORMAT_TSV, ctpkColumns, 6);
+
+        for (u32 i = 0; i < CtrCtpkGetTextureCount(archive->ctpk); i++) {
+            CtrCtpkTexture texture;
+            status = CtrCtpkGetTexture(archive->ctpk, i, &texture);
+            if (status != CTR_OK)
+                break;
+
+            ListRecordBegin(&writer);
+            ListFieldString(&writer, "path", texture.path);
+            ListFieldString(&writer, "format", CtrCtpkFormatName(texture.format));
+            ListFieldU64(&writer, "width", texture.width);
+            ListFieldU64(&writer, "height", texture.height);
+            ListFieldU64(&writer, "dataOffset", texture.dataOffset);
+            ListFieldU64(&writer, "dataSize", texture.dataSize);
+            ListRecordEnd(&writer);
+        }
+    }
+
+    ListEnd(&writer);
+    fclose(fp);
+
+    int result = status == CTR_OK ?
+        I_ServeSendBuffer(fd, text, textSize) :
+        I_ServeSendError(fd, CtrStatusString(status));
+
+    free(text);
+    return result;
+}
+
+int I_ServeGet(int fd, const ServeArchive* archive, const char* member) {
+    if (!archive->sarc)
+        return I_ServeSendError(fd, "Archive is not a SARC");
+
+    u32 index;
+    CtrSarcEntry entry;
+
+    CtrStatus status = CtrSarcFind(archive->sarc, member, &index);
+    if (status == CTR_OK)
+        status = CtrSarcGetEntry(archive->sarc, index, &entry);
+    if (status != CTR_OK)
+        return I_ServeSendError(fd, CtrStatusString(status));
+
+    return I_ServeSendArchiveRange(fd, archive, entry.offset, entry.size);
+}
+
+int I_ServePngWrite(void* user, const void* data, size_t size) {
+    return fwrite(data, 1, size, (FILE*)user) != size;
+}
+
+int I_ServePngRows(void* user, uint32_t y, uint32_t rowCount, const uint32_t* pixels) {
+    return CtrPngWriterAddRows((CtrPngWriter*)user, pixels, rowCount) != CTR_OK;
+}
+
+int I_ServePng(int fd, const ServeArchive* archive, const char* member, const char* texturePath) {
+    CtrCtpk* ctpk = archive->ctpk;
+    CtrStatus status = CTR_OK;
+
+    // A CTPK inside a SARC gets a short-lived handle over the cached member
+    if (member[0] != '\0') {
+        if (!archive->sarc)
+            return I_ServeSendError(fd, "Archive is not a SARC");
+
+        u32 index;
+        CtrSarcEntry entry;
+
+        status = CtrSarcFind(archive->sarc, member, &index);
+        if (status == CTR_OK)
+            status = CtrSarcGetEntry(archive->sarc, index, &entry);
+        if (status == CTR_OK)
+            status = CtrCtpkOpen(NULL, entry.data, entry.size, &ctpk);
+        if (status != CTR_OK)
+            return I_ServeSendError(fd, CtrStatusString(status));
+    }
+    else if (!ctpk)
+        return I_ServeSendError(fd, "Archive is not a CTPK; name the member");
+
+    // Tile rows go straight from the decoder into deflate, so only one row
+    // of pixels is ever held; the PNG collects in memory for the size header
+    char* png = NULL;
+    size_t pngSize = 0;
+
+    FILE* fp = open_memstream(&png, &pngSize);
+    if (fp == NULL)
+        status = CTR_ERROR_OUT_OF_MEMORY;
+
+    u32 index;
+    CtrCtpkTexture texture;
+
+    if (status == CTR_OK)
+        status = CtrCtpkFind(ctpk, texturePath, &index);
+    if (status == CTR_OK)
+        status = CtrCtpkGetTexture(ctpk, index, &texture);
+    if (status == CTR_OK) {
+        CtrPngWriter* writer;
+        status = CtrPngWriterBegin(
+            NULL, texture.width, texture.height, SERVE_PNG_LEVEL,
+            I_ServePngWrite, fp, &writer
+        );
+
+        if (status == CTR_OK) {
+            status = CtrCtpkDecodeTextureRows(ctpk, index, I_ServePngRows, writer);
+
+            // The writer's own failure explains an aborted decode better
+            CtrStatus finishStatus = CtrPngWriterFinish(writer);
+            if (status == CTR_OK || status == CTR_ERROR_ABORTED)
+                status = finishStatus;
+        }
+    }
+
+    if (fp)
+        fclose(fp);
+
+    int result = status == CTR_OK ?
+        I_ServeSendBuffer(fd, png, pngSize) :
+        I_ServeSendError(fd, CtrStatusString(status));
+
+    free(png);
+
+    if (ctpk != archive->ctpk)
+        CtrCtpkClose(ctpk);
+
+    return result;
+}
+
+int I_ServeStats(int fd, const ServeCache* cache) {
+    char text[256];
+    int length = snprintf(
+        text, sizeof(text),
+        "archives\tbytes\tcapacity\thits\tmisses\tevictions\n%u\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+        cache->count, cache->size, cache->capacity,
+        cache->hits, cache->misses, cache->evictions
+    );
+
+    return I_ServeSendBuffer(fd, text, length);
+}
+
+// Handles one request line. Returns FALSE if the connection should close.
+int I_ServeRequest(int fd, ServeCache* cache, char* line) {
+    char* fields[4];
+    u32 fieldCount = 0;
+
+    for (char* field = line; fieldCount < 4; ) {
+        fields[fieldCount++] = field;
+
+        char* tab = strchr(field, '\t');
+        if (!tab)
+            break;
+
+        *tab = '\0';
+        field = tab + 1;
+    }
+
+    const char* command = fields[0];
+
+    LOG_VERBOSE("Request: %s%s%s\n", command, fieldCount > 1 ? " " : "", fieldCount > 1 ? fields[1] : "");
+
+    if (strcmp(command, "STATS") == 0)
+        return I_ServeStats(fd, cache);
+
+    u32 expected;
+    if (strcmp(command, "LIST") == 0)
+        expected = 2;
+    else if (strcmp(command, "GET") == 0)
+        expected = 3;
+    else if (strcmp(command, "PNG") == 0)
+        expected = 4;
+    else
+        return I_ServeSendError(fd, "Unknown request");
+
+    if (fieldCount != expected)
+        return I_ServeSendError(fd, "Wrong number of fields");
+
+    const char* error;
+    ServeArchive* archive = ServeCacheGet(cache, fields[1], &error);
+    if (archive == NULL)
+        return I_ServeSendError(fd, error);
+
+    if (expected == 2)
+        return I_ServeList(fd, archive);
+    if (expected == 3)
+        return I_ServeGet(fd, archive, fields[2]);
+
+    return I_ServePng(fd, archive, fields[2], fields[3]);
+}
+
+//////////////////////////////////////// Server
+
+typedef struct {
+    int fd;
+
+    char line[SERVE_LINE_MAX];
+    u32 length;
+} ServeClient;
+
+volatile sig_atomic_t serveStopRequested = 0;
+
+void I_ServeHandleSignal(int signal) {
+    serveStopRequested = 1;
+}
+
+// Reads what the client sent & answers every complete line. Returns FALSE
+// once the client should be dropped.
+int I_ServeClientRead(ServeClient* client, ServeCache* cache) {
+    ssize_t count = read(client->fd, client->line + client->length, SERVE_LINE_MAX - client->length);
+    if (count < 0 && errno == EINTR)
+        return TRUE;
+    if (count <= 0)
+        return FALSE;
+
+    client->length += count;
+
+    u32 start = 0;
+    for (u32 i = client->length - count; i < client->length; i++) {
+        if (client->line[i] != '\n')
+            continue;
+
+        client->line[i] = '\0';
+        if (i > start && client->line[i - 1] == '\r')
+            client->line[i - 1] = '\0';
+
+        if (!I_ServeRequest(client->fd, cache, client->line + start))
+            return FALSE;
+
+        start = i + 1;
+    }
+
+    memmove(client->line, client->line + start, client->length - start);
+    client->length -= start;
+
+    if (client->length == SERVE_LINE_MAX) {
+        I_ServeSendError(client->fd, "Request too long");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Archive paths in requests are relative to rootPath & confined to it.
+void Serve(const char* socketPath, const char* rootPath, u64 cacheSize) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        panic("The socket path is too long.");
+    strcpy(address.sun_path, socketPath);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+        panic("Failed to create the socket.");
+
+    ServeCache cache;
+    ServeCacheInit(&cache, rootPath, cacheSize);
+
+    // Only a stale socket is replaced, never some other file
+    struct stat st;
+    if (lstat(socketPath, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            panic("The socket path exists & is not a socket.");
+
+        unlink(socketPath);
+    }
+
+    // Owner-only from the moment it exists; chmod alone would leave a window
+    mode_t oldMask = umask(0077);
+    int bound = bind(listenFd, (struct sockaddr*)&address, sizeof(address));
+    umask(oldMask);
+
+    if (bound != 0 || chmod(socketPath, 0600) != 0)
+        panic("Failed to bind the socket.");
+    if (listen(listenFd, 16) != 0)
+        panic("Failed to listen on the socket.");
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // No SA_RESTART, so poll wakes up to notice the stop request
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = I_ServeHandleSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    ServeClient* clients = (ServeClient*)malloc(sizeof(ServeClient) * SERVE_MAX_CLIENTS);
+    if (clients == NULL)
+        PANIC_MALLOC("serve clients");
+    u32 clientCount = 0;
+
+    LOG("Serving %s on %s (cache: %lu MiB) ..\n", cache.root, socketPath, cacheSize / (1024 * 1024));
+
+    while (!serveStopRequested) {
+        struct pollfd fds[SERVE_MAX_CLIENTS + 1];
+
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        for (u32 i = 0; i < clientCount; i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        if (poll(fds, clientCount + 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            panic("poll failed");
+        }
+
+        // Back to front, so dropping a client doesn't skip one
+        for (u32 i = clientCount; i > 0; i--) {
+            if (!fds[i].revents)
+                continue;
+
+            ServeClient* client = clients + i - 1;
+            if (!I_ServeClientRead(client, &cache)) {
+                close(client->fd);
+                *client = clients[--clientCount];
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int clientFd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (clientFd < 0)
+                continue;
+
+            if (clientCount == SERVE_MAX_CLIENTS) {
+                I_ServeSendError(clientFd, "Too many clients");
+                close(clientFd);
+                continue;
+            }
+
+            struct timeval timeout = { SERVE_SEND_TIMEOUT, 0 };
+            setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            clients[clientCount].fd = clientFd;
+            clients[clientCount].length = 0;
+            clientCount++;
+        }
+    }
+
+    LOG("\nStopping (hits: %lu, misses: %lu, evictions: %lu) ..",
+        cache.hits, cache.misses, cache.evictions);
+
+    for (u32 i = 0; i < clientCount; i++)
+        close(clients[i].fd);
+    free(clients);
+
+    ServeCacheFree(&cache);
+
+    close(listenFd);
+    unlink(socketPath);
+
+    LOG_OK;
+}
+
+//////////////////////////////////////// Client
+
+// Stand-in client: sends one request & writes the response body to fpOut.
+// Panics on an ERR response.
+void ServeClientRequest(const char* socketPath, char** fields, u32 fieldCount, FILE* fpOut) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        panic("The socket path is too long.");
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        panic("Failed to create the socket.");
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+        panic("Failed to connect; is the server running?");
+
+    char request[SERVE_LINE_MAX];
+    u32 length = 0;
+
+    for (u32 i = 0; i < fieldCount; i++) {
+        int written = snprintf(
+            request + length, sizeof(request) - length,
+            "%s%s", i ? "\t" : "", fields[i]
+        );
+        if (written < 0 || length + written >= sizeof(request) - 1)
+            panic("The request is too long.");
+
+        length += written;
+    }
+    request[length++] = '\n';
+
+    struct iovec iov = { request, length };
+    if (!I_ServeWritev(fd, &iov, 1))
+        panic("Failed to send the request.");
+
+    // Header line, one byte at a time so no body bytes are consumed
+    char header[512];
+    u32 headerLength = 0;
+
+    while (TRUE) {
+        ssize_t count = read(fd, header + headerLength, 1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            panic("The server closed the connection.");
+
+        if (header[headerLength] == '\n')
+            break;
+        if (++headerLength == sizeof(header) - 1)
+            panic("The response header is too long.");
+    }
+    header[headerLength] = '\0';
+
+    if (strncmp(header, "ERR ", 4) == 0) {
+        LOG_ERROR("Error: %s\n", header + 4);
+        panic("The request failed.");
+    }
+
+    u64 bodySize;
+    if (sscanf(header, "OK %lu", &bodySize) != 1)
+        panic("The response header is malformed.");
+
+    u8 buffer[64 * 1024];
+    while (bodySize > 0) {
+        ssize_t count = read(fd, buffer, bodySize < sizeof(buffer) ? bodySize : sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            panic("The response was cut short.");
+
+        if (fwrite(buffer, 1, count, fpOut) != (size_t)count)
+            panic("The response could not be written.");
+
+        bodySize -= count;
+    }
+
+    close(fd);
+}
+
+#endif
@@ -6,6 +6,8 @@
 
 #include <zlib.h>
 
+#include "ctrtools.h"
+
 #include "common.h"
 
 typedef struct {
@@ -13,86 +15,55 @@ typedef struct {
     u32 size;
 } ZlibResult;
 
-ZlibResult decompressZlib(u8* zlibBinary, u32 binSize) {
+// Unpacks whichever container the binary is in (zlib, Yaz0, LZ11/LZ13 or
+// none). The result comes from allocator (NULL: malloc).
+ZlibResult decompressData(u8* binary, u32 binSize, const CtrAllocator* allocator) {
     ZlibResult result;
-    result.size = __builtin_bswap32(*(u32*)zlibBinary);
-
-    printf("Alloc buffer (size : %u) ..", result.size);
-
-    result.ptr = (u8*)malloc(result.size);
-    if (result.ptr == NULL)
-        PANIC_MALLOC("decompressed buf");
-
-    LOG_OK;
 
-    ///////////////////////////////////////
+    CtrCodec codec = CtrCodecDetect(binary, binSize);
 
-    printf("Init ZLIB ..");
+    LOG("Decompressing (%s) ..", CtrCodecName(codec));
 
-    z_stream sInflate;
-    sInflate.zalloc = Z_NULL;
-    sInflate.zfree = Z_NULL;
-    sInflate.opaque = Z_NULL;
+    void* data;
+    size_t size;
 
-    sInflate.avail_in = binSize - sizeof(u32);
-    sInflate.next_in = zlibBinary + sizeof(u32);
-    sInflate.avail_out = result.size;
-    sInflate.next_out = result.ptr;
+    CtrStatus status = CtrCodecDecompress(allocator, codec, binary, binSize, &data, &size);
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
 
     LOG_OK;
 
-    ///////////////////////////////////////
-
-    printf("Decompressing ..");
+    LOG_VERBOSE("Decompressed size : %lu\n", (u64)size);
 
-    if (inflateInit(&sInflate) != Z_OK)
-        panic("Inflate init failed");
-    if (inflate(&sInflate, Z_NO_FLUSH) != Z_STREAM_END)
-        panic("Inflate fail");
-    inflateEnd(&sInflate);
-
-    LOG_OK;
+    result.ptr = (u8*)data;
+    result.size = size;
 
     return result;
 }
 
-ZlibResult compressData(u8* data, u32 dataSize) {
+// level: Z_BEST_COMPRESSION, or CTR_CODEC_LEVEL_ULTRA for release builds.
+ZlibResult compressData(u8* data, u32 dataSize, CtrCodec codec, int level) {
     ZlibResult result;
 
-    u64 compressedMaxSize = compressBound(dataSize);
-
-    printf("Alloc buffer (size : %lu) ..", compressedMaxSize + 4);
-
-    result.ptr = (u8 *)malloc(compressedMaxSize + 4);
-    if (!result.ptr)
-        PANIC_MALLOC("compressed buf");
-
-    LOG_OK;
-
-    *(u32*)result.ptr = __builtin_bswap32(dataSize);
-
-    z_stream sDeflate;
-    sDeflate.zalloc = Z_NULL;
-    sDeflate.zfree = Z_NULL;
-    sDeflate.opaque = Z_NULL;
-
-    sDeflate.avail_in = dataSize;
-    sDeflate.next_in = data;
-    sDeflate.avail_out = compressedMaxSize;
-    sDeflate.next_out = result.ptr + 4;
-
-    printf("Compressing ..");
+    LOG(
+        "Compressing (%s%s) ..", CtrCodecName(codec),
+        level >= CTR_CODEC_LEVEL_ULTRA ? ", ultra" : ""
+    );
 
-    if (deflateInit(&sDeflate, Z_BEST_COMPRESSION) != Z_OK)
-        panic("Deflate init failed");
-    if (deflate(&sDeflate, Z_FINISH) != Z_STREAM_END)
-        panic("Deflate fail");
+    void* compressed;
+    size_t compressedSize;
 
-    deflateEnd(&sDeflate);
+    CtrStatus status = CtrCodecCompress(
+        NULL, codec, data, dataSize, level,
+        &compressed, &compressedSize
+    );
+    if (status != CTR_OK)
+        panic(CtrStatusString(status));
 
     LOG_OK;
 
-    result.size = sDeflate.total_out + 4;
+    result.ptr = (u8*)compressed;
+    result.size = compressedSize;
 
     return result;
 }